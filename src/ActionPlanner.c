@@ -0,0 +1,657 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#include "project.h"
+
+#define _XOPEN_SOURCE 500 //realpath
+#include "ActionPlanner.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <syslog.h>
+#include <sys/param.h>
+
+#define MODBUS_UNIT_ID_COUNT 256
+
+
+/************************************************************************/
+/** @ brief function code of a merged action
+ *  
+ *  @param[out] pu32MaxCount_p max register count of a merged action
+ *  @return function code of a merged action, 0 if actions with this
+ *          function code are not merged
+ *  
+ *  single and multiple writes are merged into one multiple write
+ */
+/************************************************************************/
+static EModbusFunction getMergedFunction(EModbusFunction eFunctionCode_p, uint32_t *pu32MaxCount_p)
+{
+    switch (eFunctionCode_p)
+    {
+    case eREAD_HOLDING_REGISTERS:
+        *pu32MaxCount_p = MAX_MODBUS_READ_HOLDING_REGISTERS_COUNT;
+        return eREAD_HOLDING_REGISTERS;
+    case eREAD_INPUT_REGISTERS:
+        *pu32MaxCount_p = MAX_MODBUS_READ_INPUT_REGISTERS_COUNT;
+        return eREAD_INPUT_REGISTERS;
+    case eWRITE_SINGLE_REGISTER:
+    case eWRITE_MULTIPLE_REGISTERS:
+        *pu32MaxCount_p = MAX_MODBUS_WRITE_REGISTERS_COUNT;
+        return eWRITE_MULTIPLE_REGISTERS;
+    case eWRITE_SINGLE_COIL:
+    case eWRITE_MULTIPLE_COILS:
+        *pu32MaxCount_p = MAX_MODBUS_WRITE_COILS_COUNT;
+        return eWRITE_MULTIPLE_COILS;
+    default:
+        *pu32MaxCount_p = 0;
+        return (EModbusFunction)0;
+    }
+}
+
+static bool isWriteFunction(EModbusFunction eFunctionCode_p)
+{
+    return (eFunctionCode_p == eWRITE_MULTIPLE_REGISTERS) || (eFunctionCode_p == eWRITE_MULTIPLE_COILS);
+}
+
+static uint32_t getActionEndRegister(const TModbusAction *ptModbusAction_p)
+{
+    return ptModbusAction_p->i32uStartRegister + ptModbusAction_p->i16uRegisterCount;
+}
+
+/************************************************************************/
+/** @ brief sort order of the actions for merging
+ *  
+ *  actions which could be merged are adjacent and sorted by their start
+ *  register, all other actions keep their configured order
+ */
+/************************************************************************/
+static int compareActionsForMerging(const void* a, const void* b)
+{
+    const TModbusAction* ptA_l = &((*(struct TMBActionEntry* const*)a)->modbusAction);
+    const TModbusAction* ptB_l = &((*(struct TMBActionEntry* const*)b)->modbusAction);
+    uint32_t u32MaxCount_l;
+    EModbusFunction eMergedA_l = getMergedFunction(ptA_l->eFunctionCode, &u32MaxCount_l);
+    EModbusFunction eMergedB_l = getMergedFunction(ptB_l->eFunctionCode, &u32MaxCount_l);
+
+    if ((eMergedA_l == 0) != (eMergedB_l == 0))
+    {
+        return (eMergedA_l != 0) ? 1 : -1;
+    }
+    if (eMergedA_l != 0)
+    {
+        if (ptA_l->i8uSlaveAddress != ptB_l->i8uSlaveAddress)
+        {
+            return (ptA_l->i8uSlaveAddress < ptB_l->i8uSlaveAddress) ? -1 : 1;
+        }
+        if (eMergedA_l != eMergedB_l)
+        {
+            return (eMergedA_l < eMergedB_l) ? -1 : 1;
+        }
+        if (ptA_l->i32uInterval_us != ptB_l->i32uInterval_us)
+        {
+            return (ptA_l->i32uInterval_us < ptB_l->i32uInterval_us) ? -1 : 1;
+        }
+        if (ptA_l->ePriority != ptB_l->ePriority)
+        {
+            return (ptA_l->ePriority < ptB_l->ePriority) ? -1 : 1;
+        }
+        if (ptA_l->i32uStartRegister != ptB_l->i32uStartRegister)
+        {
+            return (ptA_l->i32uStartRegister < ptB_l->i32uStartRegister) ? -1 : 1;
+        }
+    }
+    //keep the configured order (qsort is not stable)
+    return (ptA_l->i16uActionID < ptB_l->i16uActionID) ? -1 : (ptA_l->i16uActionID > ptB_l->i16uActionID);
+}
+
+/************************************************************************/
+/** @ brief checks if an action can be added to a merged action
+ *  
+ *  @param ptMerged_p first action or merged action
+ *  @param ptNext_p next action in merge order
+ *  @param ptTuning_p tuning parameters of the master
+ *  
+ *  read actions may overlap or leave a gap of unused registers, write
+ *  actions must be exactly contiguous
+ */
+/************************************************************************/
+static bool canMergeActions(const TModbusAction *ptMerged_p, const TModbusAction *ptNext_p, const TModbusMasterTuning *ptTuning_p)
+{
+    uint32_t u32MaxCount_l;
+    uint32_t u32End_l;
+    EModbusFunction eMerged_l = getMergedFunction(ptMerged_p->eFunctionCode, &u32MaxCount_l);
+
+    if ((eMerged_l == 0)
+        || (ptMerged_p->i8uSlaveAddress != ptNext_p->i8uSlaveAddress)
+        || (eMerged_l != getMergedFunction(ptNext_p->eFunctionCode, &u32MaxCount_l))
+        || (ptMerged_p->i32uInterval_us != ptNext_p->i32uInterval_us)
+        || (ptMerged_p->ePriority != ptNext_p->ePriority))
+    {
+        return false;
+    }
+    if (isWriteFunction(eMerged_l))
+    {
+        if (!ptTuning_p->bWriteCoalescing || (ptNext_p->i32uStartRegister != getActionEndRegister(ptMerged_p)))
+        {
+            return false;
+        }
+    }
+    else if ((ptTuning_p->u32ReadCoalesceGap == READ_COALESCING_OFF)
+        || (ptNext_p->i32uStartRegister > getActionEndRegister(ptMerged_p) + ptTuning_p->u32ReadCoalesceGap))
+    {
+        return false;
+    }
+    u32End_l = MAX(getActionEndRegister(ptNext_p), getActionEndRegister(ptMerged_p));
+    return (u32End_l - ptMerged_p->i32uStartRegister) <= u32MaxCount_l;
+}
+
+/************************************************************************/
+/** @ brief creates a merged action for the given configured action
+ *  
+ *  the configured action becomes the first member of the merged action
+ *  which has the same parameters, single writes become multiple writes.
+ *  Status bytes are handled per member.
+ */
+/************************************************************************/
+static struct TMBActionEntry* createMergedAction(struct TMBActionEntry *pFirst_p)
+{
+    struct TMBActionEntry *pMerged_l = calloc(1, sizeof(struct TMBActionEntry));
+    if (pMerged_l == NULL)
+    {
+        return NULL;
+    }
+    uint32_t u32MaxCount_l;
+    pMerged_l->modbusAction = pFirst_p->modbusAction;
+    pMerged_l->modbusAction.eFunctionCode = getMergedFunction(pFirst_p->modbusAction.eFunctionCode, &u32MaxCount_l);
+    SLIST_INIT(&(pMerged_l->modbusAction.tMembers));
+    SLIST_INSERT_HEAD(&(pMerged_l->modbusAction.tMembers), pFirst_p, entries);
+    return pMerged_l;
+}
+
+static void addMergedActionMember(struct TMBActionEntry *pMerged_p, struct TMBActionEntry **ppLastMember_p, struct TMBActionEntry *pNext_p)
+{
+    TModbusAction *ptMerged_l = &(pMerged_p->modbusAction);
+    uint32_t u32End_l = getActionEndRegister(&(pNext_p->modbusAction));
+    if (u32End_l > getActionEndRegister(ptMerged_l))
+    {
+        ptMerged_l->i16uRegisterCount = (uint16_t)(u32End_l - ptMerged_l->i32uStartRegister);
+    }
+    ptMerged_l->u32TurnaroundDelayUs = MAX(ptMerged_l->u32TurnaroundDelayUs, pNext_p->modbusAction.u32TurnaroundDelayUs);
+    SLIST_INSERT_AFTER(*ppLastMember_p, pNext_p, entries);
+    *ppLastMember_p = pNext_p;
+}
+
+
+/************************************************************************/
+/** @ brief merges compatible modbus actions of a master into single requests
+ *  
+ *  @param psModbusConfiguration_p configuration of one modbus master
+ *  @return number of modbus requests of the master, -1 on error
+ *  
+ *  read actions with the same slave, function code, interval and priority
+ *  are merged if the gap between them is at most the tuning parameter
+ *  ReadCoalesceGap. Contiguous register writes (function 6 and 16) are
+ *  merged into one function 16 request and contiguous coil writes
+ *  (function 5 and 15) into one function 15 request if the tuning
+ *  parameter WriteCoalescing is on. A merged request never exceeds the
+ *  max count of its function. The configured actions become members of the merged
+ *  action, the response is scattered to their process image offsets.
+ *  On error the action list is left unchanged.
+ */
+/************************************************************************/
+int32_t planModbusActions(TModbusMasterConfiguration *psModbusConfiguration_p)
+{
+    struct TMBActionListHead *pActionList_l = &(psModbusConfiguration_p->mbActionListHead);
+    const TModbusMasterTuning *ptTuning_l = &(psModbusConfiguration_p->tTuning);
+    struct TMBActionEntry **ppActions_l = NULL;
+    struct TMBActionEntry *pAction_l = NULL;
+    struct TMBActionEntry *pMerged_l = NULL;
+    struct TMBActionEntry *pLastMember_l = NULL;
+    struct TMBActionEntry *pLastPlanned_l = NULL;
+    int32_t i32ActionCount_l = 0;
+    int32_t i32PlannedCount_l = 0;
+    int32_t i;
+
+    SLIST_FOREACH(pAction_l, pActionList_l, entries)
+    {
+        i32ActionCount_l++;
+    }
+    if (((ptTuning_l->u32ReadCoalesceGap == READ_COALESCING_OFF) && !ptTuning_l->bWriteCoalescing) || (i32ActionCount_l < 2))
+    {
+        return i32ActionCount_l;
+    }
+
+    ppActions_l = calloc(i32ActionCount_l, sizeof(struct TMBActionEntry*));
+    if (ppActions_l == NULL)
+    {
+        syslog(LOG_ERR, "Planning modbus actions failed. Memory allocation failed\n");
+        return -1;
+    }
+    i = 0;
+    SLIST_FOREACH(pAction_l, pActionList_l, entries)
+    {
+        ppActions_l[i++] = pAction_l;
+    }
+    qsort(ppActions_l, i32ActionCount_l, sizeof(struct TMBActionEntry*), compareActionsForMerging);
+
+    //rebuild the action list in merge order
+    SLIST_INIT(pActionList_l);
+    for (i = 0; i < i32ActionCount_l; i++)
+    {
+        pAction_l = ppActions_l[i];
+        if ((pMerged_l != NULL) && canMergeActions(&(pMerged_l->modbusAction), &(pAction_l->modbusAction), ptTuning_l))
+        {
+            addMergedActionMember(pMerged_l, &pLastMember_l, pAction_l);
+            continue;
+        }
+        if ((i + 1 < i32ActionCount_l) && canMergeActions(&(pAction_l->modbusAction), &(ppActions_l[i + 1]->modbusAction), ptTuning_l))
+        {
+            struct TMBActionEntry *pNewMerged_l = createMergedAction(pAction_l);
+            if (pNewMerged_l != NULL)
+            {
+                pMerged_l = pNewMerged_l;
+                pLastMember_l = pAction_l;
+                pAction_l = pNewMerged_l;
+            }
+            else
+            {
+                syslog(LOG_ERR, "Merging modbus action %d failed. Memory allocation failed\n", (int)pAction_l->modbusAction.i16uActionID);
+                pMerged_l = NULL;
+            }
+        }
+        else
+        {
+            pMerged_l = NULL;
+        }
+
+        if (pLastPlanned_l == NULL)
+        {
+            SLIST_INSERT_HEAD(pActionList_l, pAction_l, entries);
+        }
+        else
+        {
+            SLIST_INSERT_AFTER(pLastPlanned_l, pAction_l, entries);
+        }
+        pLastPlanned_l = pAction_l;
+        i32PlannedCount_l++;
+    }
+    free(ppActions_l);
+
+    SLIST_FOREACH(pAction_l, pActionList_l, entries)
+    {
+        if (!SLIST_EMPTY(&(pAction_l->modbusAction.tMembers)))
+        {
+            struct TMBActionEntry *pMember_l = NULL;
+            int32_t i32MemberCount_l = 0;
+            SLIST_FOREACH(pMember_l, &(pAction_l->modbusAction.tMembers), entries)
+            {
+                i32MemberCount_l++;
+            }
+            syslog(LOG_INFO, "Modbus slave %d function 0x%02X: %d actions merged into one request of %d registers/coils at %d\n",
+                (int)pAction_l->modbusAction.i8uSlaveAddress,
+                (int)pAction_l->modbusAction.eFunctionCode,
+                i32MemberCount_l,
+                (int)pAction_l->modbusAction.i16uRegisterCount,
+                (int)pAction_l->modbusAction.i32uStartRegister);
+        }
+    }
+    return i32PlannedCount_l;
+}
+
+/************************************************************************/
+/** @ brief connection of an action if the actions are sharded by unit id
+ *  
+ *  @param[in,out] pi32UnitLane_p connection of each unit id, -1 if the unit
+ *                 has no connection yet
+ *  @param[in,out] pi32NextLane_p connection of the next new unit id
+ */
+/************************************************************************/
+static int32_t getUnitLane(const TModbusAction *ptModbusAction_p, int32_t *pi32UnitLane_p, int32_t *pi32NextLane_p, uint32_t u32LaneCount_p)
+{
+    int32_t *pi32Lane_l = &(pi32UnitLane_p[ptModbusAction_p->i8uSlaveAddress]);
+    if (*pi32Lane_l < 0)
+    {
+        *pi32Lane_l = *pi32NextLane_p;
+        *pi32NextLane_p = (*pi32NextLane_p + 1) % u32LaneCount_p;
+    }
+    return *pi32Lane_l;
+}
+
+/************************************************************************/
+/** @ brief frees the merged masters of a master configuration
+ */
+/************************************************************************/
+static void freeMasterMembers(TModbusMasterConfiguration *psModbusConfiguration_p)
+{
+    while (!SLIST_EMPTY(&(psModbusConfiguration_p->tMembers)))
+    {
+        struct TMBMasterConfigEntry *pMember_l = SLIST_FIRST(&(psModbusConfiguration_p->tMembers));
+        SLIST_REMOVE_HEAD(&(psModbusConfiguration_p->tMembers), entries);
+        free(pMember_l);
+    }
+}
+
+/************************************************************************/
+/** @ brief copies the merged masters of a master configuration
+ *  
+ *  @param[out] psDest_p configuration which gets its own copy of the members
+ *  @param[in] psSource_p configuration with the members
+ *  @return '0' if successful, '-1' if the memory allocation failed, the
+ *          destination has no members then
+ */
+/************************************************************************/
+static int32_t copyMasterMembers(TModbusMasterConfiguration *psDest_p, const TModbusMasterConfiguration *psSource_p)
+{
+    struct TMBMasterConfigEntry *pMember_l;
+
+    SLIST_INIT(&(psDest_p->tMembers));
+    SLIST_FOREACH(pMember_l, &(psSource_p->tMembers), entries)
+    {
+        struct TMBMasterConfigEntry *pCopy_l = (struct TMBMasterConfigEntry*)malloc(sizeof(struct TMBMasterConfigEntry));
+        if (pCopy_l == NULL)
+        {
+            freeMasterMembers(psDest_p);
+            return -1;
+        }
+        *pCopy_l = *pMember_l;
+        SLIST_INSERT_HEAD(&(psDest_p->tMembers), pCopy_l, entries);
+    }
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief checks if two device files are the same serial port
+ *  
+ *  symbolic links like /dev/ttyRS485 are resolved if the device exists
+ */
+/************************************************************************/
+static bool isSameSerialPort(const char *pszPathA_p, const char *pszPathB_p)
+{
+    char szRealA_l[PATH_MAX];
+    char szRealB_l[PATH_MAX];
+
+    if ((realpath(pszPathA_p, szRealA_l) != NULL) && (realpath(pszPathB_p, szRealB_l) != NULL))
+    {
+        return (strcmp(szRealA_l, szRealB_l) == 0);
+    }
+    return (strcmp(pszPathA_p, pszPathB_p) == 0);
+}
+
+/************************************************************************/
+/** @ brief checks if two masters use the same tcp endpoint or serial port
+ */
+/************************************************************************/
+static bool isSameEndpoint(const TModbusMasterConfiguration *psA_p, const TModbusMasterConfiguration *psB_p)
+{
+    if (psA_p->tModbusDeviceConfig.eProtocol != psB_p->tModbusDeviceConfig.eProtocol)
+    {
+        return false;
+    }
+    if (psA_p->tModbusDeviceConfig.eProtocol == eProtRTU)
+    {
+        //two masters on one bus would transmit at the same time, so they always share the port
+        return isSameSerialPort(psA_p->tModbusDeviceConfig.uProt.tRtuConfig.sz8DeviceFilePath,
+            psB_p->tModbusDeviceConfig.uProt.tRtuConfig.sz8DeviceFilePath);
+    }
+
+    const TTcpConfig *ptA_l = &(psA_p->tModbusDeviceConfig.uProt.tTcpConfig);
+    const TTcpConfig *ptB_l = &(psB_p->tModbusDeviceConfig.uProt.tTcpConfig);
+
+    return psA_p->tTuning.bSharedConnection
+        && psB_p->tTuning.bSharedConnection
+        && (ptA_l->i32uPort == ptB_l->i32uPort)
+        && (strcmp(ptA_l->szTcpIpAddress, ptB_l->szTcpIpAddress) == 0);
+}
+
+/************************************************************************/
+/** @ brief checks if two rtu masters use the same line settings
+ */
+/************************************************************************/
+static bool isSameSerialSetting(const TRtuConfig *ptA_p, const TRtuConfig *ptB_p)
+{
+    return (ptA_p->i32uBaud == ptB_p->i32uBaud)
+        && (ptA_p->cParity == ptB_p->cParity)
+        && (ptA_p->i8uDatabits == ptB_p->i8uDatabits)
+        && (ptA_p->i8uStopbits == ptB_p->i8uStopbits);
+}
+
+/************************************************************************/
+/** @ brief merges the masters with the same endpoint into one master
+ *  
+ *  @param pMasterList_p list of all master configurations
+ *  @return number of masters which were merged into another one
+ *  
+ *  several master devices often address the same gateway with different
+ *  unit ids. The gateway processes their requests one after the other
+ *  anyway, so they share one connection and one scheduler: the actions of
+ *  the later masters are appended to the first master with this IP address
+ *  and port, the later masters are removed from the list and kept as
+ *  members of the first one, which writes its status to their status bytes
+ *  too. The tuning parameters of the first master apply to all of them.
+ *  Masters with the tuning parameter SharedConnection off are not merged.
+ *  RTU masters on the same serial port are always merged, the thread of the
+ *  first one owns the bus and keeps the gaps between all telegrams. Its
+ *  line settings are used if the others differ.
+ *  Has to be called before planModbusActions() and shardModbusConnections().
+ */
+/************************************************************************/
+int32_t mergeModbusEndpoints(struct TMBMasterConfHead *pMasterList_p)
+{
+    struct TMBMasterConfigEntry *pMaster_l;
+    int32_t i32MergedCount_l = 0;
+
+    SLIST_FOREACH(pMaster_l, pMasterList_p, entries)
+    {
+        TModbusMasterConfiguration *psModbusConfiguration_l = &(pMaster_l->mbMasterConfig);
+        struct TMBMasterConfigEntry *pPrevious_l = pMaster_l;
+        struct TMBActionEntry *pLastAction_l = NULL;
+        struct TMBActionEntry *pAction_l;
+        int32_t i32MemberCount_l = 0;
+
+        SLIST_FOREACH(pAction_l, &(psModbusConfiguration_l->mbActionListHead), entries)
+        {
+            pLastAction_l = pAction_l;
+        }
+
+        while (SLIST_NEXT(pPrevious_l, entries) != NULL)
+        {
+            struct TMBMasterConfigEntry *pOther_l = SLIST_NEXT(pPrevious_l, entries);
+            TModbusMasterConfiguration *psOther_l = &(pOther_l->mbMasterConfig);
+
+            if (!isSameEndpoint(psModbusConfiguration_l, psOther_l))
+            {
+                pPrevious_l = pOther_l;
+                continue;
+            }
+            if ((psModbusConfiguration_l->tModbusDeviceConfig.eProtocol == eProtRTU)
+                && !isSameSerialSetting(&(psModbusConfiguration_l->tModbusDeviceConfig.uProt.tRtuConfig),
+                                        &(psOther_l->tModbusDeviceConfig.uProt.tRtuConfig)))
+            {
+                syslog(LOG_ERR, "Modbus RTU device %s: masters with different line settings, %d baud %c %d %d is used\n",
+                    psModbusConfiguration_l->tModbusDeviceConfig.uProt.tRtuConfig.sz8DeviceFilePath,
+                    (int)psModbusConfiguration_l->tModbusDeviceConfig.uProt.tRtuConfig.i32uBaud,
+                    psModbusConfiguration_l->tModbusDeviceConfig.uProt.tRtuConfig.cParity,
+                    (int)psModbusConfiguration_l->tModbusDeviceConfig.uProt.tRtuConfig.i8uDatabits,
+                    (int)psModbusConfiguration_l->tModbusDeviceConfig.uProt.tRtuConfig.i8uStopbits);
+            }
+
+            //append the actions of the other master, keeping their order
+            while (!SLIST_EMPTY(&(psOther_l->mbActionListHead)))
+            {
+                pAction_l = SLIST_FIRST(&(psOther_l->mbActionListHead));
+                SLIST_REMOVE_HEAD(&(psOther_l->mbActionListHead), entries);
+                if (pLastAction_l == NULL)
+                {
+                    SLIST_INSERT_HEAD(&(psModbusConfiguration_l->mbActionListHead), pAction_l, entries);
+                }
+                else
+                {
+                    SLIST_INSERT_AFTER(pLastAction_l, pAction_l, entries);
+                }
+                pLastAction_l = pAction_l;
+            }
+            psModbusConfiguration_l->i32ActionCount += psOther_l->i32ActionCount;
+            psOther_l->i32ActionCount = 0;
+
+            SLIST_NEXT(pPrevious_l, entries) = SLIST_NEXT(pOther_l, entries);
+            SLIST_INSERT_HEAD(&(psModbusConfiguration_l->tMembers), pOther_l, entries);
+            i32MemberCount_l++;
+        }
+
+        if (i32MemberCount_l == 0)
+        {
+            continue;
+        }
+        if (psModbusConfiguration_l->tModbusDeviceConfig.eProtocol == eProtRTU)
+        {
+            syslog(LOG_INFO, "Modbus RTU device %s: %d masters share the bus\n",
+                psModbusConfiguration_l->tModbusDeviceConfig.uProt.tRtuConfig.sz8DeviceFilePath,
+                (int)i32MemberCount_l + 1);
+        }
+        else
+        {
+            syslog(LOG_INFO, "Modbus TCP IP: %s, Port %d: %d masters share one connection\n",
+                psModbusConfiguration_l->tModbusDeviceConfig.uProt.tTcpConfig.szTcpIpAddress,
+                (int)psModbusConfiguration_l->tModbusDeviceConfig.uProt.tTcpConfig.i32uPort,
+                (int)i32MemberCount_l + 1);
+        }
+        i32MergedCount_l += i32MemberCount_l;
+    }
+    return i32MergedCount_l;
+}
+
+/************************************************************************/
+/** @ brief spreads the actions of a tcp master over several connections
+ *  
+ *  @param pMasterEntry_p configuration entry of one modbus master in the
+ *         list of all masters
+ *  @return number of connections of the master, -1 on error
+ *  
+ *  with the tuning parameter ConnectionCount greater than 1 the actions are
+ *  distributed to additional master configurations which are inserted into
+ *  the list directly after pMasterEntry_p. Each of them is started as its
+ *  own master thread with its own connection and scheduler. The actions are
+ *  assigned by unit id (all actions of a slave share one connection) or
+ *  round robin. No connection is created without actions.
+ *  On error the action list is left unchanged.
+ */
+/************************************************************************/
+int32_t shardModbusConnections(struct TMBMasterConfigEntry *pMasterEntry_p)
+{
+    TModbusMasterConfiguration *psModbusConfiguration_l = &(pMasterEntry_p->mbMasterConfig);
+    struct TMBMasterConfigEntry *apLanes_l[MAX_CONNECTION_COUNT] = { NULL };
+    struct TMBActionEntry *apLastAction_l[MAX_CONNECTION_COUNT] = { NULL };
+    int32_t ai32UnitLane_l[MODBUS_UNIT_ID_COUNT];
+    struct TMBActionEntry *pAction_l = NULL;
+    uint32_t u32LaneCount_l = psModbusConfiguration_l->tTuning.u32ConnectionCount;
+    uint32_t u32UsedLanes_l = 0;
+    int32_t i32NextLane_l = 0;
+    int32_t i32Index_l = 0;
+    uint32_t i;
+
+    //a single lane is the configuration itself, also for masters without actions
+    if ((psModbusConfiguration_l->tModbusDeviceConfig.eProtocol != eProtTCP) || (u32LaneCount_l < 2)
+        || (psModbusConfiguration_l->i32ActionCount < 2))
+    {
+        return 1;
+    }
+    if (u32LaneCount_l > (uint32_t)psModbusConfiguration_l->i32ActionCount)
+    {
+        u32LaneCount_l = (uint32_t)psModbusConfiguration_l->i32ActionCount;
+    }
+
+    //the first lane is the configuration itself, the lanes inherit the tuning but are not sharded again
+    psModbusConfiguration_l->tTuning.u32ConnectionCount = 1;
+    apLanes_l[0] = pMasterEntry_p;
+    for (i = 1; i < u32LaneCount_l; i++)
+    {
+        apLanes_l[i] = (struct TMBMasterConfigEntry*)malloc(sizeof(struct TMBMasterConfigEntry));
+        if (apLanes_l[i] != NULL)
+        {
+            apLanes_l[i]->mbMasterConfig = *psModbusConfiguration_l;
+            apLanes_l[i]->mbMasterConfig.i32ActionCount = 0;
+            SLIST_INIT(&(apLanes_l[i]->mbMasterConfig.mbActionListHead));
+        }
+        //every lane reports to the status bytes of the merged masters too
+        if ((apLanes_l[i] == NULL) || (copyMasterMembers(&(apLanes_l[i]->mbMasterConfig), psModbusConfiguration_l) < 0))
+        {
+            syslog(LOG_ERR, "Sharding modbus actions failed. Memory allocation failed\n");
+            free(apLanes_l[i]);
+            while (--i > 0)
+            {
+                freeMasterMembers(&(apLanes_l[i]->mbMasterConfig));
+                free(apLanes_l[i]);
+            }
+            return -1;
+        }
+    }
+    for (i = 0; i < MODBUS_UNIT_ID_COUNT; i++)
+    {
+        ai32UnitLane_l[i] = -1;
+    }
+
+    //move the actions to their lanes, keeping their order
+    struct TMBActionListHead tActions_l = psModbusConfiguration_l->mbActionListHead;
+    SLIST_INIT(&(psModbusConfiguration_l->mbActionListHead));
+    psModbusConfiguration_l->i32ActionCount = 0;
+    while (!SLIST_EMPTY(&tActions_l))
+    {
+        TModbusMasterConfiguration *psLane_l;
+        int32_t i32Lane_l;
+
+        pAction_l = SLIST_FIRST(&tActions_l);
+        SLIST_REMOVE_HEAD(&tActions_l, entries);
+        if (psModbusConfiguration_l->tTuning.eConnectionSharding == eShardByUnit)
+        {
+            i32Lane_l = getUnitLane(&(pAction_l->modbusAction), ai32UnitLane_l, &i32NextLane_l, u32LaneCount_l);
+        }
+        else
+        {
+            i32Lane_l = i32Index_l % u32LaneCount_l;
+        }
+        i32Index_l++;
+
+        psLane_l = &(apLanes_l[i32Lane_l]->mbMasterConfig);
+        if (apLastAction_l[i32Lane_l] == NULL)
+        {
+            SLIST_INSERT_HEAD(&(psLane_l->mbActionListHead), pAction_l, entries);
+        }
+        else
+        {
+            SLIST_INSERT_AFTER(apLastAction_l[i32Lane_l], pAction_l, entries);
+        }
+        apLastAction_l[i32Lane_l] = pAction_l;
+        psLane_l->i32ActionCount++;
+    }
+
+    //insert the used lanes into the master list, drop lanes without actions (fewer units than connections)
+    for (i = u32LaneCount_l - 1; i > 0; i--)
+    {
+        if (apLanes_l[i]->mbMasterConfig.i32ActionCount == 0)
+        {
+            freeMasterMembers(&(apLanes_l[i]->mbMasterConfig));
+            free(apLanes_l[i]);
+            continue;
+        }
+        SLIST_INSERT_AFTER(pMasterEntry_p, apLanes_l[i], entries);
+        u32UsedLanes_l++;
+    }
+    u32UsedLanes_l++;
+
+    syslog(LOG_INFO, "Modbus TCP IP: %s, Port %d: actions spread over %d connections\n",
+        psModbusConfiguration_l->tModbusDeviceConfig.uProt.tTcpConfig.szTcpIpAddress,
+        (int)psModbusConfiguration_l->tModbusDeviceConfig.uProt.tTcpConfig.i32uPort,
+        (int)u32UsedLanes_l);
+    return (int32_t)u32UsedLanes_l;
+}
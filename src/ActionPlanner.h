@@ -0,0 +1,23 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef MODBUS_ACTION_PLANNER_H_
+#define MODBUS_ACTION_PLANNER_H_
+
+#include "modbusconfig.h"
+
+int32_t planModbusActions(TModbusMasterConfiguration *psModbusConfiguration_p);
+int32_t shardModbusConnections(struct TMBMasterConfigEntry *pMasterEntry_p);
+int32_t mergeModbusEndpoints(struct TMBMasterConfHead *pMasterList_p);
+
+#endif /* MODBUS_ACTION_PLANNER_H_ */
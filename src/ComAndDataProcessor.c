@@ -16,296 +16,499 @@
 #define _POSIX_C_SOURCE 200112L //clock_nanosleep and struct timespec
 #include <time.h>
 #include "ComAndDataProcessor.h"
+#include "ModbusPdu.h"
 #include "modbusconfig.h"
 #include <stdio.h>
 #include <errno.h>
-#include <piTest/piControlIf.h>
+#include "ProcessImage.h"
 #include <sys/param.h>
 #include <assert.h>
 #include <syslog.h>
 #include <pthread.h>
 
-#ifndef MODBUS_MAX_PDU_LENGTH 
-#define MODBUS_MAX_PDU_LENGTH 253
-#endif
 #define MODBUS_ADDRESS_OFFSET 1
 
-pthread_mutex_t mutex_modbus_context = PTHREAD_MUTEX_INITIALIZER;
-
 /************************************************************************/
-/** @ brief processing the given modbus action and updates the process image
+/** @ brief number of modbus requests which are needed for a modbus action
  *  
+ *  @param[in] ptModbusAction_p the modbus action
+ *  @return number of modbus requests, at least 1
+ */
+/************************************************************************/
+uint32_t getModbusActionPduCount(const TModbusAction *ptModbusAction_p)
+{
+    uint16_t u16MaxCount_l = getModbusPduMaxCount(ptModbusAction_p->eFunctionCode);
+    if ((u16MaxCount_l == 0) || (ptModbusAction_p->i16uRegisterCount == 0))
+    {
+        return 1;
+    }
+    return (ptModbusAction_p->i16uRegisterCount + u16MaxCount_l - 1) / u16MaxCount_l;
+}
+
+/************************************************************************/
+/** @ brief reads or writes registers or coils with back to back requests
  *  
  *  @param[in] pModbusContext the pointer to the libmodus device
- *  @param[in] nextEvent the modbus action which has to be processed
- *  @return return value of modbus function if 
- *
- *	data from/to modbus is stored in a buffer. Reading/Writing from/to the
- *	process image is done individual for every modbus action
- *	
+ *  @param[in] ptModbusAction_p the modbus action
+ *  @param[in,out] buffer registers (2 bytes each) or coils (1 byte each)
+ *  @return number of transferred registers/coils, the return value of
+ *          libmodbus if a request failed
+ *  
+ *  an action with more registers than fit into one modbus request is split
+ *  into several requests which are sent directly one after the other
  */
 /************************************************************************/
-int32_t processModbusAction(modbus_t *pModbusContext, tModbusEvent* mb_event, uint8_t *buffer)
+static int32_t transferModbusChunks(modbus_t *pModbusContext, const TModbusAction *ptModbusAction_p, uint8_t *buffer)
 {
-    int32_t len = 0;
+    uint16_t u16MaxCount_l = getModbusPduMaxCount(ptModbusAction_p->eFunctionCode);
+    int32_t address = ptModbusAction_p->i32uStartRegister - MODBUS_ADDRESS_OFFSET;
+    int32_t done = 0;
+
+    while (done < ptModbusAction_p->i16uRegisterCount)
+    {
+        int32_t count = MIN(u16MaxCount_l, ptModbusAction_p->i16uRegisterCount - done);
+        int32_t len;
+        switch (ptModbusAction_p->eFunctionCode)
+        {
+        case eREAD_COILS:
+            len = modbus_read_bits(pModbusContext, address + done, count, &(buffer[done]));
+            break;
+        case eREAD_DISCRETE_INPUTS:
+            len = modbus_read_input_bits(pModbusContext, address + done, count, &(buffer[done]));
+            break;
+        case eREAD_HOLDING_REGISTERS:
+            len = modbus_read_registers(pModbusContext, address + done, count, (uint16_t*)&(buffer[done << 1]));
+            break;
+        case eREAD_INPUT_REGISTERS:
+            len = modbus_read_input_registers(pModbusContext, address + done, count, (uint16_t*)&(buffer[done << 1]));
+            break;
+        case eWRITE_MULTIPLE_COILS:
+            len = modbus_write_bits(pModbusContext, address + done, count, &(buffer[done]));
+            break;
+        case eWRITE_MULTIPLE_REGISTERS:
+            len = modbus_write_registers(pModbusContext, address + done, count, (uint16_t*)&(buffer[done << 1]));
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+        }
+        if (len < 0)
+        {
+            return len;
+        }
+        if (len < count)
+        {
+            return done + len;
+        }
+        done += count;
+    }
+    return done;
+}
+
+/************************************************************************/
+/** @ brief writes the registers read by a modbus action to the process image
+ *  
+ *  @param[in] ptModbusAction_p the processed modbus action
+ *  @param[in] buffer registers read from the slave
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ *  the registers of a merged action are scattered to the process image
+ *  offsets of its members
+ */
+/************************************************************************/
+static int32_t writeRegistersToProcessImage(const TModbusAction *ptModbusAction_p, const uint8_t *buffer)
+{
+    struct TMBActionEntry *pMember_l = NULL;
     int32_t successful = 0;
-    // use a mutex since modbus_ctx is not thread safe
-    pthread_mutex_lock(&mutex_modbus_context);
 
-    //process modbus action
-    switch ((mb_event->ptModbusAction->eFunctionCode))
+    if (SLIST_EMPTY(&(ptModbusAction_p->tMembers)))
     {
-    case eREAD_COILS:
+        return writeProcessImage(ptModbusAction_p->i32uStartByteProcessData,
+            ((uint32_t)(ptModbusAction_p->i16uRegisterCount << 1)),
+            buffer);
+    }
+    SLIST_FOREACH(pMember_l, &(ptModbusAction_p->tMembers), entries)
+    {
+        const TModbusAction *ptMember_l = &(pMember_l->modbusAction);
+        uint32_t u32BufferOffset_l = (ptMember_l->i32uStartRegister - ptModbusAction_p->i32uStartRegister) << 1;
+        successful = writeProcessImage(ptMember_l->i32uStartByteProcessData,
+            ((uint32_t)(ptMember_l->i16uRegisterCount << 1)),
+            &(buffer[u32BufferOffset_l]));
+        if (successful < 0)
         {
-            assert(mb_event->ptModbusAction->i16uRegisterCount <= MODBUS_MAX_READ_BITS);
-            len = modbus_read_bits(pModbusContext,
-                mb_event->ptModbusAction->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
-                mb_event->ptModbusAction->i16uRegisterCount,
-                (uint8_t*)buffer);
-            if (len < mb_event->ptModbusAction->i16uRegisterCount)
-            {
-                break;
-            }
-            for(int32_t i = 0; i < (mb_event->ptModbusAction->i16uRegisterCount); i++)
-            {
-                SPIValue coil_data_l;
-                coil_data_l.i16uAddress = (uint16_t)(mb_event->ptModbusAction->i32uStartByteProcessData + (i / 8));
-                coil_data_l.i8uBit      = ((mb_event->ptModbusAction->i8uStartBitProcessData)+i) % 8;
-                coil_data_l.i8uValue    = buffer[i];
-                successful = piControlSetBitValue(&coil_data_l);
-                if (successful < 0)
-                {
-                    syslog(LOG_ERR, "write to process image failed: %d\n", successful);
-                    break;
-                }
-            }		
-        }   break;
-            
-    case eREAD_DISCRETE_INPUTS:
+            return successful;
+        }
+    }
+    return successful;
+}
+
+/************************************************************************/
+/** @ brief reads the registers of a merged write action from the process image
+ *  
+ *  @param[in] ptModbusAction_p the merged modbus action
+ *  @param[out] buffer registers which are written to the slave
+ *  @return value > 0 if successful, otherwise a value <= 0
+ *  
+ *  the registers are gathered from the process image offsets of the members
+ */
+/************************************************************************/
+static int32_t readMemberRegistersFromProcessImage(const TModbusAction *ptModbusAction_p, uint8_t *buffer)
+{
+    struct TMBActionEntry *pMember_l = NULL;
+    int32_t successful = 0;
+
+    SLIST_FOREACH(pMember_l, &(ptModbusAction_p->tMembers), entries)
+    {
+        const TModbusAction *ptMember_l = &(pMember_l->modbusAction);
+        uint32_t u32BufferOffset_l = (ptMember_l->i32uStartRegister - ptModbusAction_p->i32uStartRegister) << 1;
+        successful = readProcessImage(ptMember_l->i32uStartByteProcessData,
+            ((uint32_t)(ptMember_l->i16uRegisterCount << 1)),
+            &(buffer[u32BufferOffset_l]));
+        if (successful <= 0)
         {
-            assert(mb_event->ptModbusAction->i16uRegisterCount <= MODBUS_MAX_READ_BITS);
-            len = modbus_read_input_bits(pModbusContext,
-                mb_event->ptModbusAction->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
-                mb_event->ptModbusAction->i16uRegisterCount,
-                (uint8_t*)buffer);
-            if (len < mb_event->ptModbusAction->i16uRegisterCount)
-            {
-                break;
-            }
-            for (int32_t i = 0; i < (mb_event->ptModbusAction->i16uRegisterCount); i++)
-            {
-                SPIValue coil_data_l;
-                coil_data_l.i16uAddress = (uint16_t)(mb_event->ptModbusAction->i32uStartByteProcessData + (i / 8));
-                coil_data_l.i8uBit      = ((mb_event->ptModbusAction->i8uStartBitProcessData) + i) % 8;
-                coil_data_l.i8uValue    = buffer[i];
-                successful = piControlSetBitValue(&coil_data_l);
-                if (successful < 0)
-                {
-                    syslog(LOG_ERR, "write to process image failed: %d\n", successful);
-                    break;
-                }
-            }		
-        }   break;
-        
-    case eREAD_HOLDING_REGISTERS:
+            return successful;
+        }
+    }
+    return successful;
+}
+
+/************************************************************************/
+/** @ brief reads the coils of a merged write action from the process image
+ *  
+ *  @param[in] ptModbusAction_p the merged modbus action
+ *  @param[out] buffer coils which are written to the slave, one per byte
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ *  the coils are gathered from the process image offsets of the members
+ */
+/************************************************************************/
+static int32_t readMemberCoilsFromProcessImage(const TModbusAction *ptModbusAction_p, uint8_t *buffer)
+{
+    struct TMBActionEntry *pMember_l = NULL;
+    int32_t successful = 0;
+
+    SLIST_FOREACH(pMember_l, &(ptModbusAction_p->tMembers), entries)
+    {
+        const TModbusAction *ptMember_l = &(pMember_l->modbusAction);
+        uint32_t u32BufferOffset_l = ptMember_l->i32uStartRegister - ptModbusAction_p->i32uStartRegister;
+        successful = readProcessImageBits(ptMember_l->i32uStartByteProcessData,
+            ptMember_l->i8uStartBitProcessData,
+            ptMember_l->i16uRegisterCount,
+            &(buffer[u32BufferOffset_l]));
+        if (successful < 0)
         {
-            assert(mb_event->ptModbusAction->i16uRegisterCount <= MODBUS_MAX_READ_REGISTERS);
-            len = modbus_read_registers(pModbusContext,
-                mb_event->ptModbusAction->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
-                mb_event->ptModbusAction->i16uRegisterCount,
-                (uint16_t*)buffer);
-            if (len < mb_event->ptModbusAction->i16uRegisterCount)
-            {
-                break;
-            }
-            successful = piControlWrite(mb_event->ptModbusAction->i32uStartByteProcessData,
-                ((uint32_t)(mb_event->ptModbusAction->i16uRegisterCount << 1)),
-                buffer);
-            if (successful < 0)
-            {
-                syslog(LOG_ERR, "write to process image failed: %d\n", successful);
-                break;
-            }
-        }   break;
-                
-    case eREAD_INPUT_REGISTERS:
+            return successful;
+        }
+    }
+    return successful;
+}
+
+/************************************************************************/
+/** @ brief writes error message to the status bytes of a modbus action
+ *  
+ *  @param[in] ptModbusAction_p the modbus action, for a merged action
+ *             the status bytes of all members are written
+ *	@param[in] the Modbus or Device error code
+ */
+/************************************************************************/
+void writeActionErrorMessage(const TModbusAction *ptModbusAction_p, uint8_t modbus_error_code_p)
+{
+    struct TMBActionEntry *pMember_l = NULL;
+
+    if (SLIST_EMPTY(&(ptModbusAction_p->tMembers)))
+    {
+        writeErrorMessage(ptModbusAction_p->i32uStatusByteProcessImageOffset, modbus_error_code_p);
+        return;
+    }
+    SLIST_FOREACH(pMember_l, &(ptModbusAction_p->tMembers), entries)
+    {
+        writeErrorMessage(pMember_l->modbusAction.i32uStatusByteProcessImageOffset, modbus_error_code_p);
+    }
+}
+
+
+/************************************************************************/
+/** @ brief reads the data of a write action from the process image
+ *  
+ *  @param[in] ptModbusAction_p the modbus action
+ *  @param[out] buffer registers (2 bytes each) or coils (1 byte each)
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ */
+/************************************************************************/
+static int32_t readActionData(const TModbusAction *ptModbusAction_p, uint8_t *buffer)
+{
+    int32_t successful = 0;
+
+    switch (ptModbusAction_p->eFunctionCode)
+    {
+    case eWRITE_SINGLE_REGISTER:
+    case eWRITE_MULTIPLE_REGISTERS:
         {
-            assert(mb_event->ptModbusAction->i16uRegisterCount <= MODBUS_MAX_READ_REGISTERS);
-            len = modbus_read_input_registers(pModbusContext,
-                mb_event->ptModbusAction->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
-                mb_event->ptModbusAction->i16uRegisterCount,
-                (uint16_t*)buffer);
-            if (len < mb_event->ptModbusAction->i16uRegisterCount)
+            if (SLIST_EMPTY(&(ptModbusAction_p->tMembers)))
             {
-                break;
+                successful = readProcessImage(ptModbusAction_p->i32uStartByteProcessData, ptModbusAction_p->i16uRegisterCount << 1, (uint8_t*)buffer);
             }
-            successful = piControlWrite(mb_event->ptModbusAction->i32uStartByteProcessData,
-                ((uint32_t)(mb_event->ptModbusAction->i16uRegisterCount << 1)),
-                buffer);
-            if (successful < 0)
+            else
             {
-                syslog(LOG_ERR, "write to process image failed: %d\n", successful);
-                break;
+                successful = readMemberRegistersFromProcessImage(ptModbusAction_p, buffer);
             }
-        }   break;
-        
-    case eWRITE_SINGLE_REGISTER:
-        {
-            assert(mb_event->ptModbusAction->i16uRegisterCount == 1);
-            successful = piControlRead(mb_event->ptModbusAction->i32uStartByteProcessData, mb_event->ptModbusAction->i16uRegisterCount << 1, (uint8_t*)buffer);	
             if (successful <= 0)
             {
                 syslog(LOG_ERR, "read from process image failed: %d\n", successful);
-                break;
+                return -1;
             }
-            if (successful >= 0)
-            {
-                int val = buffer[0] + (buffer[1] << 8); // little endian
-                
-                len = modbus_write_register(pModbusContext,
-                    mb_event->ptModbusAction->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
-                    val);
-            }
-        }   break;
-            
-    case eREAD_EXCEPTION_STATUS:
-        {
-            //not implemented in libmodbus
-            syslog(LOG_ERR, "Unknown Modbus function: %d\n", (int8_t)(mb_event->ptModbusAction->eFunctionCode));
         }   break;
-            
+
     case eWRITE_SINGLE_COIL:
+    case eWRITE_MULTIPLE_COILS:
         {
-            assert(mb_event->ptModbusAction->i16uRegisterCount == 1);
-            for (int32_t i = 0; i < (mb_event->ptModbusAction->i16uRegisterCount); i++)
+            if (!SLIST_EMPTY(&(ptModbusAction_p->tMembers)))
             {
-                SPIValue coil_data_l;
-                coil_data_l.i16uAddress = (uint16_t)(mb_event->ptModbusAction->i32uStartByteProcessData + (i / 8));
-                coil_data_l.i8uBit      = ((mb_event->ptModbusAction->i8uStartBitProcessData) + i) % 8;
-                coil_data_l.i8uValue    = 0;
-                successful = piControlGetBitValue(&coil_data_l);
+                successful = readMemberCoilsFromProcessImage(ptModbusAction_p, buffer);
                 if (successful < 0)
                 {
-                    syslog(LOG_ERR, "read to process image failed: %d\n", successful);
-                    break;
+                    syslog(LOG_ERR, "read from process image failed: %d\n", successful);
                 }
-                buffer[i] = coil_data_l.i8uValue;
+                break;
             }
-            if (successful >= 0)
+            successful = readProcessImageBits(ptModbusAction_p->i32uStartByteProcessData,
+                ptModbusAction_p->i8uStartBitProcessData,
+                ptModbusAction_p->i16uRegisterCount,
+                buffer);
+            if (successful < 0)
             {
-                len = modbus_write_bit(pModbusContext,
-                    mb_event->ptModbusAction->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
-                    buffer[0]);
+                syslog(LOG_ERR, "read from process image failed: %d\n", successful);
             }
-
         }   break;
-            
+
+    default:
+        break;
+    }
+    return successful;
+}
+
+/************************************************************************/
+/** @ brief sends the requests of a modbus action with libmodbus
+ *  
+ *  @param[in] pModbusContext the pointer to the libmodus device
+ *  @param[in] ptModbusAction_p the modbus action
+ *  @param[in,out] buffer registers (2 bytes each) or coils (1 byte each)
+ *  @return return value of the libmodbus function
+ *  
+ */
+/************************************************************************/
+static int32_t transferActionData(modbus_t *pModbusContext, const TModbusAction *ptModbusAction_p, uint8_t *buffer)
+{
+    int32_t len = 0;
+
+    switch (ptModbusAction_p->eFunctionCode)
+    {
+    case eREAD_COILS:
+    case eREAD_DISCRETE_INPUTS:
+    case eREAD_HOLDING_REGISTERS:
+    case eREAD_INPUT_REGISTERS:
     case eWRITE_MULTIPLE_COILS:
+    case eWRITE_MULTIPLE_REGISTERS:
         {
-            assert(mb_event->ptModbusAction->i16uRegisterCount <= MODBUS_MAX_WRITE_BITS);
-            for (int32_t i = 0; i < (mb_event->ptModbusAction->i16uRegisterCount); i++)
-            {
-                SPIValue coil_data_l;
-                coil_data_l.i16uAddress = (uint16_t)(mb_event->ptModbusAction->i32uStartByteProcessData + (i / 8));
-                coil_data_l.i8uBit      = ((mb_event->ptModbusAction->i8uStartBitProcessData) + i) % 8;
-                coil_data_l.i8uValue    = 0;
-                successful = piControlGetBitValue(&coil_data_l);
-                if (successful < 0)
-                {
-                    syslog(LOG_ERR, "read from process image failed: %d\n", successful);
-                    break;
-                }
-                buffer[i] = coil_data_l.i8uValue;
-            }
-            if (successful >= 0)
-            {
-                len = modbus_write_bits(pModbusContext,
-                    mb_event->ptModbusAction->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
-                    mb_event->ptModbusAction->i16uRegisterCount,
-                    (uint8_t*)buffer);
-            }
+            assert(ptModbusAction_p->i16uRegisterCount <= MAX_REGISTER_COUNT_PER_ACTION);
+            len = transferModbusChunks(pModbusContext, ptModbusAction_p, buffer);
+        }   break;
 
+    case eWRITE_SINGLE_REGISTER:
+        {
+            assert(ptModbusAction_p->i16uRegisterCount == 1);
+            int val = buffer[0] + (buffer[1] << 8); // little endian
+            len = modbus_write_register(pModbusContext,
+                ptModbusAction_p->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
+                val);
         }   break;
-            
-    case eWRITE_MULTIPLE_REGISTERS:
+
+    case eWRITE_SINGLE_COIL:
         {
-            assert(mb_event->ptModbusAction->i16uRegisterCount <= MODBUS_MAX_WRITE_REGISTERS);
-            successful = piControlRead(mb_event->ptModbusAction->i32uStartByteProcessData, mb_event->ptModbusAction->i16uRegisterCount << 1, (uint8_t*)buffer);	
-            if (successful <= 0)
-            {
-                syslog(LOG_ERR, "read from process image failed: %d\n", successful);
-                break;
-            }
-            if (successful >= 0)
-            {
-                len = modbus_write_registers(pModbusContext,
-                    mb_event->ptModbusAction->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
-                    mb_event->ptModbusAction->i16uRegisterCount,
-                    (uint16_t*)buffer);
-            }
+            assert(ptModbusAction_p->i16uRegisterCount == 1);
+            len = modbus_write_bit(pModbusContext,
+                ptModbusAction_p->i32uStartRegister - MODBUS_ADDRESS_OFFSET,
+                buffer[0]);
         }   break;
-            
+
     case eREPORT_SLAVE_ID:
         {
-            assert(mb_event->ptModbusAction->i16uRegisterCount <= MODBUS_MAX_PDU_LENGTH);
-	        
+            assert(ptModbusAction_p->i16uRegisterCount <= MODBUS_MAX_PDU_LENGTH);
 #if LIBMODBUS_VERSION_CHECK(3,1,2)
 	        len = modbus_report_slave_id(pModbusContext, MAX_REGISTER_SIZE_PER_ACTION, (uint8_t*)buffer);
 #else	
 	        len = modbus_report_slave_id(pModbusContext, (uint8_t*)buffer);
 #endif
+        }   break;
 
-            if (len < ((mb_event->ptModbusAction->i16uRegisterCount) ))
-            {
-                break;
-            }
-            successful = piControlWrite(mb_event->ptModbusAction->i32uStartByteProcessData,
-                ((uint32_t)(mb_event->ptModbusAction->i16uRegisterCount)),
-                buffer);
-            if (successful < 0)
-            {
-                syslog(LOG_ERR, "write to process image failed: %d\n", successful);
-                break;
-            }
+    case eREAD_EXCEPTION_STATUS:
+        {
+            //not implemented in libmodbus
+            syslog(LOG_ERR, "Unknown Modbus function: %d\n", (int8_t)(ptModbusAction_p->eFunctionCode));
         }   break;
-            
+
     default:
         {
-            syslog(LOG_ERR, "Unknown Modbus function: %d\n", (int8_t)(mb_event->ptModbusAction->eFunctionCode));				
+            syslog(LOG_ERR, "Unknown Modbus function: %d\n", (int8_t)(ptModbusAction_p->eFunctionCode));
         }   break;
     }
+    return len;
+}
 
+/************************************************************************/
+/** @ brief writes the response of a read action to the process image
+ *  
+ *  @param[in] ptModbusAction_p the modbus action
+ *  @param[in] buffer registers (2 bytes each) or coils (1 byte each)
+ *  @param[in] len number of registers/coils received
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ *  nothing is written if less than the configured registers were received
+ */
+/************************************************************************/
+static int32_t writeActionData(const TModbusAction *ptModbusAction_p, const uint8_t *buffer, int32_t len)
+{
+    int32_t successful = 0;
+
+    if (len < ptModbusAction_p->i16uRegisterCount)
+    {
+        return 0;
+    }
+    switch (ptModbusAction_p->eFunctionCode)
+    {
+    case eREAD_COILS:
+    case eREAD_DISCRETE_INPUTS:
+        {
+            successful = writeProcessImageBits(ptModbusAction_p->i32uStartByteProcessData,
+                ptModbusAction_p->i8uStartBitProcessData,
+                ptModbusAction_p->i16uRegisterCount,
+                buffer);
+        }   break;
+
+    case eREAD_HOLDING_REGISTERS:
+    case eREAD_INPUT_REGISTERS:
+        {
+            successful = writeRegistersToProcessImage(ptModbusAction_p, buffer);
+        }   break;
+
+    case eREPORT_SLAVE_ID:
+        {
+            successful = writeProcessImage(ptModbusAction_p->i32uStartByteProcessData,
+                ((uint32_t)(ptModbusAction_p->i16uRegisterCount)),
+                buffer);
+        }   break;
+
+    default:
+        break;
+    }
     if (successful < 0)
     {
-        struct timespec tv_sleep;
-            
-        // wait for 100 milliseconds and try again
-        tv_sleep.tv_sec = 0;
-        tv_sleep.tv_nsec = 100*1000*1000;
-        clock_nanosleep(CLOCK_MONOTONIC, 0, &tv_sleep, NULL);
-        
+        syslog(LOG_ERR, "write to process image failed: %d\n", successful);
     }
-    
-    if (len < 0)
+    return successful;
+}
+
+/************************************************************************/
+/** @ brief writes the errno of a failed modbus action to its status bytes
+ */
+/************************************************************************/
+static void writeActionErrno(const TModbusAction *ptModbusAction_p, uint32_t err)
+{
+    // reduce error messages syslog(LOG_ERR, "Modbus function error: %d %d %s\n", err, err - MODBUS_ENOBASE, modbus_strerror(err));
+
+    // Errnos from the modbus lib are bigger than MODBUS_ENOBASE but we have only 1 byte in the process image.
+    // Subtract MODBUS_ENOBASE to get a number between 1 and 15. These number could also occurr as regular errno,
+    // but these number should never occur in this application.
+    if (err > MODBUS_ENOBASE)
+        err -= MODBUS_ENOBASE;
+
+    // write error code to process image
+    writeActionErrorMessage(ptModbusAction_p, (uint8_t)(err));
+}
+
+/************************************************************************/
+/** @ brief processing the given modbus action and updates the process image
+ *  
+ *  
+ *  @param[in] pModbusContext the pointer to the libmodus device
+ *  @param[in] nextEvent the modbus action which has to be processed
+ *  @return return value of modbus function, -1 with errno EIO if the
+ *          process image could not be accessed
+ *
+ *	data from/to modbus is stored in a buffer. Reading/Writing from/to the
+ *	process image is done individual for every modbus action. Actions with
+ *	more registers than fit into one modbus request are split into several
+ *	requests, the process image is accessed once for the whole action.
+ *	
+ */
+/************************************************************************/
+int32_t processModbusAction(modbus_t *pModbusContext, tModbusEvent* mb_event, uint8_t *buffer)
+{
+    int32_t len = 0;
+    int32_t successful = 0;
+
+    successful = prepareModbusAction(mb_event->ptModbusAction, buffer);
+    if (successful >= 0)
+    {
+        // modbus_ctx is owned by the calling thread, only the process image is shared
+        len = transferActionData(pModbusContext, mb_event->ptModbusAction, buffer);
+        successful = completeModbusAction(mb_event->ptModbusAction, buffer, len);
+    }
+
+    if (successful < 0)
     {
-        uint32_t err = errno;
-        // reduce error messages syslog(LOG_ERR, "Modbus function error: %d %d %s\n", err, err - MODBUS_ENOBASE, modbus_strerror(err));
-        
-        // Errnos from the modbus lib are bigger than MODBUS_ENOBASE but we have only 1 byte in the process image.
-        // Subtract MODBUS_ENOBASE to get a number between 1 and 15. These number could also occurr as regular errno,
-        // but these number should never occur in this application.
-        if (err > MODBUS_ENOBASE)
-            err -= MODBUS_ENOBASE;
-        
-        // write error code to process image
-        writeErrorMessage(mb_event->ptModbusAction->i32uStatusByteProcessImageOffset , (uint8_t)(err));
+        //no retry here, the scheduler backs off the failing action
+        errno = EIO;
+        return -1;
     }
-    
-    
-    pthread_mutex_unlock(&mutex_modbus_context);
     return len;
 }
 
+/************************************************************************/
+/** @ brief first step of a modbus action: reads the data of a write action
+ *  
+ *  @param[in] ptModbusAction_p the modbus action
+ *  @param[out] buffer data of a write action read from the process image
+ *  @return value >= 0 if the requests can be sent, otherwise a negative value
+ *  
+ */
+/************************************************************************/
+int32_t prepareModbusAction(const TModbusAction *ptModbusAction_p, uint8_t *buffer)
+{
+    int32_t successful;
+    successful = readActionData(ptModbusAction_p, buffer);
+    return successful;
+}
+
+/************************************************************************/
+/** @ brief last step of a modbus action: updates the process image
+ *  
+ *  @param[in] ptModbusAction_p the modbus action
+ *  @param[in] buffer data of a read action which is written to the process image
+ *  @param[in] len number of registers/coils transferred, negative with errno
+ *             set if the action failed
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ *  the response of a read action is written to the process image, the error
+ *  of a failed action to its status bytes
+ */
+/************************************************************************/
+int32_t completeModbusAction(const TModbusAction *ptModbusAction_p, const uint8_t *buffer, int32_t len)
+{
+    int32_t successful = 0;
+    uint32_t err = errno;
+    if (len < 0)
+    {
+        writeActionErrno(ptModbusAction_p, err);
+    }
+    else
+    {
+        successful = writeActionData(ptModbusAction_p, buffer, len);
+    }
+    return successful;
+}
+
 
 /************************************************************************/
 /** @ brief writes error message to processImage
@@ -319,7 +522,7 @@ int32_t processModbusAction(modbus_t *pModbusContext, tModbusEvent* mb_event, ui
 int32_t writeErrorMessage(uint32_t status_byte_pi_offset_p, uint8_t modbus_error_code_p)
 {
     int32_t successful = -1;
-    successful = piControlWrite(status_byte_pi_offset_p, 1,	(uint8_t*)&(modbus_error_code_p));
+    successful = writeProcessImage(status_byte_pi_offset_p, 1, &(modbus_error_code_p));
     return successful;
 }
 
@@ -341,7 +544,7 @@ int32_t reset_modbus_action_status(uint32_t status_reset_byte_offset_p, uint8_t
     reset_data_l.i8uBit      = status_reset_bit_offset_p;
     reset_data_l.i8uValue    = 0;
     uint8_t reset_data = 0;
-    successful = piControlGetBitValue(&reset_data_l);
+    successful = getProcessImageBit(&reset_data_l);
     if (successful < 0)
     {
         syslog(LOG_ERR, "read from process image failed: %d\n", successful);
@@ -349,14 +552,14 @@ int32_t reset_modbus_action_status(uint32_t status_reset_byte_offset_p, uint8_t
     }
     if (reset_data_l.i8uValue)
     {
-        successful = piControlWrite(status_byte_pi_offset_p, (uint32_t)1, &(reset_data));
+        successful = writeProcessImage(status_byte_pi_offset_p, (uint32_t)1, &(reset_data));
         if (successful < 0)
         {
             syslog(LOG_ERR, "write to process image failed: %d\n", successful);
             return successful;
         }
         reset_data_l.i8uValue = 0;
-        successful = piControlSetBitValue(&reset_data_l);
+        successful = setProcessImageBit(&reset_data_l);
         if (successful < 0)
         {
             syslog(LOG_ERR, "read from process image failed: %d\n", successful);
@@ -366,6 +569,39 @@ int32_t reset_modbus_action_status(uint32_t status_reset_byte_offset_p, uint8_t
     return successful;
 }
 
+/************************************************************************/
+/** @ brief check status reset bits of a modbus action and reset status if neccessarry
+ *  
+ *  @param[in] ptModbusAction_p the modbus action, for a merged action
+ *             the status of all members is checked
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ */
+/************************************************************************/
+int32_t reset_modbus_action_status_of(const TModbusAction *ptModbusAction_p)
+{
+    struct TMBActionEntry *pMember_l = NULL;
+    int32_t successful = 0;
+
+    if (SLIST_EMPTY(&(ptModbusAction_p->tMembers)))
+    {
+        return reset_modbus_action_status(ptModbusAction_p->i32uResetStatusProcessImageByteOffset,
+            ptModbusAction_p->i8uResetStatusProcessImageBitOffset,
+            ptModbusAction_p->i32uStatusByteProcessImageOffset);
+    }
+    SLIST_FOREACH(pMember_l, &(ptModbusAction_p->tMembers), entries)
+    {
+        successful = reset_modbus_action_status(pMember_l->modbusAction.i32uResetStatusProcessImageByteOffset,
+            pMember_l->modbusAction.i8uResetStatusProcessImageBitOffset,
+            pMember_l->modbusAction.i32uStatusByteProcessImageOffset);
+        if (successful < 0)
+        {
+            return successful;
+        }
+    }
+    return successful;
+}
+
 /************************************************************************/
 /** @ brief check status reset bit and reset status if neccessarry
  *  
@@ -380,3 +616,56 @@ int32_t reset_modbus_master_status(uint32_t status_reset_byte_offset_p, uint32_t
 {
     return reset_modbus_action_status(status_reset_byte_offset_p, 0, status_byte_offset_p);
 }
+
+/************************************************************************/
+/** @ brief writes the master status byte of a master
+ *  
+ *  @param[in] psModbusConfiguration_p the master configuration
+ *  @param[in] modbus_error_code_p the status
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ *  the status is written to the status bytes of the masters merged into
+ *  this one as well, they share its connection
+ */
+/************************************************************************/
+int32_t writeMasterErrorMessage(const TModbusMasterConfiguration *psModbusConfiguration_p, uint8_t modbus_error_code_p)
+{
+    struct TMBMasterConfigEntry *pMember_l;
+    int32_t successful = writeErrorMessage(psModbusConfiguration_p->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, modbus_error_code_p);
+
+    SLIST_FOREACH(pMember_l, &(psModbusConfiguration_p->tMembers), entries)
+    {
+        if (writeErrorMessage(pMember_l->mbMasterConfig.tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, modbus_error_code_p) < 0)
+        {
+            successful = -1;
+        }
+    }
+    return successful;
+}
+
+/************************************************************************/
+/** @ brief check the status reset bits of a master and its merged masters
+ *  
+ *  @param[in] psModbusConfiguration_p the master configuration
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ */
+/************************************************************************/
+int32_t reset_modbus_master_status_of(const TModbusMasterConfiguration *psModbusConfiguration_p)
+{
+    struct TMBMasterConfigEntry *pMember_l;
+    int32_t successful = reset_modbus_master_status(
+        psModbusConfiguration_p->tModbusDeviceConfig.i32uDeviceStatusResetByteProcessImageByteOffset,
+        psModbusConfiguration_p->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset);
+
+    SLIST_FOREACH(pMember_l, &(psModbusConfiguration_p->tMembers), entries)
+    {
+        if (reset_modbus_master_status(
+                pMember_l->mbMasterConfig.tModbusDeviceConfig.i32uDeviceStatusResetByteProcessImageByteOffset,
+                pMember_l->mbMasterConfig.tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset) < 0)
+        {
+            successful = -1;
+        }
+    }
+    return successful;
+}
@@ -19,11 +19,18 @@
 
 
 int32_t processModbusAction(modbus_t *pModbusContext, tModbusEvent* nextEvent, uint8_t* buffer);
+uint32_t getModbusActionPduCount(const TModbusAction *ptModbusAction_p);
+int32_t prepareModbusAction(const TModbusAction *ptModbusAction_p, uint8_t *buffer);
+int32_t completeModbusAction(const TModbusAction *ptModbusAction_p, const uint8_t *buffer, int32_t len);
 int32_t writeErrorMessage(uint32_t status_byte_pi_offset_p, uint8_t modbus_error_code_p);
+void writeActionErrorMessage(const TModbusAction *ptModbusAction_p, uint8_t modbus_error_code_p);
 int32_t reset_modbus_action_status(uint32_t status_reset_byte_offset_p,
 								   uint8_t status_reset_bit_offset_p,
 								   uint32_t status_byte_pi_offset_p);
+int32_t reset_modbus_action_status_of(const TModbusAction *ptModbusAction_p);
 int32_t reset_modbus_master_status(uint32_t status_reset_byte_offset_p,
 								   uint32_t status_byte_pi_offset_p);
+int32_t writeMasterErrorMessage(const TModbusMasterConfiguration *psModbusConfiguration_p, uint8_t modbus_error_code_p);
+int32_t reset_modbus_master_status_of(const TModbusMasterConfiguration *psModbusConfiguration_p);
 
 #endif /*MODBUS_PROCESSOR_H_*/
@@ -23,7 +23,13 @@
 #include "Scheduler.h"
 #include "ComAndDataProcessor.h"
 #include "ModbusMasterThread.h"
+#include "ModbusPdu.h"
+#include "ModbusRtuTransport.h"
+#include "ModbusTcpPipeline.h"
+#include "SlaveHealth.h"
+#include "TcpConnection.h"
 #include <syslog.h>
+#include <sys/param.h>
 
 #ifndef _MSC_VER
 #include <sys/time.h>
@@ -35,7 +41,7 @@ struct TMBMasterConfHead mbMasterConfHead;
 
 //#define MODBUS_DEBUG
 
-static int32_t setprio(int prio, int sched)
+int32_t setprio(int prio, int sched)
 {
     struct sched_param param;
     // Set realtime priority for this thread
@@ -50,6 +56,112 @@ static int32_t setprio(int prio, int sched)
 
 const int32_t MAX_CONSECUTIVE_DELAYED_ACTIONS = 5;
 
+/************************************************************************/
+/** @ brief sets the response and byte timeout of a modbus context
+ *  
+ *  @param[in] u32TimeoutUs_p timeout in microseconds
+ */
+/************************************************************************/
+static void setModbusTimeout(modbus_t *pModbusContext, uint32_t u32TimeoutUs_p)
+{
+    struct timeval modbus_timeout;
+    modbus_timeout.tv_sec = u32TimeoutUs_p / s32_microseconds_per_second;
+    modbus_timeout.tv_usec = u32TimeoutUs_p % s32_microseconds_per_second;
+#if LIBMODBUS_VERSION_CHECK(3,1,2)
+    modbus_set_response_timeout(pModbusContext, modbus_timeout.tv_sec, modbus_timeout.tv_usec);
+    modbus_set_byte_timeout(pModbusContext, modbus_timeout.tv_sec, modbus_timeout.tv_usec);
+#else
+    modbus_set_response_timeout(pModbusContext, &modbus_timeout);
+    modbus_set_byte_timeout(pModbusContext, &modbus_timeout);
+#endif
+}
+
+/************************************************************************/
+/** @ brief initializes the adaptive response timeouts of a master
+ *  
+ *  @param[out] ptTimeouts_p response timeout table of the master
+ *  @param[in] pEventListHead_p the scheduler with all actions of the master
+ *  @param[in] ptTuning_p floor and ceiling of the timeouts
+ *  
+ *  until the first round trip time is measured an action uses half of its
+ *  interval as timeout
+ */
+/************************************************************************/
+void initActionTimeouts(TResponseTimeoutTable *ptTimeouts_p, struct suEventListHead *pEventListHead_p, const TModbusMasterTuning *ptTuning_p)
+{
+    struct schedulerEvent* pEvent = NULL;
+    initResponseTimeoutTable(ptTimeouts_p, ptTuning_p->u32ResponseTimeoutFloorUs, ptTuning_p->u32ResponseTimeoutCeilingUs);
+    SCHEDULER_FOREACH(pEvent, pEventListHead_p)
+    {
+        initRttEstimate(ptTimeouts_p, &(pEvent->tRtt), pEvent->ptModbusAction->i32uInterval_us / 2);
+    }
+}
+
+/************************************************************************/
+/** @ brief processes a modbus action with its adaptive response timeout
+ *  
+ *  @param[in] pModbusContext the pointer to the libmodus device
+ *  @param[in] pEvent_p the modbus action which has to be processed
+ *  @param[in] ptTimeouts_p response timeout table of the master
+ *  @param[in,out] pbStaleResponse_p true while a late response of a timed
+ *                 out request may still arrive, NULL if libmodbus
+ *                 recovers the link itself
+ *  @return return value of processModbusAction(), errno is preserved
+ *  
+ *  the round trip time of a successful transaction updates the estimates
+ *  of the action and of the slave, a timeout doubles both timeouts.
+ *  After a timeout the socket is flushed before every request until a
+ *  request succeeds, so a late response does not fail the next action.
+ */
+/************************************************************************/
+static int32_t processTimedModbusAction(modbus_t *pModbusContext, tModbusEvent *pEvent_p, uint8_t *buffer, TResponseTimeoutTable *ptTimeouts_p,
+    bool *pbStaleResponse_p)
+{
+    TRttEstimate *ptActionRtt_l = &(pEvent_p->pSchedulerEvent->tRtt);
+    uint8_t i8uSlaveAddress_l = pEvent_p->ptModbusAction->i8uSlaveAddress;
+    struct timespec tv_start;
+    struct timespec tv_end;
+    struct timespec tv_rtt;
+    int32_t ret_val;
+    int err;
+
+    setModbusTimeout(pModbusContext, getResponseTimeout(ptTimeouts_p, ptActionRtt_l, i8uSlaveAddress_l));
+    if ((pbStaleResponse_p != NULL) && *pbStaleResponse_p)
+    {
+        modbus_flush(pModbusContext);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &tv_start);
+    ret_val = processModbusAction(pModbusContext, pEvent_p, buffer);
+    err = errno;
+    clock_gettime(CLOCK_MONOTONIC, &tv_end);
+
+    if (ret_val >= 0)
+    {
+        if (pbStaleResponse_p != NULL)
+        {
+            *pbStaleResponse_p = false;
+        }
+        timespec_diff(&tv_rtt, &tv_end, &tv_start);
+        //a split action takes several round trips
+        updateResponseTimeout(ptTimeouts_p, ptActionRtt_l, i8uSlaveAddress_l,
+            (uint32_t)(tv_rtt.tv_sec * s32_microseconds_per_second + tv_rtt.tv_nsec / 1000)
+                / getModbusActionPduCount(pEvent_p->ptModbusAction));
+    }
+    else if (err == ETIMEDOUT)
+    {
+        backoffResponseTimeout(ptTimeouts_p, ptActionRtt_l, i8uSlaveAddress_l);
+        if (pbStaleResponse_p != NULL)
+        {
+            modbus_flush(pModbusContext);
+            *pbStaleResponse_p = true;
+        }
+    }
+    errno = err;
+    return ret_val;
+}
+
+
 void cleanupTcpMasterThread(void *ptr)
 {
     modbus_t *pModbusContext = (modbus_t *)ptr;
@@ -72,12 +184,14 @@ void *startTcpMasterThread(void *arg)
     if(setprio(20, SCHED_RR) < 0)
     {
         syslog(LOG_ERR, "Set realtime priority for modbus tcp thread failed\n");
-        writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eInternalError));
+        writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eInternalError));
         return NULL;
     }
     
     
     uint8_t buffer[MAX_REGISTER_SIZE_PER_ACTION] = { 0 };  //max register size for each pictory action
+    TResponseTimeoutTable tTimeouts;
+    TTcpConnection tConnection;
     TTcpConfig *ptTcpConfig_l = &psModbusConfiguration_l->tModbusDeviceConfig.uProt.tTcpConfig;
     modbus_t *pModbusContext = NULL;
     char st8TcpPort[12];
@@ -90,18 +204,15 @@ void *startTcpMasterThread(void *arg)
     if (pModbusContext == NULL)
     {
         syslog(LOG_ERR, "Unable to allocate modbus tcp context\n");
-        writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eNoDevice));
+        writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eNoDevice));
         pthread_exit(0);
     }
 
     pthread_cleanup_push(cleanupTcpMasterThread, pModbusContext);
     //syslog(LOG_ERR, "pthread_cleanup_push %p\n", pModbusContext);
     
-#ifdef STRETCH
+    //the connection is reestablished by this thread, not by libmodbus
     if(modbus_set_error_recovery(pModbusContext, MODBUS_ERROR_RECOVERY_PROTOCOL) < 0)
-#else
-    if(modbus_set_error_recovery(pModbusContext, MODBUS_ERROR_RECOVERY_LINK | MODBUS_ERROR_RECOVERY_PROTOCOL) < 0)
-#endif
     {
         syslog(LOG_ERR, "Set Modbus error recovery mode failed: %s\n", modbus_strerror(errno));
     }
@@ -109,84 +220,87 @@ void *startTcpMasterThread(void *arg)
 #ifdef MODBUS_DEBUG
     modbus_set_debug(pModbusContext, 1);
 #endif
+    initTcpConnection(&tConnection, &(psModbusConfiguration_l->tTuning));
     while (1)
     {
-        if (modbus_connect(pModbusContext) < 0)
+        int iSocket_l = openTcpConnection(&tConnection, ptTcpConfig_l);
+        if (iSocket_l < 0)
         {
-            struct timespec tv_sleep;
-            
             syslog(LOG_ERR, "Modbus connection failed: ip=%s errno=%s\n", ptTcpConfig_l->szTcpIpAddress, modbus_strerror(errno));
-            writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eNoResponseFromDevice));
+            writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eNoResponseFromDevice));
             
-            // wait for 5 seconds and try again
-            tv_sleep.tv_sec = 5;
-            tv_sleep.tv_nsec = 0;
-            clock_nanosleep(CLOCK_MONOTONIC, 0, &tv_sleep, NULL);
+            //jittered exponential backoff up to ReconnectMaxDelay
+            waitTcpReconnect(&tConnection);
         }
         else
         {
+            modbus_set_socket(pModbusContext, iSocket_l);
+            bool bStaleResponse = false;   //a timed out request may still be answered
+
             //init scheduler 
-            struct suEventListHead eventListHead = TAILQ_HEAD_INITIALIZER(eventListHead);
+            struct suEventListHead eventListHead = SCHEDULER_EVENT_LIST_INITIALIZER;
             if (initScheduler(psModbusConfiguration_l->mbActionListHead, &eventListHead) < 0)
             {
                 syslog(LOG_ERR, "Scheduler initialization failed\n");
-                writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eInternalError));
+                writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eInternalError));
                 pthread_exit(0);
             }
+            setSchedulerCatchUpPolicy(&eventListHead,
+                psModbusConfiguration_l->tTuning.eCatchUpPolicy,
+                psModbusConfiguration_l->tTuning.u32MaxCatchUpPeriods);
     
-            //set modbus timeout values according to minimal modbus action interval
-            struct timespec tv_min_interval = { 0, 0 };
-            get_minimal_modbus_action_interval(&tv_min_interval, &eventListHead);
-            struct timeval modbus_timeout = { 0, 0 };
+            //response timeouts are estimated per slave and per action from the measured round trip times
+            initActionTimeouts(&tTimeouts, &eventListHead, &(psModbusConfiguration_l->tTuning));
 
-            //divide the minimal interval by 2 to get an appropriate timeout value
-            if (tv_min_interval.tv_sec % 2 != 0)
+            if (psModbusConfiguration_l->tTuning.u32PipelineDepth > 1)
             {
-                tv_min_interval.tv_nsec = tv_min_interval.tv_nsec + s32_nanoseconds_per_second;
-            }	
-            modbus_timeout.tv_sec = (tv_min_interval.tv_sec / 2);
-            modbus_timeout.tv_usec = ((tv_min_interval.tv_nsec) / 1000 / 2);
-            if ((modbus_timeout.tv_sec <= 0) && (modbus_timeout.tv_usec <= 0))
-            {
-                modbus_timeout.tv_usec = 1;
-                syslog(LOG_ERR, "modbus timeout set to 1 microsecond");
+                //several outstanding requests, matched by the transaction id instead of libmodbus
+                TModbusTcpPipeline tPipeline;
+                if (initTcpPipeline(&tPipeline, modbus_get_socket(pModbusContext), psModbusConfiguration_l->tTuning.u32PipelineDepth) < 0)
+                {
+                    writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eInternalError));
+                    pthread_exit(0);
+                }
+                pthread_cleanup_push(cleanupTcpPipeline, &tPipeline);
+                syslog(LOG_INFO, "Modbus connection established to ip=%s port=%d, pipeline depth %d\n",
+                    ptTcpConfig_l->szTcpIpAddress, ptTcpConfig_l->i32uPort, (int)tPipeline.u32Depth);
+                writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eNoError));
+                runTcpPipeline(&tPipeline, &eventListHead, &tConnection, &tTimeouts, psModbusConfiguration_l);
+                pthread_cleanup_pop(1);
+
+                modbus_close(pModbusContext);
+                cleanupScheduler(&eventListHead);
+                writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eNoResponseFromDevice));
+                waitTcpReconnect(&tConnection);
+                continue;
             }
-	        
-#if LIBMODBUS_VERSION_CHECK(3,1,2)
-	        modbus_set_response_timeout(pModbusContext, modbus_timeout.tv_sec, modbus_timeout.tv_usec);
-	        modbus_set_byte_timeout(pModbusContext, modbus_timeout.tv_sec, modbus_timeout.tv_usec);
-#else	
-	        modbus_set_response_timeout(pModbusContext, &modbus_timeout);
-	        modbus_set_byte_timeout(pModbusContext, &modbus_timeout);
-#endif
 
             tModbusEvent nextEvent;	//next modbus action from scheduler
             struct timespec tv_current = { 0, 0 };
             struct timespec tv_earliest_next_trigger_time = { 0, 0 };
             struct timespec tv_minimal_event_offset = { 0, 0 };
             get_minimal_modbus_event_offset(&tv_minimal_event_offset, &eventListHead);
-
-            int32_t err_cnt = 0;
     
             //for debug: calculate delay
             //int32_t delayedActions = 0;
             //struct timespec tv_tmp = { 0, 0 };	
             syslog(LOG_INFO, "Modbus connection established to ip=%s port=%d\n", ptTcpConfig_l->szTcpIpAddress, ptTcpConfig_l->i32uPort);
-            writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eNoError));
+            writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eNoError));
         
             while (1)
             {
                 getNextEvent(&nextEvent, &eventListHead);
+                if (nextEvent.u32DroppedPeriods > 0)
+                {
+                    syslog(LOG_INFO, "Modbus action %d: %u missed periods dropped\n",
+                        (int)nextEvent.ptModbusAction->i16uActionID,
+                        (unsigned)nextEvent.u32DroppedPeriods);
+                }
 
                 //check if reset status is set and reset status if neccessarry
-                reset_modbus_action_status(
-                    nextEvent.ptModbusAction->i32uResetStatusProcessImageByteOffset,
-                    nextEvent.ptModbusAction->i8uResetStatusProcessImageBitOffset,
-                    nextEvent.ptModbusAction->i32uStatusByteProcessImageOffset);
+                reset_modbus_action_status_of(nextEvent.ptModbusAction);
  
-                reset_modbus_master_status(
-                    psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusResetByteProcessImageByteOffset,
-                    psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset);
+                reset_modbus_master_status_of(psModbusConfiguration_l);
 
 #if 0
                 //calculate delay to check if next modbus command is overdue and print a message
@@ -204,7 +318,7 @@ void *startTcpMasterThread(void *arg)
 #endif
                         if (delayedActions > MAX_CONSECUTIVE_DELAYED_ACTIONS)
                         {
-                            writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eModbusActionBacklog));
+                            writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eModbusActionBacklog));
                         }			
                     }
                 }
@@ -226,7 +340,9 @@ void *startTcpMasterThread(void *arg)
                     syslog(LOG_ERR, "Set Modbus slave address for next command failed: %s\n", modbus_strerror(errno));
                 }
         
-                int32_t ret_val_modbus_action = processModbusAction(pModbusContext, &nextEvent, buffer);
+                int32_t ret_val_modbus_action = processTimedModbusAction(pModbusContext, &nextEvent, buffer, &tTimeouts, &bStaleResponse);
+                int err = errno;
+                reportEventResult(&eventListHead, nextEvent.pSchedulerEvent, ret_val_modbus_action >= 0);
 
                 //store earliest next trigger time for next event
                 clock_gettime(CLOCK_MONOTONIC, &tv_current);
@@ -241,16 +357,23 @@ void *startTcpMasterThread(void *arg)
                         (int32_t)nextEvent.ptModbusAction->eFunctionCode,
                         (int32_t)nextEvent.ptModbusAction->i32uStartRegister,
                         ret_val_modbus_action,
-                        errno);
-                    err_cnt++;
-                    if (err_cnt > 100)
+                        err);
+                    //process image errors are no reason to reconnect
+                    if (err != EIO)
+                    {
+                        reportTcpResponse(&tConnection, isModbusExceptionResponse(err), &tv_current);
+                    }
+                    if (isTcpPeerDead(&tConnection, modbus_get_socket(pModbusContext), &tv_current))
                     {
                         syslog(LOG_ERR,
-                            "Modbus TCP IP: %s, Port %d: too many errors -> restart\n",
+                            "Modbus TCP IP: %s, Port %d: no response -> reconnect\n",
                             ptTcpConfig_l->szTcpIpAddress,
                             ptTcpConfig_l->i32uPort);
                        
                         modbus_close(pModbusContext);
+                        cleanupScheduler(&eventListHead);
+                        writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eNoResponseFromDevice));
+                        waitTcpReconnect(&tConnection);
                         break;
                     }
 #if 0
@@ -276,7 +399,7 @@ void *startTcpMasterThread(void *arg)
                         (int)tv_earliest_next_trigger_time.tv_sec,
                         (int)(tv_earliest_next_trigger_time.tv_nsec / 1000000));
 #endif
-                    err_cnt = 0;                    
+                    reportTcpResponse(&tConnection, true, &tv_current);
                 }
             }
         }
@@ -302,6 +425,58 @@ void cleanupRtuMasterThread(void *ptr)
 }
 
 
+/************************************************************************/
+/** @ brief opens the libmodbus rtu context of a master
+ *  
+ *  @param[out] ppModbusContext_p the connected context, NULL on error
+ *  @return '0' if successful, otherwise '-1', the master status is
+ *          written then
+ */
+/************************************************************************/
+static int32_t openRtuModbusContext(TModbusMasterConfiguration *psModbusConfiguration_p, modbus_t **ppModbusContext_p)
+{
+    TRtuConfig *ptRtuConfig_l = &psModbusConfiguration_p->tModbusDeviceConfig.uProt.tRtuConfig;
+
+    *ppModbusContext_p = modbus_new_rtu(
+        ptRtuConfig_l->sz8DeviceFilePath,
+        ptRtuConfig_l->i32uBaud,
+        ptRtuConfig_l->cParity,
+        ptRtuConfig_l->i8uDatabits,
+        ptRtuConfig_l->i8uStopbits);
+    
+    if (*ppModbusContext_p == NULL)
+    {
+        syslog(LOG_ERR, "Unable to allocate modbus rtu context\n");
+        writeMasterErrorMessage(psModbusConfiguration_p, (uint8_t)(eNoDevice));
+        return -1;
+    }
+    if (modbus_set_error_recovery(*ppModbusContext_p, MODBUS_ERROR_RECOVERY_LINK | MODBUS_ERROR_RECOVERY_PROTOCOL) < 0)
+    {
+        syslog(LOG_ERR, "Set Modbus error recovery mode failed: %s\n", modbus_strerror(errno));
+    }
+        
+#ifdef MODBUS_DEBUG
+    modbus_set_debug(*ppModbusContext_p, 1);
+#endif
+    if (modbus_connect(*ppModbusContext_p) < 0)
+    {
+        syslog(LOG_ERR, "Modbus connection failed: %s\n", modbus_strerror(errno));
+        modbus_free(*ppModbusContext_p);
+        *ppModbusContext_p = NULL;
+        writeMasterErrorMessage(psModbusConfiguration_p, (uint8_t)(eNoResponseFromDevice));
+        return -1;
+    }
+
+#if 0    
+    // the call make no sense because the used ioctl-call is not implmented in most serial drivers.
+    if (modbus_rtu_set_serial_mode(*ppModbusContext_p, MODBUS_RTU_RS485) < 0)
+    {
+        syslog(LOG_ERR, "Set Modbus serial mode failed: %s\n", modbus_strerror(errno));
+    }
+#endif
+    return 0;
+}
+
 void *startRtuMasterThread(void *arg)
 {
     //init modbus device
@@ -326,131 +501,79 @@ void *startRtuMasterThread(void *arg)
     if(setprio(20, SCHED_RR) < 0)
     {
         syslog(LOG_ERR, "Set realtime priority for modbus rtu thread failed\n");
-        writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eInternalError));
+        writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eInternalError));
         return NULL;
     }
     
     
     uint8_t buffer[MAX_REGISTER_SIZE_PER_ACTION] = { 0 };  //max register size for each pictory action
     TRtuConfig *ptRtuConfig_l = &psModbusConfiguration_l->tModbusDeviceConfig.uProt.tRtuConfig;
-    modbus_t *pModbusContext = NULL; 
-    char st8TcpPort[12];
-    snprintf(st8TcpPort, sizeof(st8TcpPort), "%d", psModbusConfiguration_l->tModbusDeviceConfig.uProt.tTcpConfig.i32uPort);
-    
-    pModbusContext = modbus_new_rtu(
-        ptRtuConfig_l->sz8DeviceFilePath,
-        ptRtuConfig_l->i32uBaud,
-        ptRtuConfig_l->cParity,
-        ptRtuConfig_l->i8uDatabits,
-        ptRtuConfig_l->i8uStopbits);
-    
-    if (pModbusContext == NULL)
-    {
-        syslog(LOG_ERR, "Unable to allocate modbus rtu context\n");
-        writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eNoDevice));
-        return NULL;
-    }
-    if (modbus_set_error_recovery(pModbusContext, MODBUS_ERROR_RECOVERY_LINK | MODBUS_ERROR_RECOVERY_PROTOCOL) < 0)
+    bool bNativeTransport_l = (psModbusConfiguration_l->tTuning.eRtuTransport == eRtuTransportNative);
+    modbus_t *pModbusContext = NULL;
+    TModbusRtuTransport tTransport = { .iFd = -1 };
+
+    if (bNativeTransport_l)
     {
-        syslog(LOG_ERR, "Set Modbus error recovery mode failed: %s\n", modbus_strerror(errno));
+        if (openRtuTransport(&tTransport, ptRtuConfig_l) < 0)
+        {
+            syslog(LOG_ERR, "Modbus connection failed: %s\n", modbus_strerror(errno));
+            writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eNoDevice));
+            return NULL;
+        }
+        syslog(LOG_INFO, "Modbus RTU device %s: native transport\n", ptRtuConfig_l->sz8DeviceFilePath);
     }
-        
-#ifdef MODBUS_DEBUG
-    modbus_set_debug(pModbusContext, 1);
-#endif
-    if (modbus_connect(pModbusContext) < 0)
+    else if (openRtuModbusContext(psModbusConfiguration_l, &pModbusContext) < 0)
     {
-        syslog(LOG_ERR, "Modbus connection failed: %s\n", modbus_strerror(errno));
-        modbus_free(pModbusContext);
-        writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eNoResponseFromDevice));
         return NULL;
     }
-
-#if 0    
-    // the call make no sense because the used ioctl-call is not implmented in most serial drivers.
-    if (modbus_rtu_set_serial_mode(pModbusContext, MODBUS_RTU_RS485) < 0)
-    {
-        syslog(LOG_ERR, "Set Modbus serial mode failed: %s\n", modbus_strerror(errno));
-    }
-#endif
     pthread_cleanup_push(cleanupRtuMasterThread, pModbusContext);
+    pthread_cleanup_push(closeRtuTransport, &tTransport);
     //syslog(LOG_ERR, "pthread_cleanup_push %p\n", pModbusContext);
     
 
     //init scheduler
-    struct suEventListHead eventListHead = TAILQ_HEAD_INITIALIZER(eventListHead);
+    struct suEventListHead eventListHead = SCHEDULER_EVENT_LIST_INITIALIZER;
     if(initScheduler(psModbusConfiguration_l->mbActionListHead, &eventListHead) < 0)
     {
+        //the connection is closed by the cleanup handlers
         syslog(LOG_ERR, "Scheduler initialization failed\n");
-        modbus_close(pModbusContext);
-        modbus_free(pModbusContext);
-        writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eInternalError));
+        writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eInternalError));
         pthread_exit(0);
     }
+    setSchedulerCatchUpPolicy(&eventListHead,
+        psModbusConfiguration_l->tTuning.eCatchUpPolicy,
+        psModbusConfiguration_l->tTuning.u32MaxCatchUpPeriods);
     
     
-    //set modbus timeout values according to minimal modbus action interval
-    struct timespec tv_min_interval = { 0, 0 };
-    get_minimal_modbus_action_interval(&tv_min_interval, &eventListHead);
-    struct timeval modbus_timeout = { 0, 0 };
-    //divide the minimal interval by 2 to get an appropriate timeout value
-    if (tv_min_interval.tv_sec % 2 != 0)
-    {
-        tv_min_interval.tv_nsec = tv_min_interval.tv_nsec + s32_nanoseconds_per_second;
-    }	
-    modbus_timeout.tv_sec = (tv_min_interval.tv_sec / 2);
-    modbus_timeout.tv_usec = ((tv_min_interval.tv_nsec) / 1000 / 2);
-    if((modbus_timeout.tv_sec <= 0) && (modbus_timeout.tv_usec <= 0))
-    {
-        modbus_timeout.tv_usec = 1;
-        syslog(LOG_ERR, "modbus timeout set to 1 microsecond");
-    }
-#if LIBMODBUS_VERSION_CHECK(3,1,2)
-	modbus_set_response_timeout(pModbusContext, modbus_timeout.tv_sec, modbus_timeout.tv_usec);
-	modbus_set_byte_timeout(pModbusContext, modbus_timeout.tv_sec, modbus_timeout.tv_usec);	
-#else	
-	modbus_set_response_timeout(pModbusContext, &modbus_timeout);
-	modbus_set_byte_timeout(pModbusContext, &modbus_timeout);
-#endif	
+    //response timeouts are estimated per slave and per action from the measured round trip times
+    TResponseTimeoutTable tTimeouts;
+    initActionTimeouts(&tTimeouts, &eventListHead, &(psModbusConfiguration_l->tTuning));
 
     syslog(LOG_ERR,
-        "modbus rtu action timeout: %d s %d us\n",
-        (int)modbus_timeout.tv_sec,
-        (int)modbus_timeout.tv_usec);
+        "modbus rtu action timeout: %d us .. %d us\n",
+        (int)tTimeouts.u32FloorUs,
+        (int)tTimeouts.u32CeilingUs);
+
+    //a slave which does not answer is only probed from time to time instead of blocking the bus with timeouts
+    TSlaveHealthTable tSlaveHealth;
+    initSlaveHealthTable(&tSlaveHealth,
+        psModbusConfiguration_l->tTuning.u32BreakerThreshold,
+        BREAKER_MIN_PROBE_INTERVAL_US,
+        psModbusConfiguration_l->tTuning.u32BreakerMaxProbeIntervalUs);
     
     tModbusEvent nextEvent;	//next modbus action from scheduler
     struct timespec tv_current = { 0, 0 };
     struct timespec tv_earliest_next_trigger_time = { 0, 0 };
     struct timespec tv_minimal_event_offset = { 0, 0 };
-    //get_minimal_modbus_event_offset(&tv_minimal_event_offset, &eventListHead);
-    get_minimal_modbus_action_interval(&tv_minimal_event_offset, &eventListHead);
-    // devide the minimal interval by the number of actions and by 4
-    // then the time between the transmissions is one quarter of the whole transfer
-    uint64_t minoffset = tv_minimal_event_offset.tv_sec;
-    minoffset *= s32_nanoseconds_per_second;
-    minoffset += tv_minimal_event_offset.tv_nsec;           // convert to nsec
-    minoffset /= psModbusConfiguration_l->i32ActionCount;   // divide by number of actions
-    minoffset /= 4;                                         // divide by 4
-    tv_minimal_event_offset.tv_sec = minoffset / s32_nanoseconds_per_second;
-    tv_minimal_event_offset.tv_nsec = minoffset % s32_nanoseconds_per_second;
+    //the silent interval between two frames (t3.5) follows from the line settings,
+    //slow slaves get their turnaround delay on top of it
+    uint32_t u32FrameGapUs_l = getRtuFrameGapUs(ptRtuConfig_l);
     
     syslog(LOG_ERR,
-        "modbus rtu minimal time between telegrams: %d s %d us\n",
-        (int)tv_minimal_event_offset.tv_sec,
-        (int)(tv_minimal_event_offset.tv_nsec / 1000));
-
-#if 0
-    // set to 1 sec for Berg power meters
-    tv_minimal_event_offset.tv_sec = 1;
-    tv_minimal_event_offset.tv_nsec = 0 * 1000 * 1000;
+        "modbus rtu minimal time between telegrams: %d us\n",
+        (int)u32FrameGapUs_l);
     
-    syslog(LOG_ERR,
-        "modbus rtu minimal time between telegrams forced to: %d s %d us\n",
-        (int)tv_minimal_event_offset.tv_sec,
-        (int)(tv_minimal_event_offset.tv_nsec / 1000));
-#endif
-    
-    writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eNoError));
+    writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eNoError));
     
     //for debug: calculate delay
     //int32_t delayedActions = 0;
@@ -459,6 +582,12 @@ void *startRtuMasterThread(void *arg)
     while (1)
     {
         getNextEvent(&nextEvent, &eventListHead);
+        if (nextEvent.u32DroppedPeriods > 0)
+        {
+            syslog(LOG_INFO, "Modbus action %d: %u missed periods dropped\n",
+                (int)nextEvent.ptModbusAction->i16uActionID,
+                (unsigned)nextEvent.u32DroppedPeriods);
+        }
 
 #if 0
         //check, if reset status is set for this action and reset status if neccessarry
@@ -470,19 +599,14 @@ void *startRtuMasterThread(void *arg)
         {
             //check, if reset status is set for ANY action and reset status if neccessarry
             struct schedulerEvent* pEvent = NULL;
-            TAILQ_FOREACH(pEvent, &eventListHead, events)
+            SCHEDULER_FOREACH(pEvent, &eventListHead)
             {
-                TModbusAction *pModbusAction = pEvent->ptModbusAction;
-                reset_modbus_action_status(pModbusAction->i32uResetStatusProcessImageByteOffset,
-                    pModbusAction->i8uResetStatusProcessImageBitOffset,
-                    pModbusAction->i32uStatusByteProcessImageOffset);
+                reset_modbus_action_status_of(pEvent->ptModbusAction);
             }
         }
 #endif        
         
-        reset_modbus_master_status(
-            psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusResetByteProcessImageByteOffset,
-            psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset);
+        reset_modbus_master_status_of(psModbusConfiguration_l);
 
 #if 0
         //calculate delay to check if next modbus command is overdue
@@ -498,7 +622,7 @@ void *startRtuMasterThread(void *arg)
 #endif
                 if (delayedActions > MAX_CONSECUTIVE_DELAYED_ACTIONS)
                 {
-                    writeErrorMessage(psModbusConfiguration_l->tModbusDeviceConfig.i32uDeviceStatusByteProcessImageOffset, (uint8_t)(eModbusActionBacklog));
+                    writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eModbusActionBacklog));
                 }			
             }
             
@@ -514,17 +638,48 @@ void *startRtuMasterThread(void *arg)
     
         //additional sleep if tv_earliest_next_trigger_time is not yet overdue
         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tv_earliest_next_trigger_time, NULL);
-        
-        //set the modbus slave address for the next command
-        if(modbus_set_slave(pModbusContext, nextEvent.ptModbusAction->i8uSlaveAddress) < 0)
+
+        //actions of a suspended slave are skipped without bus traffic, except for the probes
+        clock_gettime(CLOCK_MONOTONIC, &tv_current);
+        if (!isSlaveRequestAllowed(&tSlaveHealth, nextEvent.ptModbusAction->i8uSlaveAddress, &tv_current))
         {
-            syslog(LOG_ERR, "Set Modbus slave address for next command failed: %s\n", modbus_strerror(errno));
+            writeActionErrorMessage(nextEvent.ptModbusAction, (uint8_t)(eSlaveSuspended));
+            continue;
         }
         
-        int32_t ret_val_modbus_action = processModbusAction(pModbusContext, &nextEvent, buffer);
+        int32_t ret_val_modbus_action;
+        if (bNativeTransport_l)
+        {
+            ret_val_modbus_action = processRtuAction(&tTransport, &nextEvent, buffer, &tTimeouts);
+        }
+        else
+        {
+            //set the modbus slave address for the next command
+            if(modbus_set_slave(pModbusContext, nextEvent.ptModbusAction->i8uSlaveAddress) < 0)
+            {
+                syslog(LOG_ERR, "Set Modbus slave address for next command failed: %s\n", modbus_strerror(errno));
+            }
+            ret_val_modbus_action = processTimedModbusAction(pModbusContext, &nextEvent, buffer, &tTimeouts, NULL);
+        }
+        int err = errno;
+        reportEventResult(&eventListHead, nextEvent.pSchedulerEvent, ret_val_modbus_action >= 0);
         
         //store earliest next trigger time for next event
         clock_gettime(CLOCK_MONOTONIC, &tv_current);
+
+        //process image errors tell nothing about the slave
+        if ((ret_val_modbus_action >= 0) || (err != EIO))
+        {
+            if (reportSlaveResult(&tSlaveHealth, nextEvent.ptModbusAction->i8uSlaveAddress,
+                    (ret_val_modbus_action >= 0) || isModbusExceptionResponse(err), &tv_current))
+            {
+                writeMasterErrorMessage(psModbusConfiguration_l,
+                    (uint8_t)((tSlaveHealth.u32OpenCount > 0) ? eSlaveSuspended : eNoError));
+            }
+        }
+        uint32_t u32GapUs_l = MAX(u32FrameGapUs_l, nextEvent.ptModbusAction->u32TurnaroundDelayUs);
+        tv_minimal_event_offset.tv_sec = u32GapUs_l / 1000000;
+        tv_minimal_event_offset.tv_nsec = (u32GapUs_l % 1000000) * 1000;
         timespec_add(&tv_earliest_next_trigger_time, &tv_current, &tv_minimal_event_offset);	
         
         if (ret_val_modbus_action < 0)
@@ -536,8 +691,8 @@ void *startRtuMasterThread(void *arg)
                 (int32_t)nextEvent.ptModbusAction->eFunctionCode,
                 (int32_t)nextEvent.ptModbusAction->i32uStartRegister,
                 ret_val_modbus_action,
-                errno,
-                errno-MODBUS_ENOBASE);
+                err,
+                err-MODBUS_ENOBASE);
             
 #if 0
             //a modbus timeout could lead to delay times, which exceeds the idle time to the next modbus action.
@@ -568,6 +723,7 @@ void *startRtuMasterThread(void *arg)
 #endif
     }
     pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
     return NULL;
 }
 
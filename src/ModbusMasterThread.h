@@ -15,7 +15,11 @@
 #define MODBUS_MASTER_THREAD_H_
 
 #include "modbusconfig.h"
+#include "Scheduler.h"
+#include "ResponseTimeout.h"
 
+int32_t setprio(int prio, int sched);
+void initActionTimeouts(TResponseTimeoutTable *ptTimeouts_p, struct suEventListHead *pEventListHead_p, const TModbusMasterTuning *ptTuning_p);
 void *startTcpMasterThread(void *arg);
 void *startRtuMasterThread(void *arg);
 
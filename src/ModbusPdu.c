@@ -0,0 +1,310 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#include "project.h"
+
+#include "ModbusPdu.h"
+#include <string.h>
+#include <errno.h>
+
+#define MODBUS_EXCEPTION_FLAG 0x80
+#define MODBUS_COIL_ON 0xFF00
+#define MODBUS_RTU_FIXED_FRAME_GAP_US 1750      //t3.5 above 19200 baud
+#define MODBUS_RTU_FIXED_GAP_BAUD 19200
+
+
+static void putUint16(uint8_t *pDest_p, uint16_t u16Value_p)
+{
+    pDest_p[0] = (uint8_t)(u16Value_p >> 8);
+    pDest_p[1] = (uint8_t)(u16Value_p & 0xFF);
+}
+
+static uint16_t getUint16(const uint8_t *pSrc_p)
+{
+    return (uint16_t)((pSrc_p[0] << 8) | pSrc_p[1]);
+}
+
+static int32_t setPduError(int err)
+{
+    errno = err;
+    return -1;
+}
+
+
+/************************************************************************/
+/** @ brief max number of registers or coils of one modbus request
+ *  
+ *  @return max count of the function, 0 if the function has no count
+ */
+/************************************************************************/
+uint16_t getModbusPduMaxCount(EModbusFunction eFunctionCode_p)
+{
+    switch (eFunctionCode_p)
+    {
+    case eREAD_COILS:
+        return MAX_MODBUS_READ_COILS_COUNT;
+    case eREAD_DISCRETE_INPUTS:
+        return MAX_MODBUS_READ_DISCRETE_INPUTS_COUNT;
+    case eREAD_HOLDING_REGISTERS:
+        return MAX_MODBUS_READ_HOLDING_REGISTERS_COUNT;
+    case eREAD_INPUT_REGISTERS:
+        return MAX_MODBUS_READ_INPUT_REGISTERS_COUNT;
+    case eWRITE_MULTIPLE_COILS:
+        return MAX_MODBUS_WRITE_COILS_COUNT;
+    case eWRITE_MULTIPLE_REGISTERS:
+        return MAX_MODBUS_WRITE_REGISTERS_COUNT;
+    default:
+        return 0;
+    }
+}
+
+/************************************************************************/
+/** @ brief byte offset of a register/coil within the buffer of an action
+ */
+/************************************************************************/
+uint32_t getModbusBufferOffset(EModbusFunction eFunctionCode_p, uint16_t u16Offset_p)
+{
+    switch (eFunctionCode_p)
+    {
+    case eREAD_HOLDING_REGISTERS:
+    case eREAD_INPUT_REGISTERS:
+    case eWRITE_SINGLE_REGISTER:
+    case eWRITE_MULTIPLE_REGISTERS:
+        return (uint32_t)u16Offset_p << 1;
+    default:
+        return u16Offset_p;
+    }
+}
+
+/************************************************************************/
+/** @ brief builds the PDU of a modbus request
+ *  
+ *  @param[in] u16Address_p first register/coil (0 based protocol address)
+ *  @param[in] u16Count_p number of registers/coils
+ *  @param[in] pData_p data of a write request, registers in host byte
+ *             order (2 bytes each) or coils (1 byte each) like libmodbus
+ *  @param[out] pPdu_p request PDU, at least MODBUS_MAX_PDU_LENGTH bytes
+ *  @return length of the PDU, -1 with errno set if the request is invalid
+ *  
+ */
+/************************************************************************/
+int32_t buildModbusRequestPdu(EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p, const uint8_t *pData_p, uint8_t *pPdu_p)
+{
+    uint16_t u16MaxCount_l = getModbusPduMaxCount(eFunctionCode_p);
+
+    if ((u16MaxCount_l != 0) && ((u16Count_p == 0) || (u16Count_p > u16MaxCount_l)))
+    {
+        return setPduError(EMBMDATA);
+    }
+    pPdu_p[0] = (uint8_t)eFunctionCode_p;
+    switch (eFunctionCode_p)
+    {
+    case eREAD_COILS:
+    case eREAD_DISCRETE_INPUTS:
+    case eREAD_HOLDING_REGISTERS:
+    case eREAD_INPUT_REGISTERS:
+        putUint16(&(pPdu_p[1]), u16Address_p);
+        putUint16(&(pPdu_p[3]), u16Count_p);
+        return 5;
+
+    case eWRITE_SINGLE_COIL:
+        putUint16(&(pPdu_p[1]), u16Address_p);
+        putUint16(&(pPdu_p[3]), pData_p[0] ? MODBUS_COIL_ON : 0);
+        return 5;
+
+    case eWRITE_SINGLE_REGISTER:
+        putUint16(&(pPdu_p[1]), u16Address_p);
+        putUint16(&(pPdu_p[3]), (uint16_t)(pData_p[0] + (pData_p[1] << 8))); // little endian
+        return 5;
+
+    case eWRITE_MULTIPLE_COILS:
+        {
+            uint8_t u8ByteCount_l = (uint8_t)((u16Count_p + 7) / 8);
+            putUint16(&(pPdu_p[1]), u16Address_p);
+            putUint16(&(pPdu_p[3]), u16Count_p);
+            pPdu_p[5] = u8ByteCount_l;
+            memset(&(pPdu_p[6]), 0, u8ByteCount_l);
+            for (uint16_t i = 0; i < u16Count_p; i++)
+            {
+                if (pData_p[i])
+                {
+                    pPdu_p[6 + i / 8] |= (uint8_t)(1 << (i % 8));
+                }
+            }
+            return 6 + u8ByteCount_l;
+        }
+
+    case eWRITE_MULTIPLE_REGISTERS:
+        {
+            putUint16(&(pPdu_p[1]), u16Address_p);
+            putUint16(&(pPdu_p[3]), u16Count_p);
+            pPdu_p[5] = (uint8_t)(u16Count_p * 2);
+            for (uint16_t i = 0; i < u16Count_p; i++)
+            {
+                uint16_t u16Value_l;
+                memcpy(&u16Value_l, &(pData_p[2 * i]), sizeof(u16Value_l));
+                putUint16(&(pPdu_p[6 + 2 * i]), u16Value_l);
+            }
+            return 6 + u16Count_p * 2;
+        }
+
+    case eREPORT_SLAVE_ID:
+        return 1;
+
+    default:
+        return setPduError(EINVAL);
+    }
+}
+
+/************************************************************************/
+/** @ brief parses the PDU of a modbus response
+ *  
+ *  @param[in] u16Address_p, u16Count_p parameters of the request
+ *  @param[in] pPdu_p response PDU
+ *  @param[in] i32Length_p length of the response PDU
+ *  @param[out] pData_p data of a read response, registers in host byte
+ *              order (2 bytes each) or coils (1 byte each) like libmodbus
+ *  @return number of registers/coils (bytes for report slave id),
+ *          -1 with errno set like libmodbus if the response is an
+ *          exception or does not match the request
+ *  
+ */
+/************************************************************************/
+int32_t parseModbusResponsePdu(EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p, const uint8_t *pPdu_p, int32_t i32Length_p, uint8_t *pData_p)
+{
+    if (i32Length_p < 2)
+    {
+        return setPduError(EMBBADDATA);
+    }
+    if (pPdu_p[0] == ((uint8_t)eFunctionCode_p | MODBUS_EXCEPTION_FLAG))
+    {
+        if ((pPdu_p[1] == 0) || (pPdu_p[1] > MODBUS_EXCEPTION_GATEWAY_TARGET))
+        {
+            return setPduError(EMBBADEXC);
+        }
+        return setPduError(MODBUS_ENOBASE + pPdu_p[1]);
+    }
+    if (pPdu_p[0] != (uint8_t)eFunctionCode_p)
+    {
+        return setPduError(EMBBADDATA);
+    }
+
+    switch (eFunctionCode_p)
+    {
+    case eREAD_COILS:
+    case eREAD_DISCRETE_INPUTS:
+        if ((pPdu_p[1] != (u16Count_p + 7) / 8) || (i32Length_p != 2 + pPdu_p[1]))
+        {
+            return setPduError(EMBBADDATA);
+        }
+        for (uint16_t i = 0; i < u16Count_p; i++)
+        {
+            pData_p[i] = (pPdu_p[2 + i / 8] >> (i % 8)) & 1;
+        }
+        return u16Count_p;
+
+    case eREAD_HOLDING_REGISTERS:
+    case eREAD_INPUT_REGISTERS:
+        if ((pPdu_p[1] != u16Count_p * 2) || (i32Length_p != 2 + pPdu_p[1]))
+        {
+            return setPduError(EMBBADDATA);
+        }
+        for (uint16_t i = 0; i < u16Count_p; i++)
+        {
+            uint16_t u16Value_l = getUint16(&(pPdu_p[2 + 2 * i]));
+            memcpy(&(pData_p[2 * i]), &u16Value_l, sizeof(u16Value_l));
+        }
+        return u16Count_p;
+
+    case eWRITE_SINGLE_COIL:
+    case eWRITE_SINGLE_REGISTER:
+        if ((i32Length_p != 5) || (getUint16(&(pPdu_p[1])) != u16Address_p))
+        {
+            return setPduError(EMBBADDATA);
+        }
+        return 1;
+
+    case eWRITE_MULTIPLE_COILS:
+    case eWRITE_MULTIPLE_REGISTERS:
+        if ((i32Length_p != 5) || (getUint16(&(pPdu_p[1])) != u16Address_p) || (getUint16(&(pPdu_p[3])) != u16Count_p))
+        {
+            return setPduError(EMBBADDATA);
+        }
+        return u16Count_p;
+
+    case eREPORT_SLAVE_ID:
+        if (i32Length_p != 2 + pPdu_p[1])
+        {
+            return setPduError(EMBBADDATA);
+        }
+        memcpy(pData_p, &(pPdu_p[2]), pPdu_p[1]);
+        return pPdu_p[1];
+
+    default:
+        return setPduError(EINVAL);
+    }
+}
+
+/************************************************************************/
+/** @ brief checks if the slave answered a failed modbus action
+ *  
+ *  @param[in] err errno of the failed action
+ *  @return true for an exception response, false if no valid response
+ *          was received
+ */
+/************************************************************************/
+bool isModbusExceptionResponse(int err)
+{
+    return (err > MODBUS_ENOBASE) && (err < MODBUS_ENOBASE + MODBUS_EXCEPTION_MAX);
+}
+
+/************************************************************************/
+/** @ brief transmission time of one character on a serial line
+ *  
+ *  @param[in] ptRtuConfig_p line settings
+ *  @return time in nsec, 0 if the baud rate is not set
+ *  
+ *  a character consists of the start bit, the data bits, the parity bit
+ *  if parity is used and the stop bits
+ */
+/************************************************************************/
+uint32_t getRtuCharTimeNs(const TRtuConfig *ptRtuConfig_p)
+{
+    uint32_t u32Bits_l = 1 + ptRtuConfig_p->i8uDatabits + ptRtuConfig_p->i8uStopbits
+        + ((ptRtuConfig_p->cParity == 'N') ? 0 : 1);
+
+    if (ptRtuConfig_p->i32uBaud == 0)
+    {
+        return 0;
+    }
+    return (uint32_t)(((uint64_t)u32Bits_l * 1000000000 + ptRtuConfig_p->i32uBaud - 1) / ptRtuConfig_p->i32uBaud);
+}
+
+/************************************************************************/
+/** @ brief minimal silent interval between two RTU frames (t3.5)
+ *  
+ *  @param[in] ptRtuConfig_p line settings
+ *  @return time in usec
+ *  
+ *  3.5 character times, above 19200 baud the specification uses a fixed
+ *  value of 1750 usec
+ */
+/************************************************************************/
+uint32_t getRtuFrameGapUs(const TRtuConfig *ptRtuConfig_p)
+{
+    if ((ptRtuConfig_p->i32uBaud == 0) || (ptRtuConfig_p->i32uBaud > MODBUS_RTU_FIXED_GAP_BAUD))
+    {
+        return MODBUS_RTU_FIXED_FRAME_GAP_US;
+    }
+    return (uint32_t)(((uint64_t)getRtuCharTimeNs(ptRtuConfig_p) * 7 / 2 + 999) / 1000);
+}
@@ -0,0 +1,31 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef MODBUS_PDU_H_
+#define MODBUS_PDU_H_
+
+#include "modbusconfig.h"
+
+#ifndef MODBUS_MAX_PDU_LENGTH
+#define MODBUS_MAX_PDU_LENGTH 253
+#endif
+
+uint16_t getModbusPduMaxCount(EModbusFunction eFunctionCode_p);
+uint32_t getModbusBufferOffset(EModbusFunction eFunctionCode_p, uint16_t u16Offset_p);
+int32_t buildModbusRequestPdu(EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p, const uint8_t *pData_p, uint8_t *pPdu_p);
+bool isModbusExceptionResponse(int err);
+uint32_t getRtuCharTimeNs(const TRtuConfig *ptRtuConfig_p);
+uint32_t getRtuFrameGapUs(const TRtuConfig *ptRtuConfig_p);
+int32_t parseModbusResponsePdu(EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p, const uint8_t *pPdu_p, int32_t i32Length_p, uint8_t *pData_p);
+
+#endif /* MODBUS_PDU_H_ */
@@ -0,0 +1,567 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#include "project.h"
+
+#define _GNU_SOURCE //ppoll
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <syslog.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <linux/serial.h>
+#include <modbus/modbus.h>
+#include "ModbusRtuTransport.h"
+#include "ComAndDataProcessor.h"
+#include "ModbusPdu.h"
+
+#define MODBUS_ADDRESS_OFFSET 1
+#define MODBUS_EXCEPTION_FLAG 0x80
+#define MODBUS_RTU_CRC_LENGTH 2
+#define MODBUS_RTU_EXCEPTION_LENGTH 5       //slave address, function, exception code, crc
+#define MODBUS_RTU_WRITE_RESPONSE_LENGTH 8  //slave address, function, address, count/value, crc
+#define MODBUS_BROADCAST_ADDRESS 0
+
+
+static void addNanoseconds(struct timespec *sum, const struct timespec *summand, uint64_t u64Ns_p)
+{
+    struct timespec tv_offset;
+    tv_offset.tv_sec = u64Ns_p / s32_nanoseconds_per_second;
+    tv_offset.tv_nsec = u64Ns_p % s32_nanoseconds_per_second;
+    timespec_add(sum, summand, &tv_offset);
+}
+
+static uint32_t getElapsedMicroseconds(const struct timespec *ptv_end_p, const struct timespec *ptv_start_p)
+{
+    struct timespec tv_diff;
+    timespec_diff(&tv_diff, ptv_end_p, ptv_start_p);
+    return (uint32_t)(tv_diff.tv_sec * s32_microseconds_per_second + tv_diff.tv_nsec / 1000);
+}
+
+/************************************************************************/
+/** @ brief crc of a modbus rtu frame
+ */
+/************************************************************************/
+static uint16_t getRtuCrc(const uint8_t *pData_p, int32_t i32Length_p)
+{
+    uint16_t u16Crc_l = 0xFFFF;
+
+    for (int32_t i = 0; i < i32Length_p; i++)
+    {
+        u16Crc_l ^= pData_p[i];
+        for (int32_t b = 0; b < 8; b++)
+        {
+            u16Crc_l = (u16Crc_l & 1) ? ((u16Crc_l >> 1) ^ 0xA001) : (u16Crc_l >> 1);
+        }
+    }
+    return u16Crc_l;
+}
+
+/************************************************************************/
+/** @ brief termios constant of a baud rate
+ *
+ *  @return the speed, B0 if the baud rate is not supported
+ */
+/************************************************************************/
+static speed_t getTermiosSpeed(uint32_t u32Baud_p)
+{
+    switch (u32Baud_p)
+    {
+    case 1200:      return B1200;
+    case 2400:      return B2400;
+    case 4800:      return B4800;
+    case 9600:      return B9600;
+    case 19200:     return B19200;
+    case 38400:     return B38400;
+    case 57600:     return B57600;
+    case 115200:    return B115200;
+    case 230400:    return B230400;
+    case 460800:    return B460800;
+    case 500000:    return B500000;
+    case 576000:    return B576000;
+    case 921600:    return B921600;
+    case 1000000:   return B1000000;
+    default:        return B0;
+    }
+}
+
+/************************************************************************/
+/** @ brief length of a response frame
+ *
+ *  @param[in] pAdu_p the bytes received so far
+ *  @param[in] i32Received_p number of bytes received so far
+ *  @return length of the whole frame including the crc, 0 if more bytes
+ *          are needed to know it, -1 if the function code is not one the
+ *          transport sends
+ *
+ *  the length follows from the function code, for reads from the byte
+ *  count after it
+ */
+/************************************************************************/
+static int32_t getRtuResponseLength(const uint8_t *pAdu_p, int32_t i32Received_p)
+{
+    if (i32Received_p < 2)
+    {
+        return 0;
+    }
+    if (pAdu_p[1] & MODBUS_EXCEPTION_FLAG)
+    {
+        return MODBUS_RTU_EXCEPTION_LENGTH;
+    }
+    switch (pAdu_p[1])
+    {
+    case eWRITE_SINGLE_COIL:
+    case eWRITE_SINGLE_REGISTER:
+    case eWRITE_MULTIPLE_COILS:
+    case eWRITE_MULTIPLE_REGISTERS:
+        return MODBUS_RTU_WRITE_RESPONSE_LENGTH;
+    case eREAD_COILS:
+    case eREAD_DISCRETE_INPUTS:
+    case eREAD_HOLDING_REGISTERS:
+    case eREAD_INPUT_REGISTERS:
+    case eREPORT_SLAVE_ID:
+        //byte count and data
+        if (i32Received_p < 3)
+        {
+            return 0;
+        }
+        return 3 + pAdu_p[2] + MODBUS_RTU_CRC_LENGTH;
+    default:
+        //e.g. read exception status or mask write register have fixed lengths
+        //of their own, but buildModbusRequestPdu() never sends them
+        return -1;
+    }
+}
+
+/************************************************************************/
+/** @ brief opens and configures the serial port of a modbus rtu master
+ *
+ *  @param[out] ptTransport_p the transport
+ *  @param[in] ptRtuConfig_p device file and line settings
+ *  @return '0' if successful, otherwise '-1' with errno set
+ *
+ *  the low latency flag lets the serial driver pass received bytes on
+ *  at once, e.g. USB serial adapters otherwise collect them for several
+ *  milliseconds. Drivers without it (e.g. pseudo terminals) are used as
+ *  they are.
+ */
+/************************************************************************/
+int32_t openRtuTransport(TModbusRtuTransport *ptTransport_p, const TRtuConfig *ptRtuConfig_p)
+{
+    struct termios tTermios_l;
+    struct serial_struct tSerial_l;
+    speed_t tSpeed_l = getTermiosSpeed(ptRtuConfig_p->i32uBaud);
+
+    memset(ptTransport_p, 0, sizeof(*ptTransport_p));
+    ptTransport_p->iFd = -1;
+    ptTransport_p->ptRtuConfig = ptRtuConfig_p;
+    if (tSpeed_l == B0)
+    {
+        syslog(LOG_ERR, "Modbus RTU device %s: baud rate %d not supported\n",
+            ptRtuConfig_p->sz8DeviceFilePath, (int)ptRtuConfig_p->i32uBaud);
+        errno = EINVAL;
+        return -1;
+    }
+
+    ptTransport_p->iFd = open(ptRtuConfig_p->sz8DeviceFilePath, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (ptTransport_p->iFd < 0)
+    {
+        return -1;
+    }
+
+    memset(&tTermios_l, 0, sizeof(tTermios_l));
+    cfmakeraw(&tTermios_l);
+    cfsetispeed(&tTermios_l, tSpeed_l);
+    cfsetospeed(&tTermios_l, tSpeed_l);
+    tTermios_l.c_cflag |= CLOCAL | CREAD;
+    tTermios_l.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+    switch (ptRtuConfig_p->i8uDatabits)
+    {
+    case 5:  tTermios_l.c_cflag |= CS5; break;
+    case 6:  tTermios_l.c_cflag |= CS6; break;
+    case 7:  tTermios_l.c_cflag |= CS7; break;
+    default: tTermios_l.c_cflag |= CS8; break;
+    }
+    if (ptRtuConfig_p->cParity == 'E')
+    {
+        tTermios_l.c_cflag |= PARENB;
+    }
+    else if (ptRtuConfig_p->cParity == 'O')
+    {
+        tTermios_l.c_cflag |= PARENB | PARODD;
+    }
+    if (ptRtuConfig_p->i8uStopbits == 2)
+    {
+        tTermios_l.c_cflag |= CSTOPB;
+    }
+    tTermios_l.c_cc[VMIN] = 0;
+    tTermios_l.c_cc[VTIME] = 0;
+    if (tcsetattr(ptTransport_p->iFd, TCSANOW, &tTermios_l) < 0)
+    {
+        int err = errno;
+        close(ptTransport_p->iFd);
+        ptTransport_p->iFd = -1;
+        errno = err;
+        return -1;
+    }
+
+    if ((ioctl(ptTransport_p->iFd, TIOCGSERIAL, &tSerial_l) < 0)
+        || ((tSerial_l.flags |= ASYNC_LOW_LATENCY), (ioctl(ptTransport_p->iFd, TIOCSSERIAL, &tSerial_l) < 0)))
+    {
+        syslog(LOG_INFO, "Modbus RTU device %s: low latency mode not available\n", ptRtuConfig_p->sz8DeviceFilePath);
+    }
+
+    ptTransport_p->u32CharTimeNs = getRtuCharTimeNs(ptRtuConfig_p);
+    tcflush(ptTransport_p->iFd, TCIOFLUSH);
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief closes the serial port
+ *
+ *  @param[in] ptr the transport (TModbusRtuTransport*), usable as cleanup
+ *             handler of the master thread
+ */
+/************************************************************************/
+void closeRtuTransport(void *ptr)
+{
+    TModbusRtuTransport *ptTransport_l = (TModbusRtuTransport *)ptr;
+
+    if (ptTransport_l->iFd >= 0)
+    {
+        close(ptTransport_l->iFd);
+        ptTransport_l->iFd = -1;
+    }
+}
+
+/************************************************************************/
+/** @ brief closes and reopens the serial port after an i/o error
+ *
+ *  @return '0' if successful, otherwise '-1', errno is kept
+ *
+ *  like the link recovery of libmodbus, e.g. a USB serial adapter which
+ *  was unplugged and plugged in again gets a new file descriptor. If the
+ *  device is not back yet the next request tries again.
+ */
+/************************************************************************/
+static int32_t reopenRtuTransport(TModbusRtuTransport *ptTransport_p)
+{
+    const TRtuConfig *ptRtuConfig_l = ptTransport_p->ptRtuConfig;
+    int err = errno;
+    int32_t ret;
+
+    closeRtuTransport(ptTransport_p);
+    ret = openRtuTransport(ptTransport_p, ptRtuConfig_l);
+    if (ret < 0)
+    {
+        syslog(LOG_ERR, "Modbus RTU device %s: reopen failed: %s\n",
+            ptRtuConfig_l->sz8DeviceFilePath, strerror(errno));
+    }
+    else
+    {
+        syslog(LOG_INFO, "Modbus RTU device %s: reopened after i/o error: %s\n",
+            ptRtuConfig_l->sz8DeviceFilePath, strerror(err));
+    }
+    errno = err;
+    return ret;
+}
+
+/************************************************************************/
+/** @ brief writes a whole frame to the non blocking serial port
+ */
+/************************************************************************/
+static int32_t writeRtuFrame(int iFd_p, const uint8_t *pFrame_p, int32_t i32Length_p)
+{
+    int32_t i32Written_l = 0;
+
+    while (i32Written_l < i32Length_p)
+    {
+        ssize_t n = write(iFd_p, &(pFrame_p[i32Written_l]), i32Length_p - i32Written_l);
+        if (n > 0)
+        {
+            i32Written_l += n;
+            continue;
+        }
+        if ((n < 0) && (errno == EAGAIN))
+        {
+            struct pollfd tPollFd_l = { .fd = iFd_p, .events = POLLOUT };
+            if ((poll(&tPollFd_l, 1, -1) < 0) && (errno != EINTR))
+            {
+                return -1;
+            }
+            continue;
+        }
+        if ((n < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief sends a request and receives its response
+ *
+ *  @param[in] i8uSlaveAddress_p slave address, 0 for a broadcast
+ *  @param[in] pRequestPdu_p, i32RequestLength_p the request PDU
+ *  @param[out] pResponsePdu_p response PDU, at least MODBUS_MAX_PDU_LENGTH
+ *              bytes
+ *  @param[in] u32TimeoutUs_p response timeout after the transmission of the
+ *             request, also the max gap between two received bytes
+ *  @return length of the response PDU, 0 for a broadcast, -1 with errno set
+ *          like libmodbus if the response is missing or invalid
+ *
+ *  the reception ends as soon as the whole response has arrived. The time
+ *  of the transmission and of the last received byte are kept in the
+ *  transport for the round trip time and the inter-frame gap. The port is
+ *  reopened after an i/o error, a timeout keeps it.
+ */
+/************************************************************************/
+int32_t transferRtuPdu(TModbusRtuTransport *ptTransport_p,
+                       uint8_t i8uSlaveAddress_p,
+                       const uint8_t *pRequestPdu_p,
+                       int32_t i32RequestLength_p,
+                       uint8_t *pResponsePdu_p,
+                       uint32_t u32TimeoutUs_p)
+{
+    uint8_t au8Adu_l[MODBUS_RTU_MAX_ADU_LENGTH];
+    int32_t i32AduLength_l = 1 + i32RequestLength_p + MODBUS_RTU_CRC_LENGTH;
+    int32_t i32Received_l = 0;
+    int32_t i32Expected_l = 0;
+    struct timespec tv_deadline;
+    uint16_t u16Crc_l;
+
+    if (i32AduLength_l > MODBUS_RTU_MAX_ADU_LENGTH)
+    {
+        errno = EMBMDATA;
+        return -1;
+    }
+    au8Adu_l[0] = i8uSlaveAddress_p;
+    memcpy(&(au8Adu_l[1]), pRequestPdu_p, i32RequestLength_p);
+    u16Crc_l = getRtuCrc(au8Adu_l, 1 + i32RequestLength_p);
+    au8Adu_l[1 + i32RequestLength_p] = (uint8_t)(u16Crc_l & 0xFF);
+    au8Adu_l[2 + i32RequestLength_p] = (uint8_t)(u16Crc_l >> 8);
+
+    //the reopen after an earlier i/o error failed
+    if ((ptTransport_p->iFd < 0) && (openRtuTransport(ptTransport_p, ptTransport_p->ptRtuConfig) < 0))
+    {
+        return -1;
+    }
+
+    //bytes of an earlier, timed out response must not be taken for this one
+    tcflush(ptTransport_p->iFd, TCIFLUSH);
+    clock_gettime(CLOCK_MONOTONIC, &(ptTransport_p->tvSent));
+    if (writeRtuFrame(ptTransport_p->iFd, au8Adu_l, i32AduLength_l) < 0)
+    {
+        reopenRtuTransport(ptTransport_p);
+        return -1;
+    }
+    if (i8uSlaveAddress_p == MODBUS_BROADCAST_ADDRESS)
+    {
+        //no response, the bus is free after the transmission
+        tcdrain(ptTransport_p->iFd);
+        clock_gettime(CLOCK_MONOTONIC, &(ptTransport_p->tvLastByte));
+        return 0;
+    }
+
+    //the response timeout starts after the transmission of the request
+    addNanoseconds(&tv_deadline, &(ptTransport_p->tvSent),
+        (uint64_t)ptTransport_p->u32CharTimeNs * i32AduLength_l + (uint64_t)u32TimeoutUs_p * 1000);
+    while ((i32Expected_l == 0) || (i32Received_l < i32Expected_l))
+    {
+        struct pollfd tPollFd_l = { .fd = ptTransport_p->iFd, .events = POLLIN };
+        struct timespec tv_current;
+        struct timespec tv_timeout;
+        ssize_t n;
+        int ret;
+
+        clock_gettime(CLOCK_MONOTONIC, &tv_current);
+        if (timespec_diff(&tv_timeout, &tv_deadline, &tv_current) < 0)
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        ret = ppoll(&tPollFd_l, 1, &tv_timeout, NULL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            reopenRtuTransport(ptTransport_p);
+            return -1;
+        }
+        if (ret == 0)
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if ((tPollFd_l.revents & POLLIN) == 0)
+        {
+            //hangup or error of the device, read() would not block any more
+            errno = EIO;
+            reopenRtuTransport(ptTransport_p);
+            return -1;
+        }
+
+        n = read(ptTransport_p->iFd, &(au8Adu_l[i32Received_l]),
+            ((i32Expected_l > 0) ? i32Expected_l : MODBUS_RTU_MAX_ADU_LENGTH) - i32Received_l);
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EINTR))
+            {
+                continue;
+            }
+            reopenRtuTransport(ptTransport_p);
+            return -1;
+        }
+        if (n == 0)
+        {
+            if (tPollFd_l.revents & (POLLHUP | POLLERR))
+            {
+                errno = EIO;
+                reopenRtuTransport(ptTransport_p);
+                return -1;
+            }
+            continue;
+        }
+        //all bytes of one read arrived together
+        clock_gettime(CLOCK_MONOTONIC, &(ptTransport_p->tvLastByte));
+        i32Received_l += n;
+        i32Expected_l = getRtuResponseLength(au8Adu_l, i32Received_l);
+        if ((i32Expected_l < 0) || (i32Expected_l > MODBUS_RTU_MAX_ADU_LENGTH) || ((i32Expected_l > 0) && (i32Received_l > i32Expected_l)))
+        {
+            errno = EMBBADDATA;
+            return -1;
+        }
+        //the next byte has to follow within the timeout
+        addNanoseconds(&tv_deadline, &(ptTransport_p->tvLastByte), (uint64_t)u32TimeoutUs_p * 1000);
+    }
+
+    u16Crc_l = getRtuCrc(au8Adu_l, i32Received_l - MODBUS_RTU_CRC_LENGTH);
+    if ((au8Adu_l[i32Received_l - 2] != (uint8_t)(u16Crc_l & 0xFF)) || (au8Adu_l[i32Received_l - 1] != (uint8_t)(u16Crc_l >> 8)))
+    {
+        errno = EMBBADCRC;
+        return -1;
+    }
+    if (au8Adu_l[0] != i8uSlaveAddress_p)
+    {
+        errno = EMBBADSLAVE;
+        return -1;
+    }
+    memcpy(pResponsePdu_p, &(au8Adu_l[1]), i32Received_l - 1 - MODBUS_RTU_CRC_LENGTH);
+    return i32Received_l - 1 - MODBUS_RTU_CRC_LENGTH;
+}
+
+/************************************************************************/
+/** @ brief processes a modbus action on the rtu transport
+ *
+ *  @param[in] pEvent_p the modbus action which has to be processed
+ *  @param[in] buffer data of the action
+ *  @param[in] ptTimeouts_p response timeout table of the master
+ *  @return number of transferred registers/coils, -1 with errno set like
+ *          libmodbus if a request failed or EIO if the process image could
+ *          not be accessed
+ *
+ *  counterpart of processModbusAction() for the libmodbus context: actions
+ *  with more registers than fit into one request are split, each round trip
+ *  time updates the response timeout estimates, a timeout doubles them
+ */
+/************************************************************************/
+int32_t processRtuAction(TModbusRtuTransport *ptTransport_p, tModbusEvent *pEvent_p, uint8_t *buffer, TResponseTimeoutTable *ptTimeouts_p)
+{
+    const TModbusAction *ptModbusAction_l = pEvent_p->ptModbusAction;
+    TRttEstimate *ptActionRtt_l = &(pEvent_p->pSchedulerEvent->tRtt);
+    uint8_t i8uSlaveAddress_l = ptModbusAction_l->i8uSlaveAddress;
+    uint16_t u16MaxCount_l = getModbusPduMaxCount(ptModbusAction_l->eFunctionCode);
+    uint8_t au8Request_l[MODBUS_MAX_PDU_LENGTH];
+    uint8_t au8Response_l[MODBUS_MAX_PDU_LENGTH];
+    uint16_t u16Offset_l = 0;
+    int32_t i32Done_l = 0;
+    int32_t len = 0;
+    int err;
+
+    if (prepareModbusAction(ptModbusAction_l, buffer) < 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    while (len >= 0)
+    {
+        uint16_t u16Count_l = ptModbusAction_l->i16uRegisterCount;
+        uint16_t u16Address_l;
+        int32_t i32PduLength_l;
+
+        if (u16MaxCount_l != 0)
+        {
+            u16Count_l = MIN(u16MaxCount_l, ptModbusAction_l->i16uRegisterCount - u16Offset_l);
+        }
+        u16Address_l = (uint16_t)(ptModbusAction_l->i32uStartRegister - MODBUS_ADDRESS_OFFSET + u16Offset_l);
+        i32PduLength_l = buildModbusRequestPdu(ptModbusAction_l->eFunctionCode, u16Address_l, u16Count_l,
+            &(buffer[getModbusBufferOffset(ptModbusAction_l->eFunctionCode, u16Offset_l)]), au8Request_l);
+        if (i32PduLength_l < 0)
+        {
+            len = -1;
+            break;
+        }
+
+        len = transferRtuPdu(ptTransport_p, i8uSlaveAddress_l, au8Request_l, i32PduLength_l, au8Response_l,
+            getResponseTimeout(ptTimeouts_p, ptActionRtt_l, i8uSlaveAddress_l));
+        if (len < 0)
+        {
+            if (errno == ETIMEDOUT)
+            {
+                backoffResponseTimeout(ptTimeouts_p, ptActionRtt_l, i8uSlaveAddress_l);
+            }
+            break;
+        }
+        if (i8uSlaveAddress_l == MODBUS_BROADCAST_ADDRESS)
+        {
+            len = u16Count_l;
+        }
+        else
+        {
+            len = parseModbusResponsePdu(ptModbusAction_l->eFunctionCode, u16Address_l, u16Count_l, au8Response_l, len,
+                &(buffer[getModbusBufferOffset(ptModbusAction_l->eFunctionCode, u16Offset_l)]));
+            if (len < 0)
+            {
+                break;
+            }
+            updateResponseTimeout(ptTimeouts_p, ptActionRtt_l, i8uSlaveAddress_l,
+                getElapsedMicroseconds(&(ptTransport_p->tvLastByte), &(ptTransport_p->tvSent)));
+        }
+
+        i32Done_l += len;
+        u16Offset_l += u16Count_l;
+        if ((u16MaxCount_l == 0) || (u16Offset_l >= ptModbusAction_l->i16uRegisterCount))
+        {
+            len = i32Done_l;
+            break;
+        }
+    }
+
+    err = errno;
+    if (completeModbusAction(ptModbusAction_l, buffer, len) < 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+    errno = err;
+    return len;
+}
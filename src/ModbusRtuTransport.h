@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef MODBUS_RTU_TRANSPORT_H_
+#define MODBUS_RTU_TRANSPORT_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "modbusconfig.h"
+#include "ResponseTimeout.h"
+#include "Scheduler.h"
+
+/************************************************************************/
+/** @ brief serial port of a modbus rtu master without libmodbus
+ *
+ *	the port is configured with termios and the low latency flag of the
+ *	serial driver. A response is complete as soon as the length given by
+ *	its function code and byte count has arrived, the silent interval at
+ *	the end of the frame is not waited for.
+ */
+/************************************************************************/
+typedef struct
+{
+	int iFd;
+	const TRtuConfig *ptRtuConfig;	//device file and line settings, to reopen the port after i/o errors
+	uint32_t u32CharTimeNs;			//transmission time of one character
+	struct timespec tvSent;			//start of the transmission of the last request
+	struct timespec tvLastByte;		//reception of the last byte of the last response
+} TModbusRtuTransport;
+
+int32_t openRtuTransport(TModbusRtuTransport *ptTransport_p, const TRtuConfig *ptRtuConfig_p);
+void closeRtuTransport(void *ptr);
+int32_t transferRtuPdu(TModbusRtuTransport *ptTransport_p,
+					   uint8_t i8uSlaveAddress_p,
+					   const uint8_t *pRequestPdu_p,
+					   int32_t i32RequestLength_p,
+					   uint8_t *pResponsePdu_p,
+					   uint32_t u32TimeoutUs_p);
+int32_t processRtuAction(TModbusRtuTransport *ptTransport_p, tModbusEvent *pEvent_p, uint8_t *buffer, TResponseTimeoutTable *ptTimeouts_p);
+
+#endif /* MODBUS_RTU_TRANSPORT_H_ */
@@ -11,15 +11,18 @@
  *
  */
 
-#define _POSIX_C_SOURCE 200112L //clock_nanosleep and struct timespec
+#define _GNU_SOURCE //accept4
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/queue.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 #include <pthread.h>
 #include <syslog.h>
 
@@ -29,70 +32,315 @@
 
 struct TMBSlaveConfHead mbSlaveConfHead;
 
+#define TCP_SLAVE_MAX_EVENTS 64
+
 //#define MODBUS_DEBUG
 
-/************************************************************************/
-/** @ brief start routine for a modbus tcp slave thread
- *  
- *	@param[in] arg configuration parameter for the modbus tcp slave of type TModbusSlaveConfiguration
- *
- *	@return returns NULL if initialisation failed
- *
- *	the (lib)modbus initialisation and execution is performed
- *
- */
-/************************************************************************/
+//a connected modbus tcp master, the request is collected until it is complete
+struct TSlaveConnection
+{
+    int iSocket;
+    int32_t i32Received;                            // bytes of the partial request received so far
+    uint8_t au8Request[MODBUS_TCP_MAX_ADU_LENGTH];
+    LIST_ENTRY(TSlaveConnection) entries;
+};
+LIST_HEAD(TSlaveConnectionHead, TSlaveConnection);
+
 struct hndlTcpSlaveThread
 {
     modbus_mapping_t* mbMapping;
     modbus_t *mb_slave;
-    fd_set refset;
+    int iServerSocket;
+    int iEpoll;
+    struct TSlaveConnectionHead tConnections;
+    TProcessImageMirror tMirror;
+    TProcessImageMirror *ptMirror;      //NULL if the inputs are read for every request
 };
 
+/************************************************************************/
+/** @ brief starts the input mirror of a slave if it is configured
+ *  
+ *	@param[in,out] ptMirror_p the mirror, *pptMirror_p points to it while
+ *	               it has to be stopped by the cleanup handler
+ *	@param[out] pptMirror_p the started mirror, NULL if the inputs are
+ *	            read for every request
+ *	@param[in] psModbusConfiguration_p the slave configuration
+ */
+/************************************************************************/
+static void startSlaveMirror(TProcessImageMirror *ptMirror_p, TProcessImageMirror **pptMirror_p, const TModbusSlaveConfiguration *psModbusConfiguration_p)
+{
+    if (psModbusConfiguration_p->tTuning.u32MirrorIntervalUs == 0)
+    {
+        return;
+    }
+    *pptMirror_p = ptMirror_p;
+    if (startProcessImageMirror(ptMirror_p, psModbusConfiguration_p) < 0)
+    {
+        stopProcessImageMirror(ptMirror_p);
+        *pptMirror_p = NULL;
+        syslog(LOG_ERR, "Process image mirror not available, the inputs are read for every request\n");
+    }
+}
+
+static void closeSlaveConnection(struct TSlaveConnection *ptConnection_p)
+{
+    //closing the socket removes it from the epoll set
+    close(ptConnection_p->iSocket);
+    LIST_REMOVE(ptConnection_p, entries);
+    free(ptConnection_p);
+}
+
 void cleanupTcpSlaveThread(void *ptr)
 {
-    int fd;
     struct hndlTcpSlaveThread *h = (struct hndlTcpSlaveThread *)ptr;
     
     syslog(LOG_NOTICE, "cleanupTcpSlaveThread\n");
     
+    if (h->ptMirror)
+        stopProcessImageMirror(h->ptMirror);
+
     if (h->mbMapping)
         modbus_mapping_free(h->mbMapping);
+
+    while (!LIST_EMPTY(&h->tConnections))
+    {
+        syslog(LOG_ERR, "close socket %d\n", LIST_FIRST(&h->tConnections)->iSocket);
+        closeSlaveConnection(LIST_FIRST(&h->tConnections));
+    }
+    if (h->iEpoll >= 0)
+    {
+        close(h->iEpoll);
+    }
     
     if (h->mb_slave)
     {
+        //modbus_close closes the server socket
+        modbus_set_socket(h->mb_slave, h->iServerSocket);
         modbus_close(h->mb_slave);
         modbus_free(h->mb_slave);
     }
+}
+
+/************************************************************************/
+/** @ brief accepts all pending connections of the server socket
+ *  
+ *	the new sockets are non blocking and added to the epoll set
+ */
+/************************************************************************/
+static void acceptSlaveConnections(struct hndlTcpSlaveThread *h)
+{
+    while (1)
+    {
+        struct sockaddr_in clientaddr;
+        socklen_t addrlen = sizeof(clientaddr);
+        memset(&clientaddr, 0, sizeof(clientaddr));
+        int newfd = accept4(h->iServerSocket, (struct sockaddr *)&clientaddr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (newfd == -1)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                syslog(LOG_ERR, "Server accept() error: %s\n", strerror(errno));
+            }
+            if (errno != EINTR)
+            {
+                return;
+            }
+            continue;
+        }
+
+        struct TSlaveConnection *ptConnection_l = calloc(1, sizeof(struct TSlaveConnection));
+        if (ptConnection_l == NULL)
+        {
+            syslog(LOG_ERR, "Out of memory, connection on socket %d refused\n", newfd);
+            close(newfd);
+            continue;
+        }
+        ptConnection_l->iSocket = newfd;
+        LIST_INSERT_HEAD(&h->tConnections, ptConnection_l, entries);
+
+        struct epoll_event tEvent_l;
+        memset(&tEvent_l, 0, sizeof(tEvent_l));
+        tEvent_l.events = EPOLLIN;
+        tEvent_l.data.ptr = ptConnection_l;
+        if (epoll_ctl(h->iEpoll, EPOLL_CTL_ADD, newfd, &tEvent_l) < 0)
+        {
+            syslog(LOG_ERR, "epoll_ctl failed: %s\n", strerror(errno));
+            closeSlaveConnection(ptConnection_l);
+            continue;
+        }
+        syslog(LOG_INFO,
+            "New connection from %s:%d on socket %d\n",
+            inet_ntoa(clientaddr.sin_addr),
+            clientaddr.sin_port,
+            newfd);
+    }
+}
+
+/************************************************************************/
+/** @ brief checks the length of a request PDU against its content
+ *  
+ *	@param[in] pPdu_p the request PDU, starting with the function code
+ *	@param[in] i32Length_p length of the PDU given by the MBAP header
+ *
+ *	@return '0' if the length fits the function code and byte count,
+ *	        otherwise '-1'
+ *
+ *	modbus_reply trusts the quantity and byte count of a request. libmodbus
+ *	frames a request by them, the MBAP length has to match them here.
+ */
+/************************************************************************/
+static int32_t checkModbusPduLength(const uint8_t *pPdu_p, int32_t i32Length_p)
+{
+    int32_t i32Expected_l;
+    uint16_t u16Count_l;
+
+    switch (pPdu_p[0])
+    {
+    case eREAD_COILS:
+    case eREAD_DISCRETE_INPUTS:
+    case eREAD_HOLDING_REGISTERS:
+    case eREAD_INPUT_REGISTERS:
+    case eWRITE_SINGLE_COIL:
+    case eWRITE_SINGLE_REGISTER:
+        i32Expected_l = 5;
+        break;
+
+    case eWRITE_MASK_REGISTER:
+        i32Expected_l = 7;
+        break;
+
+    case eWRITE_MULTIPLE_COILS:
+    case eWRITE_MULTIPLE_REGISTERS:
+        if (i32Length_p < 6)
+        {
+            return -1;
+        }
+        u16Count_l = (uint16_t)((pPdu_p[3] << 8) | pPdu_p[4]);
+        if (pPdu_p[5] != ((pPdu_p[0] == eWRITE_MULTIPLE_COILS) ? (u16Count_l + 7) / 8 : u16Count_l * 2))
+        {
+            return -1;
+        }
+        i32Expected_l = 6 + pPdu_p[5];
+        break;
+
+    case eWRITE_AND_READ_REGISTERS:
+        if (i32Length_p < 10)
+        {
+            return -1;
+        }
+        u16Count_l = (uint16_t)((pPdu_p[7] << 8) | pPdu_p[8]);
+        if (pPdu_p[9] != u16Count_l * 2)
+        {
+            return -1;
+        }
+        i32Expected_l = 10 + pPdu_p[9];
+        break;
+
+    default:
+        //answered with an exception by libmodbus without reading the data
+        return 0;
+    }
+    return (i32Length_p == i32Expected_l) ? 0 : -1;
+}
+
+/************************************************************************/
+/** @ brief reads the available data of a connection and answers all
+ *          complete requests
+ *  
+ *	@return '0' if the connection stays open, '-1' if it has to be closed
+ *
+ *	the length of a request is taken from its MBAP header, a partial
+ *	request is kept until the rest arrives, so a slow master never blocks
+ *	the others
+ */
+/************************************************************************/
+static int32_t serveSlaveConnection(struct hndlTcpSlaveThread *h, struct TSlaveConnection *ptConnection_p,
+    TModbusSlaveConfiguration *psModbusConfiguration_p)
+{
+    int32_t i32Offset_l = 0;
+    ssize_t n;
+
+    do
+    {
+        n = recv(ptConnection_p->iSocket, &(ptConnection_p->au8Request[ptConnection_p->i32Received]),
+            sizeof(ptConnection_p->au8Request) - (size_t)ptConnection_p->i32Received, 0);
+    } while ((n < 0) && (errno == EINTR));
+    if (n == 0)
+    {
+        return -1;
+    }
+    if (n < 0)
+    {
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+    }
+    ptConnection_p->i32Received += (int32_t)n;
 
-    for (fd = 0; fd < __FD_SETSIZE; fd++)
+    while ((ptConnection_p->i32Received - i32Offset_l) >= MODBUS_MBAP_HEADER_LENGTH)
     {
-        if (FD_ISSET(fd, &h->refset)) // NOLINT
+        uint8_t *pRequest_l = &(ptConnection_p->au8Request[i32Offset_l]);
+        //the length field counts the unit id and the PDU
+        int32_t i32Length_l = MODBUS_MBAP_HEADER_LENGTH - 1 + ((pRequest_l[4] << 8) | pRequest_l[5]);
+        if ((i32Length_l <= MODBUS_MBAP_HEADER_LENGTH) || (i32Length_l > MODBUS_TCP_MAX_ADU_LENGTH))
+        {
+            syslog(LOG_ERR, "Invalid request length on socket %d\n", ptConnection_p->iSocket);
+            return -1;
+        }
+        if ((ptConnection_p->i32Received - i32Offset_l) < i32Length_l)
+        {
+            break;
+        }
+        modbus_set_socket(h->mb_slave, ptConnection_p->iSocket);
+        if (checkModbusPduLength(&(pRequest_l[MODBUS_MBAP_HEADER_LENGTH]), i32Length_l - MODBUS_MBAP_HEADER_LENGTH) < 0)
+        {
+            syslog(LOG_ERR, "Malformed request on socket %d\n", ptConnection_p->iSocket);
+            if (modbus_reply_exception(h->mb_slave, pRequest_l, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (reply_modbus_request(h->mb_slave, pRequest_l, i32Length_l, h->mbMapping,
+            psModbusConfiguration_p, h->ptMirror) < 0)
         {
-            close(fd);
-            syslog(LOG_ERR, "close socket %d\n", fd);
+            return -1;
         }
+        i32Offset_l += i32Length_l;
     }
+    ptConnection_p->i32Received -= i32Offset_l;
+    memmove(ptConnection_p->au8Request, &(ptConnection_p->au8Request[i32Offset_l]), (size_t)ptConnection_p->i32Received);
+    return 0;
 }
 
+/************************************************************************/
+/** @ brief start routine for a modbus tcp slave thread
+ *  
+ *	@param[in] arg configuration parameter for the modbus tcp slave of type TModbusSlaveConfiguration
+ *
+ *	@return returns NULL if initialisation failed
+ *
+ *	the (lib)modbus initialisation and execution is performed, the
+ *	connections are served with epoll by this thread
+ *
+ */
+/************************************************************************/
 void *startTcpSlaveThread(void *arg)
 {
     TModbusSlaveConfiguration *psModbusConfiguration_l = (TModbusSlaveConfiguration*)arg;
     struct hndlTcpSlaveThread hdl;
     int ret;
-    int server_socket = -1;
-    fd_set rdset;
-    /* maximal file descriptor number */
-    int fdmax;
+    struct epoll_event atEvents_l[TCP_SLAVE_MAX_EVENTS];
+    struct epoll_event tEvent_l;
     
     struct timespec tv_sleep;
     tv_sleep.tv_sec = 5;        // wait for 5 seconds in case of an error
     tv_sleep.tv_nsec = 0;
 
-    /* Clear the reference set of socket */
-    FD_ZERO(&hdl.refset);
     hdl.mbMapping = NULL;
     hdl.mb_slave = NULL;
+    hdl.iServerSocket = -1;
+    hdl.iEpoll = -1;
+    LIST_INIT(&hdl.tConnections);
+    memset(&hdl.tMirror, 0, sizeof(hdl.tMirror));
+    hdl.ptMirror = NULL;
 
     pthread_cleanup_push(cleanupTcpSlaveThread, &hdl);
     
@@ -106,6 +354,7 @@ void *startTcpSlaveThread(void *arg)
         syslog(LOG_ERR, "Failed to allocate the mapping: %s\n", modbus_strerror(errno));
         pthread_exit(0);
     }
+    startSlaveMirror(&hdl.tMirror, &hdl.ptMirror, psModbusConfiguration_l);
     
     char st8TcpPort[10];
     snprintf(st8TcpPort, sizeof(st8TcpPort), "%d", psModbusConfiguration_l->tModbusDeviceConfig.uProt.tTcpConfig.i32uPort);
@@ -116,8 +365,15 @@ void *startTcpSlaveThread(void *arg)
     }
     
 #ifdef MODBUS_DEBUG
-    modbus_set_debug(mb_slave, TRUE);
+    modbus_set_debug(hdl.mb_slave, TRUE);
 #endif
+
+    hdl.iEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (hdl.iEpoll < 0)
+    {
+        syslog(LOG_ERR, "epoll_create1 failed: %s\n", strerror(errno));
+        pthread_exit(0);
+    }
     
     //run slave
     do
@@ -133,86 +389,49 @@ void *startTcpSlaveThread(void *arg)
     } while (ret == -1);
     
     
-    server_socket = ret;
-    syslog(LOG_NOTICE, "server socket %d\n", server_socket);
-
-                /* Add the server socket */
-    FD_SET(server_socket, &hdl.refset);
+    hdl.iServerSocket = ret;
+    syslog(LOG_NOTICE, "server socket %d\n", hdl.iServerSocket);
 
-                /* Keep track of the max file descriptor */
-    fdmax = server_socket;
+    //the server socket is marked with data.ptr NULL
+    memset(&tEvent_l, 0, sizeof(tEvent_l));
+    tEvent_l.events = EPOLLIN;
+    tEvent_l.data.ptr = NULL;
+    if ((fcntl(hdl.iServerSocket, F_SETFL, fcntl(hdl.iServerSocket, F_GETFL) | O_NONBLOCK) < 0)
+        || (epoll_ctl(hdl.iEpoll, EPOLL_CTL_ADD, hdl.iServerSocket, &tEvent_l) < 0))
+    {
+        syslog(LOG_ERR, "Could not watch the server socket: %s\n", strerror(errno));
+        pthread_exit(0);
+    }
             
     while (1)
     {
-        int master_socket = 0;
-        rdset = hdl.refset;
-        ret = select(fdmax + 1, &rdset, NULL, NULL, NULL);
-        if (ret == -1)
+        int n = epoll_wait(hdl.iEpoll, atEvents_l, TCP_SLAVE_MAX_EVENTS, -1);
+        if (n < 0)
         {
-            syslog(LOG_ERR, "Could not select: errno=%s\n", modbus_strerror(errno));
-            if (server_socket != -1)
+            if (errno == EINTR)
             {
-                close(server_socket);
+                continue;
             }
+            syslog(LOG_ERR, "Could not epoll_wait: errno=%s\n", strerror(errno));
             pthread_exit(0);
         }
 
-        /* Run through the existing connections looking for data to be read */
-        for (master_socket = 0; master_socket <= fdmax; master_socket++)
+        //only the descriptors with events are visited
+        for (int i = 0; i < n; i++)
         {
-            if (!FD_ISSET(master_socket, &rdset))
+            struct TSlaveConnection *ptConnection_l = (struct TSlaveConnection *)atEvents_l[i].data.ptr;
+            if (ptConnection_l == NULL)
             {
+                syslog(LOG_INFO, "New connection request on socket %d\n", hdl.iServerSocket);
+                acceptSlaveConnections(&hdl);
                 continue;
             }
-        
-            if (master_socket == server_socket)
-            {
-                syslog(LOG_INFO, "New connection request on socket %d\n", server_socket);
-                /* A client is asking a new connection */
-                socklen_t addrlen;
-                struct sockaddr_in clientaddr;
-                int newfd;
-            
-                /* Handle new connections */
-                addrlen = sizeof(clientaddr);
-                memset(&clientaddr, 0, sizeof(clientaddr));
-                newfd = accept(server_socket, (struct sockaddr *)&clientaddr, &addrlen);
-                if (newfd == -1)
-                {
-                    syslog(LOG_ERR, "Server accept() error");
-                }
-                else
-                {
-                    FD_SET(newfd, &hdl.refset);
-
-                    if (newfd > fdmax) {
-                        /* Keep track of the maximum */
-                        fdmax = newfd;
-                    }
-                    syslog(LOG_INFO,
-                        "New connection from %s:%d on socket %d\n",
-                        inet_ntoa(clientaddr.sin_addr),
-                        clientaddr.sin_port,
-                        newfd);
-                }
-            }
-            else
+
+            syslog(LOG_DEBUG, "Check request on socket %d\n", ptConnection_l->iSocket);
+            if (serveSlaveConnection(&hdl, ptConnection_l, psModbusConfiguration_l) < 0)
             {
-                modbus_set_socket(hdl.mb_slave, master_socket);
-                
-                syslog(LOG_DEBUG, "Check request on socket %d/%d\n", master_socket, fdmax);
-                if (process_modbus_request(hdl.mb_slave, hdl.mbMapping, psModbusConfiguration_l) < 0)
-                {
-                    syslog(LOG_INFO, "Connection closed on socket %d\n", master_socket);
-                    close(master_socket);
-                    
-                    /* Remove from reference set */
-                    FD_CLR(master_socket, &hdl.refset);
-                    if (master_socket == fdmax)
-                    {
-                        fdmax--;
-                    }
-                }
+                syslog(LOG_INFO, "Connection closed on socket %d\n", ptConnection_l->iSocket);
+                closeSlaveConnection(ptConnection_l);
             }
         }
     }
@@ -239,6 +458,8 @@ struct hndlRtuSlaveThread
 {
     modbus_mapping_t* mbMapping;
     modbus_t *mb_slave;
+    TProcessImageMirror tMirror;
+    TProcessImageMirror *ptMirror;      //NULL if the inputs are read for every request
 };
 
 void cleanupRtuSlaveThread(void *ptr)
@@ -247,6 +468,9 @@ void cleanupRtuSlaveThread(void *ptr)
     
     syslog(LOG_INFO, "cleanupRtuSlaveThread\n");
     
+    if (h->ptMirror)
+        stopProcessImageMirror(h->ptMirror);
+
     if (h->mbMapping)
         modbus_mapping_free(h->mbMapping);
     
@@ -263,6 +487,8 @@ void *startRtuSlaveThread(void *arg)
 
     hdl.mb_slave = NULL;
     hdl.mbMapping = NULL;
+    memset(&hdl.tMirror, 0, sizeof(hdl.tMirror));
+    hdl.ptMirror = NULL;
     
     pthread_cleanup_push(cleanupRtuSlaveThread, &hdl);
     int logRtuPath = 0; // late declaration prevents Wclobbered error
@@ -291,6 +517,7 @@ void *startRtuSlaveThread(void *arg)
         syslog(LOG_ERR, "Failed to allocate the mapping: %s\n", modbus_strerror(errno));
         pthread_exit(0);
     }
+    startSlaveMirror(&hdl.tMirror, &hdl.ptMirror, psModbusConfiguration_l);
 
     hdl.mb_slave = modbus_new_rtu(
         psModbusConfiguration_l->tModbusDeviceConfig.uProt.tRtuConfig.sz8DeviceFilePath,
@@ -322,7 +549,7 @@ void *startRtuSlaveThread(void *arg)
 
     while (1)
     {
-        process_modbus_request(hdl.mb_slave, hdl.mbMapping, psModbusConfiguration_l);
+        process_modbus_request(hdl.mb_slave, hdl.mbMapping, psModbusConfiguration_l, hdl.ptMirror);
     }
     
     pthread_cleanup_pop(1); // this makro closes the loop of pthread_cleanup_push
@@ -330,20 +557,133 @@ void *startRtuSlaveThread(void *arg)
 
 
 
+/************************************************************************/
+/** @ brief decodes the coils/registers accessed by a modbus request
+ *  
+ *	@param[in] pPdu_p the request PDU, starting with the function code
+ *	@param[in] i32Length_p number of bytes from the function code to the
+ *	           end of the request
+ *	@param[out] pu16Address_p first coil/register
+ *	@param[out] pu16Count_p number of coils/registers
+ *
+ *	@return '0' if the request accesses a range, otherwise '-1'
+ *
+ *	for WRITE_AND_READ_REGISTERS the written range is returned, the read
+ *	range are holding registers which are not read from the process image
+ */
+/************************************************************************/
+static int32_t getModbusRequestRange(const uint8_t *pPdu_p, int32_t i32Length_p, uint16_t *pu16Address_p, uint16_t *pu16Count_p)
+{
+    if (i32Length_p < 5)
+    {
+        return -1;
+    }
+    *pu16Address_p = (uint16_t)((pPdu_p[1] << 8) | pPdu_p[2]);
+    *pu16Count_p = (uint16_t)((pPdu_p[3] << 8) | pPdu_p[4]);
+
+    switch (pPdu_p[0])
+    {
+    case eREAD_DISCRETE_INPUTS:
+    case eREAD_INPUT_REGISTERS:
+    case eWRITE_MULTIPLE_COILS:
+    case eWRITE_MULTIPLE_REGISTERS:
+        return 0;
+
+    case eWRITE_SINGLE_COIL:
+    case eWRITE_SINGLE_REGISTER:
+    case eWRITE_MASK_REGISTER:
+        *pu16Count_p = 1;
+        return 0;
+
+    case eWRITE_AND_READ_REGISTERS:
+        if (i32Length_p < 9)
+        {
+            return -1;
+        }
+        *pu16Address_p = (uint16_t)((pPdu_p[5] << 8) | pPdu_p[6]);
+        *pu16Count_p = (uint16_t)((pPdu_p[7] << 8) | pPdu_p[8]);
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+
+/************************************************************************/
+/** @ brief answers a received modbus request
+ *  
+ *	@param mb_slave_p the modbus context, connected to the requesting master
+ *	@param req the request including the header of the protocol
+ *	@param len length of the request
+ *	@param mbMapping_p the modbus mapping
+ *	@patram psModbusConfiguration_p the modbus device configuration
+ *	@param ptMirror_p the input mirror of the slave, NULL to read the
+ *	       inputs from the process image
+ *
+ *	@return '0' if processing was successful otherwise '-1'
+ *
+ */
+/************************************************************************/
+int32_t reply_modbus_request(modbus_t *mb_slave_p, const uint8_t *req, int32_t len, modbus_mapping_t* mbMapping_p,
+    TModbusSlaveConfiguration *psModbusConfiguration_p, TProcessImageMirror *ptMirror_p)
+{
+    /*	due to seperated input and output areas in the pi process image,
+        data from pi process image (e.g. other device) can only be requested by
+        the modbus functions READ_INPUT_REGISTERS and READ_DISCRETE_INPUTS
+        therefor only for this modbus functions a read from the pi process image is performed
+     */
+    int32_t header_length = modbus_get_header_length(mb_slave_p);
+    uint8_t mb_function_code = req[header_length];	//the modbus function code for the current request
+    uint16_t mb_address = 0;
+    uint16_t mb_count = 0;
+    bool has_range = (getModbusRequestRange(&(req[header_length]), len - header_length, &mb_address, &mb_count) == 0);
+    if (has_range && ((mb_function_code == eREAD_INPUT_REGISTERS) || (mb_function_code == eREAD_DISCRETE_INPUTS)))
+    {
+        if (ptMirror_p)
+        {
+            copyMirrorToModbusMapping(ptMirror_p, mbMapping_p, (EModbusFunction)mb_function_code, mb_address, mb_count);
+        }
+        else
+        {
+            readModbusDataFromProcessImage(mbMapping_p, &(psModbusConfiguration_p->tProcessImageConfig),
+                (EModbusFunction)mb_function_code, mb_address, mb_count);
+        }
+    }
+    len = modbus_reply(mb_slave_p, req, len, mbMapping_p);
+    if (len == -1)
+    {
+        syslog(LOG_ERR, "modbus reply failed\n");
+        return -1;
+    }			
+    if (has_range && ((mb_function_code == eWRITE_MULTIPLE_COILS) || (mb_function_code == eWRITE_MULTIPLE_REGISTERS) ||
+        (mb_function_code == eWRITE_SINGLE_COIL) || (mb_function_code == eWRITE_SINGLE_REGISTER) ||
+        (mb_function_code == eWRITE_AND_READ_REGISTERS) || (mb_function_code == eWRITE_MASK_REGISTER)))
+    {
+        writeModbusDataToProcessImage(mbMapping_p, &(psModbusConfiguration_p->tProcessImageConfig),
+            (EModbusFunction)mb_function_code, mb_address, mb_count);
+    }		
+    return 0;
+}
+
+
 /************************************************************************/
 /** @ brief common modbus request processing 
  *  
  *	@param mb_slave_p the modbus context
  *	@param mbMapping_p the modbus mapping
  *	@patram psModbusConfiguration_p the modbus device configuration
+ *	@param ptMirror_p the input mirror of the slave, NULL to read the
+ *	       inputs from the process image
  *
  *	@return '0' if processing was successful otherwise '-1'
  *
- *	the (lib)modbus initialisation and execution is performed
+ *	waits for the next request with libmodbus and answers it
  *
  */
 /************************************************************************/
-int32_t process_modbus_request(modbus_t *mb_slave_p, modbus_mapping_t* mbMapping_p, TModbusSlaveConfiguration *psModbusConfiguration_p)
+int32_t process_modbus_request(modbus_t *mb_slave_p, modbus_mapping_t* mbMapping_p, TModbusSlaveConfiguration *psModbusConfiguration_p,
+    TProcessImageMirror *ptMirror_p)
 {
     uint8_t req[MODBUS_TCP_MAX_ADU_LENGTH];     // request buffer TCP
     int32_t len = 0;                            //length of the request/response
@@ -351,28 +691,7 @@ int32_t process_modbus_request(modbus_t *mb_slave_p, modbus_mapping_t* mbMapping
     len = modbus_receive(mb_slave_p, req);
     if (len > 0)
     {
-        /*	due to seperated input and output areas in the pi process image,
-            data from pi process image (e.g. other device) can only be requested by
-            the modbus functions READ_INPUT_REGISTERS and READ_DISCRETE_INPUTS
-            therefor only for this modbus functions a read from the pi process image is performed
-         */
-        uint8_t mb_function_code = req[modbus_get_header_length(mb_slave_p)];	//the modbus function code for the current request
-        if ((mb_function_code == eREAD_INPUT_REGISTERS) || (mb_function_code == eREAD_DISCRETE_INPUTS)) 
-        {
-            readModbusDataFromProcessImage(mbMapping_p, &(psModbusConfiguration_p->tProcessImageConfig));
-        }
-        len = modbus_reply(mb_slave_p, req, len, mbMapping_p);
-        if (len == -1)
-        {
-            syslog(LOG_ERR, "modbus reply failed\n");
-            return -1;
-        }			
-        if ((mb_function_code == eWRITE_MULTIPLE_COILS) || (mb_function_code == eWRITE_MULTIPLE_REGISTERS) ||
-            (mb_function_code == eWRITE_SINGLE_COIL) || (mb_function_code == eWRITE_SINGLE_REGISTER) ||
-            (mb_function_code == eWRITE_AND_READ_REGISTERS) || (mb_function_code == eWRITE_MASK_REGISTER))
-        {
-            writeModbusDataToProcessImage(mbMapping_p, &(psModbusConfiguration_p->tProcessImageConfig));
-        }		
+        return reply_modbus_request(mb_slave_p, req, len, mbMapping_p, psModbusConfiguration_p, ptMirror_p);
     }
     else if (len == -1)
     {
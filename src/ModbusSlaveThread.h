@@ -15,9 +15,13 @@
 #define MODBUS_SLAVE_THREAD_H_
 
 #include "modbusconfig.h"
+#include "ProcessImageMirror.h"
 
 void *startTcpSlaveThread(void *arg);
 void *startRtuSlaveThread(void *arg);
-int32_t process_modbus_request(modbus_t *mb_slave_p, modbus_mapping_t* mbMapping_p, TModbusSlaveConfiguration *psModbusConfiguration_p);
+int32_t process_modbus_request(modbus_t *mb_slave_p, modbus_mapping_t* mbMapping_p, TModbusSlaveConfiguration *psModbusConfiguration_p,
+    TProcessImageMirror *ptMirror_p);
+int32_t reply_modbus_request(modbus_t *mb_slave_p, const uint8_t *req, int32_t len, modbus_mapping_t* mbMapping_p,
+    TModbusSlaveConfiguration *psModbusConfiguration_p, TProcessImageMirror *ptMirror_p);
 
 #endif /* MODBUS_SLAVE_THREAD_H_ */
@@ -0,0 +1,684 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#include "project.h"
+
+#define _GNU_SOURCE //ppoll
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/param.h>
+#include <modbus/modbus.h>
+#include "ModbusTcpPipeline.h"
+#include "ComAndDataProcessor.h"
+
+#define MODBUS_ADDRESS_OFFSET 1
+
+static uint16_t getUint16(const uint8_t *pSrc_p)
+{
+    return (uint16_t)((pSrc_p[0] << 8) | pSrc_p[1]);
+}
+
+static void putUint16(uint8_t *pDest_p, uint16_t u16Value_p)
+{
+    pDest_p[0] = (uint8_t)(u16Value_p >> 8);
+    pDest_p[1] = (uint8_t)(u16Value_p & 0xFF);
+}
+
+static bool isTimeBefore(const struct timespec *a, const struct timespec *b)
+{
+    struct timespec tv_diff;
+    return timespec_diff(&tv_diff, a, b) < 0;
+}
+
+static void addMicroseconds(struct timespec *sum, const struct timespec *summand, uint32_t u32Us_p)
+{
+    struct timespec tv_offset;
+    tv_offset.tv_sec = u32Us_p / s32_microseconds_per_second;
+    tv_offset.tv_nsec = (u32Us_p % s32_microseconds_per_second) * 1000;
+    timespec_add(sum, summand, &tv_offset);
+}
+
+/************************************************************************/
+/** @ brief checks if the pipeline can send the function of an action
+ */
+/************************************************************************/
+static bool isPipelineFunction(EModbusFunction eFunctionCode_p)
+{
+    switch (eFunctionCode_p)
+    {
+    case eREAD_COILS:
+    case eREAD_DISCRETE_INPUTS:
+    case eREAD_HOLDING_REGISTERS:
+    case eREAD_INPUT_REGISTERS:
+    case eWRITE_SINGLE_COIL:
+    case eWRITE_SINGLE_REGISTER:
+    case eWRITE_MULTIPLE_COILS:
+    case eWRITE_MULTIPLE_REGISTERS:
+    case eREPORT_SLAVE_ID:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/************************************************************************/
+/** @ brief initializes a pipeline on a connected modbus tcp socket
+ *  
+ *  @param[out] ptPipeline_p the pipeline
+ *  @param[in] iSocket_p socket of the connected modbus context
+ *  @param[in] u32Depth_p max number of outstanding requests
+ *  @return '0' if successful, otherwise '-1'
+ *  
+ */
+/************************************************************************/
+int32_t initTcpPipeline(TModbusTcpPipeline *ptPipeline_p, int iSocket_p, uint32_t u32Depth_p)
+{
+    memset(ptPipeline_p, 0, sizeof(*ptPipeline_p));
+    ptPipeline_p->iSocket = iSocket_p;
+    ptPipeline_p->u32Depth = (u32Depth_p > MAX_PIPELINE_DEPTH) ? MAX_PIPELINE_DEPTH : u32Depth_p;
+    for (uint32_t i = 0; i < MAX_PIPELINE_DEPTH; i++)
+    {
+        ptPipeline_p->atRequests[i].i32Action = -1;
+    }
+    for (uint32_t i = 0; i < ptPipeline_p->u32Depth; i++)
+    {
+        ptPipeline_p->atActions[i].pBuffer = (uint8_t*)malloc(MAX_REGISTER_SIZE_PER_ACTION);
+        if (ptPipeline_p->atActions[i].pBuffer == NULL)
+        {
+            syslog(LOG_ERR, "Unable to allocate modbus tcp pipeline\n");
+            cleanupTcpPipeline(ptPipeline_p);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief frees the buffers of a pipeline
+ *  
+ *  @param[in] ptr the pipeline (TModbusTcpPipeline*), usable as cleanup
+ *             handler of the master thread
+ *  
+ */
+/************************************************************************/
+void cleanupTcpPipeline(void *ptr)
+{
+    TModbusTcpPipeline *ptPipeline_l = (TModbusTcpPipeline *)ptr;
+    for (uint32_t i = 0; i < MAX_PIPELINE_DEPTH; i++)
+    {
+        free(ptPipeline_l->atActions[i].pBuffer);
+        ptPipeline_l->atActions[i].pBuffer = NULL;
+        ptPipeline_l->atActions[i].bActive = false;
+    }
+}
+
+/************************************************************************/
+/** @ brief writes the result of a finished action to the process image
+ */
+/************************************************************************/
+static void completePipelineAction(TModbusTcpPipeline *ptPipeline_p, TPipelineAction *ptAction_p, const TModbusMasterConfiguration *ptConfig_p)
+{
+    const TModbusAction *ptModbusAction_l = ptAction_p->tEvent.ptModbusAction;
+    struct timespec tv_current;
+
+    clock_gettime(CLOCK_MONOTONIC, &tv_current);
+    if (ptAction_p->i32Error != 0)
+    {
+        const TTcpConfig *ptTcpConfig_l = &(ptConfig_p->tModbusDeviceConfig.uProt.tTcpConfig);
+        syslog(LOG_ERR,
+            "Modbus TCP action IP: %s, Port: %d function: 0x%02X, address: %d failed %d/%d\n",
+            ptTcpConfig_l->szTcpIpAddress,
+            ptTcpConfig_l->i32uPort,
+            (int32_t)ptModbusAction_l->eFunctionCode,
+            (int32_t)ptModbusAction_l->i32uStartRegister,
+            -1,
+            ptAction_p->i32Error);
+        errno = ptAction_p->i32Error;
+        completeModbusAction(ptModbusAction_l, ptAction_p->pBuffer, -1);
+        reportTcpResponse(ptPipeline_p->ptConnection, isModbusExceptionResponse(ptAction_p->i32Error), &tv_current);
+        reportEventResult(ptPipeline_p->pEventListHead, ptAction_p->tEvent.pSchedulerEvent, false);
+    }
+    else
+    {
+        int32_t successful = completeModbusAction(ptModbusAction_l, ptAction_p->pBuffer, ptAction_p->i32Transferred);
+        reportTcpResponse(ptPipeline_p->ptConnection, true, &tv_current);
+        reportEventResult(ptPipeline_p->pEventListHead, ptAction_p->tEvent.pSchedulerEvent, successful >= 0);
+    }
+    ptAction_p->bActive = false;
+}
+
+/************************************************************************/
+/** @ brief finishes an outstanding request with its response or error
+ *  
+ *  @param[in] i32Length_p number of registers/coils of the response,
+ *             negative with errno set if the request failed
+ *  
+ *  the action is completed when all of its sent requests are finished and
+ *  either all requests were sent or one of them failed
+ */
+/************************************************************************/
+static void finishPipelineRequest(TModbusTcpPipeline *ptPipeline_p, TPipelineRequest *ptRequest_p, int32_t i32Length_p, const TModbusMasterConfiguration *ptConfig_p)
+{
+    TPipelineAction *ptAction_l = &(ptPipeline_p->atActions[ptRequest_p->i32Action]);
+
+    ptRequest_p->i32Action = -1;
+    ptAction_l->u32PduDone++;
+    if (i32Length_p < 0)
+    {
+        if (ptAction_l->i32Error == 0)
+        {
+            ptAction_l->i32Error = errno;
+        }
+    }
+    else
+    {
+        ptAction_l->i32Transferred += i32Length_p;
+    }
+
+    if ((ptAction_l->u32PduDone == ptAction_l->u32PduSent)
+        && ((ptAction_l->u32PduSent == ptAction_l->u32PduCount) || (ptAction_l->i32Error != 0)))
+    {
+        completePipelineAction(ptPipeline_p, ptAction_l, ptConfig_p);
+    }
+}
+
+/************************************************************************/
+/** @ brief fails all actions of the pipeline, e.g. after a connection loss
+ *  
+ *  @param[in] err errno which is reported for the actions
+ *  
+ */
+/************************************************************************/
+void abortTcpPipeline(TModbusTcpPipeline *ptPipeline_p, int err, const TModbusMasterConfiguration *ptConfig_p)
+{
+    for (uint32_t i = 0; i < MAX_PIPELINE_DEPTH; i++)
+    {
+        ptPipeline_p->atRequests[i].i32Action = -1;
+    }
+    for (uint32_t i = 0; i < ptPipeline_p->u32Depth; i++)
+    {
+        TPipelineAction *ptAction_l = &(ptPipeline_p->atActions[i]);
+        if (ptAction_l->bActive)
+        {
+            if (ptAction_l->i32Error == 0)
+            {
+                ptAction_l->i32Error = err;
+            }
+            completePipelineAction(ptPipeline_p, ptAction_l, ptConfig_p);
+        }
+    }
+    ptPipeline_p->i32RxLength = 0;
+}
+
+/************************************************************************/
+/** @ brief checks if an action can be started now
+ *  
+ *  an action is never sent again before all requests of its previous
+ *  period are finished
+ */
+/************************************************************************/
+static TPipelineAction* getFreePipelineAction(TModbusTcpPipeline *ptPipeline_p, const tModbusEvent *pEvent_p)
+{
+    TPipelineAction *ptFree_l = NULL;
+    for (uint32_t i = 0; i < ptPipeline_p->u32Depth; i++)
+    {
+        TPipelineAction *ptAction_l = &(ptPipeline_p->atActions[i]);
+        if (!ptAction_l->bActive)
+        {
+            if (ptFree_l == NULL)
+            {
+                ptFree_l = ptAction_l;
+            }
+        }
+        else if (ptAction_l->tEvent.pSchedulerEvent == pEvent_p->pSchedulerEvent)
+        {
+            return NULL;
+        }
+    }
+    return ptFree_l;
+}
+
+/************************************************************************/
+/** @ brief starts a modbus action which is due
+ *  
+ *  resets the status bytes if requested and reads the data of a write
+ *  action from the process image, the requests are sent by
+ *  sendPipelineRequests()
+ */
+/************************************************************************/
+static void startPipelineAction(TModbusTcpPipeline *ptPipeline_p, TPipelineAction *ptAction_p, const tModbusEvent *pEvent_p, const TModbusMasterConfiguration *ptConfig_p)
+{
+    const TModbusAction *ptModbusAction_l = pEvent_p->ptModbusAction;
+
+    if (pEvent_p->u32DroppedPeriods > 0)
+    {
+        syslog(LOG_INFO, "Modbus action %d: %u missed periods dropped\n",
+            (int)ptModbusAction_l->i16uActionID,
+            (unsigned)pEvent_p->u32DroppedPeriods);
+    }
+
+    //check if reset status is set and reset status if neccessarry
+    reset_modbus_action_status_of(ptModbusAction_l);
+    reset_modbus_master_status_of(ptConfig_p);
+
+    if (!isPipelineFunction(ptModbusAction_l->eFunctionCode))
+    {
+        syslog(LOG_ERR, "Unknown Modbus function: %d\n", (int8_t)(ptModbusAction_l->eFunctionCode));
+        return;
+    }
+    if (prepareModbusAction(ptModbusAction_l, ptAction_p->pBuffer) < 0)
+    {
+        reportEventResult(ptPipeline_p->pEventListHead, pEvent_p->pSchedulerEvent, false);
+        return;
+    }
+
+    ptAction_p->tEvent = *pEvent_p;
+    ptAction_p->u32PduCount = getModbusActionPduCount(ptModbusAction_l);
+    ptAction_p->u32PduSent = 0;
+    ptAction_p->u32PduDone = 0;
+    ptAction_p->i32Transferred = 0;
+    ptAction_p->i32Error = 0;
+    ptAction_p->bActive = true;
+}
+
+/************************************************************************/
+/** @ brief sends the next request of an action
+ *  
+ *  @return '0' if successful, '-1' with errno set if the connection failed
+ *  
+ */
+/************************************************************************/
+static int32_t sendPipelineRequest(TModbusTcpPipeline *ptPipeline_p, int32_t i32Action_p, TPipelineRequest *ptRequest_p, TResponseTimeoutTable *ptTimeouts_p)
+{
+    TPipelineAction *ptAction_l = &(ptPipeline_p->atActions[i32Action_p]);
+    const TModbusAction *ptModbusAction_l = ptAction_l->tEvent.ptModbusAction;
+    uint16_t u16MaxCount_l = getModbusPduMaxCount(ptModbusAction_l->eFunctionCode);
+    uint8_t au8Adu_l[MODBUS_TCP_ADU_LENGTH];
+    uint16_t u16Offset_l = 0;
+    uint16_t u16Count_l = ptModbusAction_l->i16uRegisterCount;
+    int32_t i32PduLength_l;
+    ssize_t sent;
+
+    if (u16MaxCount_l != 0)
+    {
+        u16Offset_l = (uint16_t)(ptAction_l->u32PduSent * u16MaxCount_l);
+        u16Count_l = MIN(u16MaxCount_l, ptModbusAction_l->i16uRegisterCount - u16Offset_l);
+    }
+
+    i32PduLength_l = buildModbusRequestPdu(ptModbusAction_l->eFunctionCode,
+        (uint16_t)(ptModbusAction_l->i32uStartRegister - MODBUS_ADDRESS_OFFSET + u16Offset_l),
+        u16Count_l,
+        &(ptAction_l->pBuffer[getModbusBufferOffset(ptModbusAction_l->eFunctionCode, u16Offset_l)]),
+        &(au8Adu_l[MODBUS_MBAP_HEADER_LENGTH]));
+    if (i32PduLength_l < 0)
+    {
+        //the request is not sent, the action fails once its sent requests are finished
+        ptAction_l->i32Error = errno;
+        ptAction_l->u32PduCount = ptAction_l->u32PduSent;
+        return 0;
+    }
+
+    ptRequest_p->u16TransactionId = ptPipeline_p->u16NextTransactionId++;
+    putUint16(&(au8Adu_l[0]), ptRequest_p->u16TransactionId);
+    putUint16(&(au8Adu_l[2]), 0);   //protocol id
+    putUint16(&(au8Adu_l[4]), (uint16_t)(i32PduLength_l + 1));
+    au8Adu_l[6] = ptModbusAction_l->i8uSlaveAddress;
+
+    sent = send(ptPipeline_p->iSocket, au8Adu_l, MODBUS_MBAP_HEADER_LENGTH + i32PduLength_l, MSG_NOSIGNAL);
+    if (sent != MODBUS_MBAP_HEADER_LENGTH + i32PduLength_l)
+    {
+        if (sent >= 0)
+        {
+            errno = EIO;
+        }
+        return -1;
+    }
+
+    ptRequest_p->i32Action = i32Action_p;
+    ptRequest_p->u16Offset = u16Offset_l;
+    ptRequest_p->u16Count = u16Count_l;
+    clock_gettime(CLOCK_MONOTONIC, &(ptRequest_p->tvSent));
+    addMicroseconds(&(ptRequest_p->tvDeadline), &(ptRequest_p->tvSent),
+        getResponseTimeout(ptTimeouts_p, &(ptAction_l->tEvent.pSchedulerEvent->tRtt), ptModbusAction_l->i8uSlaveAddress));
+    ptAction_l->u32PduSent++;
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief fills the free request slots with the requests of the
+ *          started actions
+ *  
+ *  @return '0' if successful, '-1' with errno set if the connection failed
+ *  
+ *  an action whose request could not be built is completed as failed as
+ *  soon as none of its requests is outstanding
+ */
+/************************************************************************/
+static int32_t sendPipelineRequests(TModbusTcpPipeline *ptPipeline_p, TResponseTimeoutTable *ptTimeouts_p, const TModbusMasterConfiguration *ptConfig_p)
+{
+    uint32_t u32Request_l = 0;
+
+    for (uint32_t i = 0; i < ptPipeline_p->u32Depth; i++)
+    {
+        TPipelineAction *ptAction_l = &(ptPipeline_p->atActions[i]);
+        while (ptAction_l->bActive
+            && (ptAction_l->i32Error == 0)
+            && (ptAction_l->u32PduSent < ptAction_l->u32PduCount))
+        {
+            while ((u32Request_l < ptPipeline_p->u32Depth) && (ptPipeline_p->atRequests[u32Request_l].i32Action >= 0))
+            {
+                u32Request_l++;
+            }
+            if (u32Request_l == ptPipeline_p->u32Depth)
+            {
+                return 0;
+            }
+            if (sendPipelineRequest(ptPipeline_p, (int32_t)i, &(ptPipeline_p->atRequests[u32Request_l]), ptTimeouts_p) < 0)
+            {
+                return -1;
+            }
+        }
+        if (ptAction_l->bActive && (ptAction_l->i32Error != 0) && (ptAction_l->u32PduDone == ptAction_l->u32PduSent))
+        {
+            completePipelineAction(ptPipeline_p, ptAction_l, ptConfig_p);
+        }
+    }
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief fails all requests whose response timeout expired
+ *  
+ *  a late response of an expired request is discarded
+ */
+/************************************************************************/
+static void expirePipelineRequests(TModbusTcpPipeline *ptPipeline_p, TResponseTimeoutTable *ptTimeouts_p, const struct timespec *ptv_current_p, const TModbusMasterConfiguration *ptConfig_p)
+{
+    for (uint32_t i = 0; i < ptPipeline_p->u32Depth; i++)
+    {
+        TPipelineRequest *ptRequest_l = &(ptPipeline_p->atRequests[i]);
+        if ((ptRequest_l->i32Action >= 0) && !isTimeBefore(ptv_current_p, &(ptRequest_l->tvDeadline)))
+        {
+            TPipelineAction *ptAction_l = &(ptPipeline_p->atActions[ptRequest_l->i32Action]);
+            backoffResponseTimeout(ptTimeouts_p, &(ptAction_l->tEvent.pSchedulerEvent->tRtt), ptAction_l->tEvent.ptModbusAction->i8uSlaveAddress);
+            errno = ETIMEDOUT;
+            finishPipelineRequest(ptPipeline_p, ptRequest_l, -1, ptConfig_p);
+        }
+    }
+}
+
+/************************************************************************/
+/** @ brief processes one response frame
+ *  
+ *  @param[in] pFrame_p MBAP header and PDU of the response
+ *  @param[in] i32Length_p length of the frame
+ *  
+ */
+/************************************************************************/
+static void processPipelineResponse(TModbusTcpPipeline *ptPipeline_p, const uint8_t *pFrame_p, int32_t i32Length_p, TResponseTimeoutTable *ptTimeouts_p, const TModbusMasterConfiguration *ptConfig_p)
+{
+    uint16_t u16TransactionId_l = getUint16(&(pFrame_p[0]));
+
+    for (uint32_t i = 0; i < ptPipeline_p->u32Depth; i++)
+    {
+        TPipelineRequest *ptRequest_l = &(ptPipeline_p->atRequests[i]);
+        if ((ptRequest_l->i32Action >= 0) && (ptRequest_l->u16TransactionId == u16TransactionId_l))
+        {
+            TPipelineAction *ptAction_l = &(ptPipeline_p->atActions[ptRequest_l->i32Action]);
+            const TModbusAction *ptModbusAction_l = ptAction_l->tEvent.ptModbusAction;
+            int32_t len;
+
+            if (pFrame_p[6] != ptModbusAction_l->i8uSlaveAddress)
+            {
+                errno = EMBBADSLAVE;
+                len = -1;
+            }
+            else
+            {
+                len = parseModbusResponsePdu(ptModbusAction_l->eFunctionCode,
+                    (uint16_t)(ptModbusAction_l->i32uStartRegister - MODBUS_ADDRESS_OFFSET + ptRequest_l->u16Offset),
+                    ptRequest_l->u16Count,
+                    &(pFrame_p[MODBUS_MBAP_HEADER_LENGTH]),
+                    i32Length_p - MODBUS_MBAP_HEADER_LENGTH,
+                    &(ptAction_l->pBuffer[getModbusBufferOffset(ptModbusAction_l->eFunctionCode, ptRequest_l->u16Offset)]));
+            }
+
+            if (len >= 0)
+            {
+                struct timespec tv_current;
+                struct timespec tv_rtt;
+                clock_gettime(CLOCK_MONOTONIC, &tv_current);
+                timespec_diff(&tv_rtt, &tv_current, &(ptRequest_l->tvSent));
+                updateResponseTimeout(ptTimeouts_p, &(ptAction_l->tEvent.pSchedulerEvent->tRtt), ptModbusAction_l->i8uSlaveAddress,
+                    (uint32_t)(tv_rtt.tv_sec * s32_microseconds_per_second + tv_rtt.tv_nsec / 1000));
+            }
+            finishPipelineRequest(ptPipeline_p, ptRequest_l, len, ptConfig_p);
+            return;
+        }
+    }
+    //response of an expired request
+}
+
+/************************************************************************/
+/** @ brief receives and processes the available response frames
+ *  
+ *  @return '0' if successful, '-1' with errno set if the connection
+ *          failed or the stream is out of sync
+ *  
+ */
+/************************************************************************/
+static int32_t receivePipelineResponses(TModbusTcpPipeline *ptPipeline_p, TResponseTimeoutTable *ptTimeouts_p, const TModbusMasterConfiguration *ptConfig_p)
+{
+    ssize_t received = recv(ptPipeline_p->iSocket,
+        &(ptPipeline_p->au8Rx[ptPipeline_p->i32RxLength]),
+        sizeof(ptPipeline_p->au8Rx) - ptPipeline_p->i32RxLength,
+        MSG_DONTWAIT);
+    if (received == 0)
+    {
+        errno = ECONNRESET;
+        return -1;
+    }
+    if (received < 0)
+    {
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+    }
+    ptPipeline_p->i32RxLength += received;
+
+    int32_t i32Offset_l = 0;
+    while (ptPipeline_p->i32RxLength - i32Offset_l >= MODBUS_MBAP_HEADER_LENGTH)
+    {
+        const uint8_t *pFrame_l = &(ptPipeline_p->au8Rx[i32Offset_l]);
+        uint16_t u16Length_l = getUint16(&(pFrame_l[4]));    //unit id and PDU
+        if ((getUint16(&(pFrame_l[2])) != 0) || (u16Length_l < 2) || (u16Length_l > MODBUS_MAX_PDU_LENGTH + 1))
+        {
+            errno = EMBBADDATA;
+            return -1;
+        }
+        if (ptPipeline_p->i32RxLength - i32Offset_l < MODBUS_MBAP_HEADER_LENGTH - 1 + u16Length_l)
+        {
+            break;
+        }
+        processPipelineResponse(ptPipeline_p, pFrame_l, MODBUS_MBAP_HEADER_LENGTH - 1 + u16Length_l, ptTimeouts_p, ptConfig_p);
+        i32Offset_l += MODBUS_MBAP_HEADER_LENGTH - 1 + u16Length_l;
+    }
+    ptPipeline_p->i32RxLength -= i32Offset_l;
+    memmove(ptPipeline_p->au8Rx, &(ptPipeline_p->au8Rx[i32Offset_l]), ptPipeline_p->i32RxLength);
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief prepares a pipeline on a new connection for serviceTcpPipeline()
+ *  
+ *  @param[in] ptPipeline_p initialized pipeline on the connected socket
+ *  @param[in] pEventListHead_p the scheduler with all actions of the master
+ *  @param[in] ptConnection_p connection state for the dead peer detection
+ *  @return '0' if successful, '-1' if the master has no actions
+ *  
+ */
+/************************************************************************/
+int32_t startTcpPipeline(TModbusTcpPipeline *ptPipeline_p,
+                         struct suEventListHead *pEventListHead_p,
+                         TTcpConnection *ptConnection_p)
+{
+    ptPipeline_p->pEventListHead = pEventListHead_p;
+    ptPipeline_p->ptConnection = ptConnection_p;
+    return getNextEvent(&(ptPipeline_p->tNextEvent), pEventListHead_p);
+}
+
+/************************************************************************/
+/** @ brief processes the pending work of a pipeline without waiting
+ *  
+ *  @param[in] bReadable_p true if the socket has data or an error
+ *  @param[in] ptTimeouts_p response timeout table of the master
+ *  @param[in] ptConfig_p configuration of the master
+ *  @param[out] ptv_wakeup_p time of the next trigger or response timeout,
+ *              the pipeline has to be serviced again at this time or when
+ *              the socket gets readable. If the next action is due but
+ *              cannot start yet, only the response timeouts count: it is
+ *              started when a response or timeout frees its slot.
+ *  @return '0' if successful, '-1' if the connection has to be
+ *          reestablished, all outstanding actions are failed then
+ *  
+ *	receives the available responses, fails the expired requests, starts
+ *	the due actions in the order of the scheduler as long as fewer than
+ *	u32Depth actions are outstanding and sends their requests
+ */
+/************************************************************************/
+int32_t serviceTcpPipeline(TModbusTcpPipeline *ptPipeline_p,
+                           bool bReadable_p,
+                           TResponseTimeoutTable *ptTimeouts_p,
+                           const TModbusMasterConfiguration *ptConfig_p,
+                           struct timespec *ptv_wakeup_p)
+{
+    struct timespec tv_current;
+    TPipelineAction *ptAction_l;
+
+    if (bReadable_p && (receivePipelineResponses(ptPipeline_p, ptTimeouts_p, ptConfig_p) < 0))
+    {
+        syslog(LOG_ERR, "Modbus TCP receive failed: %s\n", modbus_strerror(errno));
+        abortTcpPipeline(ptPipeline_p, errno, ptConfig_p);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &tv_current);
+    expirePipelineRequests(ptPipeline_p, ptTimeouts_p, &tv_current, ptConfig_p);
+
+    if (isTcpPeerDead(ptPipeline_p->ptConnection, ptPipeline_p->iSocket, &tv_current))
+    {
+        syslog(LOG_ERR,
+            "Modbus TCP IP: %s, Port %d: no response -> reconnect\n",
+            ptConfig_p->tModbusDeviceConfig.uProt.tTcpConfig.szTcpIpAddress,
+            ptConfig_p->tModbusDeviceConfig.uProt.tTcpConfig.i32uPort);
+        abortTcpPipeline(ptPipeline_p, ECONNRESET, ptConfig_p);
+        return -1;
+    }
+
+    //start all due actions as long as the pipeline has room for them
+    while (!isTimeBefore(&tv_current, &(ptPipeline_p->tNextEvent.triggerTime))
+        && ((ptAction_l = getFreePipelineAction(ptPipeline_p, &(ptPipeline_p->tNextEvent))) != NULL))
+    {
+        startPipelineAction(ptPipeline_p, ptAction_l, &(ptPipeline_p->tNextEvent), ptConfig_p);
+        getNextEvent(&(ptPipeline_p->tNextEvent), ptPipeline_p->pEventListHead);
+    }
+
+    if (sendPipelineRequests(ptPipeline_p, ptTimeouts_p, ptConfig_p) < 0)
+    {
+        syslog(LOG_ERR, "Modbus TCP send failed: %s\n", modbus_strerror(errno));
+        abortTcpPipeline(ptPipeline_p, errno, ptConfig_p);
+        return -1;
+    }
+
+    //the next trigger time or the earliest response timeout. A due action which waits for a free
+    //slot or for its previous period has outstanding requests, its trigger time would wake at once.
+    bool bBlocked_l = !isTimeBefore(&tv_current, &(ptPipeline_p->tNextEvent.triggerTime))
+        && (getFreePipelineAction(ptPipeline_p, &(ptPipeline_p->tNextEvent)) == NULL);
+    bool bWakeup_l = !bBlocked_l;
+    *ptv_wakeup_p = ptPipeline_p->tNextEvent.triggerTime;
+    for (uint32_t i = 0; i < ptPipeline_p->u32Depth; i++)
+    {
+        TPipelineRequest *ptRequest_l = &(ptPipeline_p->atRequests[i]);
+        if ((ptRequest_l->i32Action >= 0) && (!bWakeup_l || isTimeBefore(&(ptRequest_l->tvDeadline), ptv_wakeup_p)))
+        {
+            *ptv_wakeup_p = ptRequest_l->tvDeadline;
+            bWakeup_l = true;
+        }
+    }
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief processes the modbus actions of a master with several
+ *          outstanding requests
+ *  
+ *  @param[in] ptPipeline_p pipeline on the connected socket
+ *  @param[in] pEventListHead_p the scheduler with all actions of the master
+ *  @param[in] ptConnection_p connection state for the dead peer detection
+ *  @param[in] ptTimeouts_p response timeout table of the master
+ *  @param[in] ptConfig_p configuration of the master
+ *  @return '-1' if the connection has to be reestablished
+ *  
+ *	Each response is matched to its request by the transaction id, so a
+ *	slow slave does not delay the responses of the others.
+ */
+/************************************************************************/
+int32_t runTcpPipeline(TModbusTcpPipeline *ptPipeline_p,
+                       struct suEventListHead *pEventListHead_p,
+                       TTcpConnection *ptConnection_p,
+                       TResponseTimeoutTable *ptTimeouts_p,
+                       const TModbusMasterConfiguration *ptConfig_p)
+{
+    struct pollfd tPollFd_l;
+    bool bReadable_l = false;
+
+    tPollFd_l.fd = ptPipeline_p->iSocket;
+    tPollFd_l.events = POLLIN;
+
+    if (startTcpPipeline(ptPipeline_p, pEventListHead_p, ptConnection_p) < 0)
+    {
+        return -1;
+    }
+
+    while (1)
+    {
+        struct timespec tv_current;
+        struct timespec tv_wakeup;
+        struct timespec tv_timeout;
+        int ret;
+
+        if (serviceTcpPipeline(ptPipeline_p, bReadable_l, ptTimeouts_p, ptConfig_p, &tv_wakeup) < 0)
+        {
+            return -1;
+        }
+
+        //wait for a response, the next trigger time or the earliest response timeout
+        clock_gettime(CLOCK_MONOTONIC, &tv_current);
+        if (timespec_diff(&tv_timeout, &tv_wakeup, &tv_current) < 0)
+        {
+            tv_timeout.tv_sec = 0;
+            tv_timeout.tv_nsec = 0;
+        }
+
+        ret = ppoll(&tPollFd_l, 1, &tv_timeout, NULL);
+        if ((ret < 0) && (errno != EINTR))
+        {
+            abortTcpPipeline(ptPipeline_p, errno, ptConfig_p);
+            return -1;
+        }
+        bReadable_l = (ret > 0);
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef MODBUS_TCP_PIPELINE_H_
+#define MODBUS_TCP_PIPELINE_H_
+
+#include <stdbool.h>
+#include "Scheduler.h"
+#include "ModbusPdu.h"
+#include "TcpConnection.h"
+
+#define MODBUS_TCP_ADU_LENGTH (MODBUS_MBAP_HEADER_LENGTH + MODBUS_MAX_PDU_LENGTH)
+
+/************************************************************************/
+/** @ brief modbus action which is processed by the pipeline
+ *  
+ *	an action with more registers than fit into one modbus request is sent
+ *	as several requests, the process image is updated when all of them
+ *	are answered
+ */
+/************************************************************************/
+typedef struct
+{
+	tModbusEvent tEvent;
+	uint8_t *pBuffer;			//registers (2 bytes each) or coils (1 byte each) of the action
+	uint32_t u32PduCount;		//number of requests of the action
+	uint32_t u32PduSent;
+	uint32_t u32PduDone;
+	int32_t i32Transferred;		//registers/coils transferred so far
+	int i32Error;				//errno of the first failed request, 0 if none failed
+	bool bActive;
+} TPipelineAction;
+
+/************************************************************************/
+/** @ brief modbus tcp request which is waiting for its response
+ */
+/************************************************************************/
+typedef struct
+{
+	uint16_t u16TransactionId;
+	int32_t i32Action;			//index of the action in atActions, -1 if the slot is free
+	uint16_t u16Offset;			//first register/coil of the request within the action
+	uint16_t u16Count;
+	struct timespec tvSent;
+	struct timespec tvDeadline;
+} TPipelineRequest;
+
+/************************************************************************/
+/** @ brief modbus tcp client with several outstanding requests
+ *  
+ *	the requests are matched with their responses by the transaction id of
+ *	the MBAP header, so up to u32Depth requests can be sent without waiting
+ *	for the previous responses
+ */
+/************************************************************************/
+typedef struct
+{
+	int iSocket;
+	uint32_t u32Depth;
+	uint16_t u16NextTransactionId;
+	TTcpConnection *ptConnection;	//for the dead peer detection
+	tModbusEvent tNextEvent;		//next action from the scheduler
+	struct suEventListHead *pEventListHead;	//scheduler of the actions, for the failure backoff
+	TPipelineAction atActions[MAX_PIPELINE_DEPTH];
+	TPipelineRequest atRequests[MAX_PIPELINE_DEPTH];
+	uint8_t au8Rx[2 * MODBUS_TCP_ADU_LENGTH];
+	int32_t i32RxLength;
+} TModbusTcpPipeline;
+
+int32_t initTcpPipeline(TModbusTcpPipeline *ptPipeline_p, int iSocket_p, uint32_t u32Depth_p);
+void cleanupTcpPipeline(void *ptr);
+int32_t startTcpPipeline(TModbusTcpPipeline *ptPipeline_p,
+						 struct suEventListHead *pEventListHead_p,
+						 TTcpConnection *ptConnection_p);
+int32_t serviceTcpPipeline(TModbusTcpPipeline *ptPipeline_p,
+						   bool bReadable_p,
+						   TResponseTimeoutTable *ptTimeouts_p,
+						   const TModbusMasterConfiguration *ptConfig_p,
+						   struct timespec *ptv_wakeup_p);
+void abortTcpPipeline(TModbusTcpPipeline *ptPipeline_p, int err, const TModbusMasterConfiguration *ptConfig_p);
+int32_t runTcpPipeline(TModbusTcpPipeline *ptPipeline_p,
+					   struct suEventListHead *pEventListHead_p,
+					   TTcpConnection *ptConnection_p,
+					   TResponseTimeoutTable *ptTimeouts_p,
+					   const TModbusMasterConfiguration *ptConfig_p);
+
+#endif /* MODBUS_TCP_PIPELINE_H_ */
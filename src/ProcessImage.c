@@ -0,0 +1,356 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster, piModbusSlave
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#include "project.h"
+
+#define _XOPEN_SOURCE 500 //pread and pwrite
+#include "ProcessImage.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define MAX_PROCESS_IMAGE_BIT_BYTES (65536 / 8 + 1)    //whole modbus address range at any start bit
+#define BIT_LANES_MASK 0x0101010101010101ULL
+
+/************************************************************************/
+/*  The piControlIf functions seek on one shared file descriptor and then
+ *  read or write, so two threads may interleave and access the wrong
+ *  offset. This module uses positional pread/pwrite instead, which do
+ *  not touch the file offset, and the bit ioctls which are atomic in the
+ *  driver. The descriptor is opened on the first access and then shared
+ *  by all master and slave threads without any lock. A failed open is
+ *  retried on the next access, e.g. until the driver is loaded. Only bit
+ *  ranges which start or end within a byte are read, modified and written
+ *  back under tBitLock, which also serialises the single bit writes of
+ *  this process.
+ */
+/************************************************************************/
+
+static int iProcessImageHandle = -1;
+static pthread_mutex_t tOpenLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t tBitLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int getProcessImageHandle(void)
+{
+    static bool bOpenFailed = false;    //the failure is logged once, not on every access
+    int iHandle_l = __atomic_load_n(&iProcessImageHandle, __ATOMIC_ACQUIRE);
+
+    if (iHandle_l >= 0)
+    {
+        return iHandle_l;
+    }
+    pthread_mutex_lock(&tOpenLock);
+    iHandle_l = iProcessImageHandle;
+    if (iHandle_l < 0)
+    {
+        iHandle_l = open(PICONTROL_DEVICE, O_RDWR);
+        if (iHandle_l < 0)
+        {
+            if (!bOpenFailed)
+            {
+                syslog(LOG_ERR, "Cannot open process image %s: %d\n", PICONTROL_DEVICE, errno);
+            }
+            bOpenFailed = true;
+        }
+        else
+        {
+            if (bOpenFailed)
+            {
+                syslog(LOG_INFO, "Process image %s opened\n", PICONTROL_DEVICE);
+            }
+            bOpenFailed = false;
+            __atomic_store_n(&iProcessImageHandle, iHandle_l, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&tOpenLock);
+    return iHandle_l;
+}
+
+/************************************************************************/
+/** @ brief reads bytes from the process image
+ *  
+ *  @param[in] u32Offset_p byte offset in the process image
+ *  @param[in] u32Length_p number of bytes
+ *  @param[out] pData_p the data
+ *  @return number of bytes read, a negative value on error
+ *  
+ */
+/************************************************************************/
+int32_t readProcessImage(uint32_t u32Offset_p, uint32_t u32Length_p, uint8_t *pData_p)
+{
+    int iHandle_l = getProcessImageHandle();
+    if (iHandle_l < 0)
+    {
+        return -ENODEV;
+    }
+    ssize_t result = pread(iHandle_l, pData_p, u32Length_p, u32Offset_p);
+    return (result < 0) ? -errno : (int32_t)result;
+}
+
+/************************************************************************/
+/** @ brief writes bytes to the process image
+ *  
+ *  @param[in] u32Offset_p byte offset in the process image
+ *  @param[in] u32Length_p number of bytes
+ *  @param[in] pData_p the data
+ *  @return number of bytes written, a negative value on error
+ *  
+ */
+/************************************************************************/
+int32_t writeProcessImage(uint32_t u32Offset_p, uint32_t u32Length_p, const uint8_t *pData_p)
+{
+    int iHandle_l = getProcessImageHandle();
+    if (iHandle_l < 0)
+    {
+        return -ENODEV;
+    }
+    ssize_t result = pwrite(iHandle_l, pData_p, u32Length_p, u32Offset_p);
+    return (result < 0) ? -errno : (int32_t)result;
+}
+
+/************************************************************************/
+/** @ brief reads one bit of the process image
+ *  
+ *  @param[in,out] ptValue_p address and bit, i8uValue receives the value
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ */
+/************************************************************************/
+int32_t getProcessImageBit(SPIValue *ptValue_p)
+{
+    int iHandle_l = getProcessImageHandle();
+    if (iHandle_l < 0)
+    {
+        return -ENODEV;
+    }
+    return (ioctl(iHandle_l, KB_GET_VALUE, ptValue_p) < 0) ? -errno : 0;
+}
+
+/************************************************************************/
+/** @ brief writes one bit of the process image
+ *  
+ *  @param[in] ptValue_p address, bit and value
+ *  @return value >= 0 if successful, otherwise a negative value
+ *  
+ *  the driver modifies the bit atomically, other bits of the byte which
+ *  are written by other threads at the same time are not lost
+ */
+/************************************************************************/
+int32_t setProcessImageBit(SPIValue *ptValue_p)
+{
+    int iHandle_l = getProcessImageHandle();
+    if (iHandle_l < 0)
+    {
+        return -ENODEV;
+    }
+    pthread_mutex_lock(&tBitLock);
+    int32_t result = (ioctl(iHandle_l, KB_SET_VALUE, ptValue_p) < 0) ? -errno : 0;
+    pthread_mutex_unlock(&tBitLock);
+    return result;
+}
+
+/************************************************************************/
+/** @ brief packs bits stored one per byte like libmodbus into bytes
+ *  
+ *  @param[in] pBits_p the bits, every value != 0 is a set bit
+ *  @param[in] u32Count_p number of bits
+ *  @param[out] pBytes_p the packed bits, lsb first, unused bits of the
+ *              last byte are 0
+ *  
+ *  eight bits are packed at once: the bytes are reduced to 0 or 1 and
+ *  the multiplication moves the lowest bit of every byte to the top byte
+ */
+/************************************************************************/
+static void packBits(const uint8_t *pBits_p, uint32_t u32Count_p, uint8_t *pBytes_p)
+{
+    uint32_t i = 0;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    for (; i + 8 <= u32Count_p; i += 8)
+    {
+        uint64_t u64Lanes_l;
+        memcpy(&u64Lanes_l, &(pBits_p[i]), sizeof(u64Lanes_l));
+        u64Lanes_l = ((((u64Lanes_l & ~(BIT_LANES_MASK << 7)) + ~(BIT_LANES_MASK << 7)) | u64Lanes_l) >> 7) & BIT_LANES_MASK;
+        pBytes_p[i >> 3] = (uint8_t)((u64Lanes_l * 0x0102040810204080ULL) >> 56);
+    }
+#endif
+    for (; i < u32Count_p; i += 8)
+    {
+        uint8_t u8Byte_l = 0;
+        for (uint32_t j = 0; (j < 8) && ((i + j) < u32Count_p); j++)
+        {
+            if (pBits_p[i + j])
+            {
+                u8Byte_l |= (uint8_t)(1 << j);
+            }
+        }
+        pBytes_p[i >> 3] = u8Byte_l;
+    }
+}
+
+/************************************************************************/
+/** @ brief unpacks bits into one byte per bit like libmodbus
+ *  
+ *  @param[in] pBytes_p the packed bits, lsb first
+ *  @param[in] u32Count_p number of bits
+ *  @param[out] pBits_p the bits, 0 or 1
+ *  
+ *  eight bits are unpacked at once: the byte is copied to all lanes, every
+ *  lane keeps its own bit, and the addition carries it to the top of the
+ *  lane
+ */
+/************************************************************************/
+static void unpackBits(const uint8_t *pBytes_p, uint32_t u32Count_p, uint8_t *pBits_p)
+{
+    uint32_t i = 0;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    for (; i + 8 <= u32Count_p; i += 8)
+    {
+        uint64_t u64Lanes_l = (pBytes_p[i >> 3] * BIT_LANES_MASK) & 0x8040201008040201ULL;
+        u64Lanes_l = ((u64Lanes_l + ~(BIT_LANES_MASK << 7)) >> 7) & BIT_LANES_MASK;
+        memcpy(&(pBits_p[i]), &u64Lanes_l, sizeof(u64Lanes_l));
+    }
+#endif
+    for (; i < u32Count_p; i++)
+    {
+        pBits_p[i] = (pBytes_p[i >> 3] >> (i & 7)) & 1;
+    }
+}
+
+/************************************************************************/
+/** @ brief reads a range of bits of the process image
+ *  
+ *  @param[in] u32Offset_p byte offset of the first bit
+ *  @param[in] u8StartBit_p bit of the first bit within its byte (0-7)
+ *  @param[in] u32Count_p number of bits (max 65536)
+ *  @param[out] pBits_p the bits, one per byte like libmodbus
+ *  @return number of bits read, a negative value on error
+ *  
+ *  the bytes which contain the range are read with a single pread
+ */
+/************************************************************************/
+int32_t readProcessImageBits(uint32_t u32Offset_p, uint8_t u8StartBit_p, uint32_t u32Count_p, uint8_t *pBits_p)
+{
+    uint8_t au8Bytes_l[MAX_PROCESS_IMAGE_BIT_BYTES + 1];
+    uint32_t u32Length_l = (u8StartBit_p + u32Count_p + 7) / 8;
+
+    if ((u8StartBit_p > 7) || (u32Length_l > MAX_PROCESS_IMAGE_BIT_BYTES))
+    {
+        return -EINVAL;
+    }
+    int32_t result = readProcessImage(u32Offset_p, u32Length_l, au8Bytes_l);
+    if (result < 0)
+    {
+        return result;
+    }
+    if ((uint32_t)result < u32Length_l)
+    {
+        return -EIO;
+    }
+    if (u8StartBit_p != 0)
+    {
+        au8Bytes_l[u32Length_l] = 0;
+        for (uint32_t i = 0; i < u32Length_l; i++)
+        {
+            au8Bytes_l[i] = (uint8_t)((au8Bytes_l[i] >> u8StartBit_p) | (au8Bytes_l[i + 1] << (8 - u8StartBit_p)));
+        }
+    }
+    unpackBits(au8Bytes_l, u32Count_p, pBits_p);
+    return (int32_t)u32Count_p;
+}
+
+/************************************************************************/
+/** @ brief writes a range of bits to the process image
+ *  
+ *  @param[in] u32Offset_p byte offset of the first bit
+ *  @param[in] u8StartBit_p bit of the first bit within its byte (0-7)
+ *  @param[in] u32Count_p number of bits (max 65536)
+ *  @param[in] pBits_p the bits, one per byte like libmodbus
+ *  @return number of bits written, a negative value on error
+ *  
+ *  the bits are written with a single pwrite. If the range starts or ends
+ *  within a byte, the bytes are read before and the other bits of the
+ *  edge bytes are kept.
+ */
+/************************************************************************/
+int32_t writeProcessImageBits(uint32_t u32Offset_p, uint8_t u8StartBit_p, uint32_t u32Count_p, const uint8_t *pBits_p)
+{
+    uint8_t au8Packed_l[MAX_PROCESS_IMAGE_BIT_BYTES];
+    uint8_t au8Bytes_l[MAX_PROCESS_IMAGE_BIT_BYTES];
+    uint32_t u32Length_l = (u8StartBit_p + u32Count_p + 7) / 8;
+    uint8_t u8FirstKeepMask_l = (uint8_t)((1 << u8StartBit_p) - 1);
+    uint8_t u8LastKeepMask_l = (uint8_t)(0xFF << ((u8StartBit_p + u32Count_p) & 7));
+    int32_t result;
+
+    if ((u8StartBit_p > 7) || (u32Length_l > MAX_PROCESS_IMAGE_BIT_BYTES))
+    {
+        return -EINVAL;
+    }
+    if (u32Count_p == 0)
+    {
+        return 0;
+    }
+    if (((u8StartBit_p + u32Count_p) & 7) == 0)
+    {
+        u8LastKeepMask_l = 0;
+    }
+    packBits(pBits_p, u32Count_p, au8Packed_l);
+    if (u8StartBit_p == 0)
+    {
+        memcpy(au8Bytes_l, au8Packed_l, u32Length_l);
+    }
+    else
+    {
+        uint32_t u32PackedLength_l = (u32Count_p + 7) / 8;
+        au8Bytes_l[0] = (uint8_t)(au8Packed_l[0] << u8StartBit_p);
+        for (uint32_t i = 1; i < u32Length_l; i++)
+        {
+            uint8_t u8Low_l = (i < u32PackedLength_l) ? (uint8_t)(au8Packed_l[i] << u8StartBit_p) : 0;
+            au8Bytes_l[i] = (uint8_t)(u8Low_l | (au8Packed_l[i - 1] >> (8 - u8StartBit_p)));
+        }
+    }
+
+    if ((u8FirstKeepMask_l == 0) && (u8LastKeepMask_l == 0))
+    {
+        result = writeProcessImage(u32Offset_p, u32Length_l, au8Bytes_l);
+    }
+    else
+    {
+        uint8_t au8Old_l[MAX_PROCESS_IMAGE_BIT_BYTES];
+
+        pthread_mutex_lock(&tBitLock);
+        result = readProcessImage(u32Offset_p, u32Length_l, au8Old_l);
+        if ((result >= 0) && ((uint32_t)result < u32Length_l))
+        {
+            result = -EIO;
+        }
+        if (result >= 0)
+        {
+            au8Bytes_l[0] = (uint8_t)((au8Bytes_l[0] & ~u8FirstKeepMask_l) | (au8Old_l[0] & u8FirstKeepMask_l));
+            au8Bytes_l[u32Length_l - 1] = (uint8_t)((au8Bytes_l[u32Length_l - 1] & ~u8LastKeepMask_l) | (au8Old_l[u32Length_l - 1] & u8LastKeepMask_l));
+            result = writeProcessImage(u32Offset_p, u32Length_l, au8Bytes_l);
+        }
+        pthread_mutex_unlock(&tBitLock);
+    }
+    if (result < 0)
+    {
+        return result;
+    }
+    return ((uint32_t)result < u32Length_l) ? -EIO : (int32_t)u32Count_p;
+}
@@ -0,0 +1,27 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster, piModbusSlave
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef PROCESS_IMAGE_H_
+#define PROCESS_IMAGE_H_
+
+#include <stdint.h>
+#include <piTest/piControlIf.h>
+
+int32_t readProcessImage(uint32_t u32Offset_p, uint32_t u32Length_p, uint8_t *pData_p);
+int32_t writeProcessImage(uint32_t u32Offset_p, uint32_t u32Length_p, const uint8_t *pData_p);
+int32_t getProcessImageBit(SPIValue *ptValue_p);
+int32_t setProcessImageBit(SPIValue *ptValue_p);
+int32_t readProcessImageBits(uint32_t u32Offset_p, uint8_t u8StartBit_p, uint32_t u32Count_p, uint8_t *pBits_p);
+int32_t writeProcessImageBits(uint32_t u32Offset_p, uint8_t u8StartBit_p, uint32_t u32Count_p, const uint8_t *pBits_p);
+
+#endif /* PROCESS_IMAGE_H_ */
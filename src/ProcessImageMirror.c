@@ -0,0 +1,224 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusSlave
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#define _POSIX_C_SOURCE 200112L //clock_nanosleep and struct timespec
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "ProcessImageMirror.h"
+#include "ProcessImage.h"
+
+#define NANOSECONDS_PER_SECOND 1000000000L
+
+
+/************************************************************************/
+/** @ brief reads the input areas from the process image into a buffer
+ *
+ *  @return value >= 0 if successful, otherwise a negative value
+ */
+/************************************************************************/
+static int32_t readMirrorInputs(TProcessImageMirror *ptMirror_p, uint32_t u32Buffer_p)
+{
+    const TProcessImageConfiguration *ptOffsets_l = &(ptMirror_p->ptConfig->tProcessImageConfig);
+    int32_t successful = 0;
+
+    if (ptMirror_p->u16DiscreteInputs > 0)
+    {
+        successful = readProcessImageBits(ptOffsets_l->u32DiscreteInputsOffset, 0,
+            ptMirror_p->u16DiscreteInputs, ptMirror_p->apu8InputBits[u32Buffer_p]);
+        if (successful < 0)
+        {
+            return successful;
+        }
+    }
+    if (ptMirror_p->u16InputRegisters > 0)
+    {
+        successful = readProcessImage(ptOffsets_l->u32InputRegistersOffset,
+            (uint32_t)ptMirror_p->u16InputRegisters << 1, (uint8_t*)ptMirror_p->apu16InputRegisters[u32Buffer_p]);
+    }
+    return successful;
+}
+
+/************************************************************************/
+/** @ brief reads the inputs into the unpublished buffer and publishes it
+ *
+ *  @return value >= 0 if successful, otherwise a negative value, the
+ *          published buffer is kept then
+ */
+/************************************************************************/
+static int32_t refreshMirror(TProcessImageMirror *ptMirror_p)
+{
+    uint32_t u32Next_l = __atomic_load_n(&(ptMirror_p->u32Published), __ATOMIC_RELAXED) + 1;
+
+    //readers of the buffer which is overwritten now retry their copy
+    __atomic_store_n(&(ptMirror_p->u32Writing), u32Next_l, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    int32_t successful = readMirrorInputs(ptMirror_p, u32Next_l & 1);
+    if (successful >= 0)
+    {
+        __atomic_store_n(&(ptMirror_p->u32Published), u32Next_l, __ATOMIC_RELEASE);
+    }
+    return successful;
+}
+
+static void *mirrorThread(void *arg)
+{
+    TProcessImageMirror *ptMirror_l = (TProcessImageMirror *)arg;
+    uint32_t u32IntervalUs_l = ptMirror_l->ptConfig->tTuning.u32MirrorIntervalUs;
+    bool bFailed_l = false;
+    struct timespec tvNext_l;
+
+    clock_gettime(CLOCK_MONOTONIC, &tvNext_l);
+    while (1)
+    {
+        tvNext_l.tv_nsec += (long)(u32IntervalUs_l % 1000000) * 1000;
+        tvNext_l.tv_sec += u32IntervalUs_l / 1000000;
+        if (tvNext_l.tv_nsec >= NANOSECONDS_PER_SECOND)
+        {
+            tvNext_l.tv_nsec -= NANOSECONDS_PER_SECOND;
+            tvNext_l.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tvNext_l, NULL);
+
+        int32_t successful = refreshMirror(ptMirror_l);
+        if ((successful < 0) && !bFailed_l)
+        {
+            syslog(LOG_ERR, "read access to process image failed: %d\n", successful);
+        }
+        bFailed_l = (successful < 0);
+    }
+    return NULL;
+}
+
+/************************************************************************/
+/** @ brief allocates the buffers of the mirror, reads the inputs once and
+ *          starts the thread which refreshes them
+ *
+ *  @param[out] ptMirror_p the mirror
+ *  @param[in] ptConfig_p the slave configuration, tTuning.u32MirrorIntervalUs
+ *             is the refresh interval
+ *  @return '0' if successful, otherwise '-1'. The mirror can be stopped in
+ *          both cases.
+ */
+/************************************************************************/
+int32_t startProcessImageMirror(TProcessImageMirror *ptMirror_p, const TModbusSlaveConfiguration *ptConfig_p)
+{
+    memset(ptMirror_p, 0, sizeof(*ptMirror_p));
+    ptMirror_p->ptConfig = ptConfig_p;
+    ptMirror_p->u16DiscreteInputs = ptConfig_p->tModbusDataConfig.u16DiscreteInputs;
+    ptMirror_p->u16InputRegisters = ptConfig_p->tModbusDataConfig.u16InputRegisters;
+
+    for (int i = 0; i < 2; i++)
+    {
+        //at least one element, an empty area is never accessed
+        ptMirror_p->apu8InputBits[i] = calloc(ptMirror_p->u16DiscreteInputs + 1, sizeof(uint8_t));
+        ptMirror_p->apu16InputRegisters[i] = calloc(ptMirror_p->u16InputRegisters + 1, sizeof(uint16_t));
+        if ((ptMirror_p->apu8InputBits[i] == NULL) || (ptMirror_p->apu16InputRegisters[i] == NULL))
+        {
+            syslog(LOG_ERR, "Failed to allocate the process image mirror\n");
+            return -1;
+        }
+    }
+
+    int32_t successful = refreshMirror(ptMirror_p);
+    if (successful < 0)
+    {
+        syslog(LOG_ERR, "read access to process image failed: %d\n", successful);
+    }
+
+    int err = pthread_create(&(ptMirror_p->tThread), NULL, mirrorThread, ptMirror_p);
+    if (err != 0)
+    {
+        syslog(LOG_ERR, "Cannot create process image mirror thread: %s\n", strerror(err));
+        return -1;
+    }
+    ptMirror_p->bThreadStarted = true;
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief stops the thread of the mirror and frees its buffers
+ *
+ *  @param[in] ptr the mirror, usable as cleanup handler
+ */
+/************************************************************************/
+void stopProcessImageMirror(void *ptr)
+{
+    TProcessImageMirror *ptMirror_l = (TProcessImageMirror *)ptr;
+
+    if (ptMirror_l->bThreadStarted)
+    {
+        pthread_cancel(ptMirror_l->tThread);
+        pthread_join(ptMirror_l->tThread, NULL);
+        ptMirror_l->bThreadStarted = false;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        free(ptMirror_l->apu8InputBits[i]);
+        ptMirror_l->apu8InputBits[i] = NULL;
+        free(ptMirror_l->apu16InputRegisters[i]);
+        ptMirror_l->apu16InputRegisters[i] = NULL;
+    }
+}
+
+/************************************************************************/
+/** @ brief copies the requested inputs from the mirror to the modbus mapping
+ *
+ *  @param[in] ptMirror_p the mirror
+ *  @param[out] mbMapping_p the modbus mapping which is used for the reply
+ *  @param[in] eFunctionCode_p function code of the read request
+ *  @param[in] u16Address_p first input/register requested
+ *  @param[in] u16Count_p number of inputs/registers requested
+ *
+ *  a range outside of the mapping is not copied, libmodbus answers it with
+ *  an exception
+ */
+/************************************************************************/
+void copyMirrorToModbusMapping(TProcessImageMirror *ptMirror_p, modbus_mapping_t *mbMapping_p,
+    EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p)
+{
+    uint32_t u32Published_l;
+    uint32_t u32Writing_l;
+
+    if ((u16Count_p == 0) ||
+        ((eFunctionCode_p == eREAD_DISCRETE_INPUTS) && ((int)u16Address_p + (int)u16Count_p > mbMapping_p->nb_input_bits)) ||
+        ((eFunctionCode_p == eREAD_INPUT_REGISTERS) && ((int)u16Address_p + (int)u16Count_p > mbMapping_p->nb_input_registers)))
+    {
+        return;
+    }
+    do
+    {
+        u32Published_l = __atomic_load_n(&(ptMirror_p->u32Published), __ATOMIC_ACQUIRE);
+        uint32_t u32Buffer_l = u32Published_l & 1;
+
+        switch (eFunctionCode_p)
+        {
+        case eREAD_DISCRETE_INPUTS:
+            memcpy(&(mbMapping_p->tab_input_bits[u16Address_p]),
+                &(ptMirror_p->apu8InputBits[u32Buffer_l][u16Address_p]), u16Count_p);
+            break;
+        case eREAD_INPUT_REGISTERS:
+            memcpy(&(mbMapping_p->tab_input_registers[u16Address_p]),
+                &(ptMirror_p->apu16InputRegisters[u32Buffer_l][u16Address_p]), (size_t)u16Count_p << 1);
+            break;
+        default:
+            return;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        u32Writing_l = __atomic_load_n(&(ptMirror_p->u32Writing), __ATOMIC_RELAXED);
+    } while ((u32Writing_l - u32Published_l) >= 2);
+}
@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusSlave
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef PROCESS_IMAGE_MIRROR_H_
+#define PROCESS_IMAGE_MIRROR_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "modbusconfig.h"
+
+/************************************************************************/
+/** @ brief copy of the input areas of a modbus slave
+ *
+ *	a thread reads the discrete inputs and input registers from the process
+ *	image periodically into the buffer which is not published and then
+ *	publishes it. Requests copy the requested range from the published
+ *	buffer without any lock or system call, the copy is repeated if the
+ *	thread started to overwrite the buffer in the meantime.
+ */
+/************************************************************************/
+typedef struct
+{
+	const TModbusSlaveConfiguration *ptConfig;
+	uint16_t u16DiscreteInputs;
+	uint16_t u16InputRegisters;
+	uint8_t *apu8InputBits[2];			//one byte per bit like libmodbus
+	uint16_t *apu16InputRegisters[2];
+	uint32_t u32Published;				//buffer u32Published & 1 holds the latest inputs
+	uint32_t u32Writing;				//buffer u32Writing & 1 is written, u32Published + 1 while refreshing
+	pthread_t tThread;
+	bool bThreadStarted;
+} TProcessImageMirror;
+
+int32_t startProcessImageMirror(TProcessImageMirror *ptMirror_p, const TModbusSlaveConfiguration *ptConfig_p);
+void stopProcessImageMirror(void *ptr);
+void copyMirrorToModbusMapping(TProcessImageMirror *ptMirror_p, modbus_mapping_t *mbMapping_p,
+	EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p);
+
+#endif /* PROCESS_IMAGE_MIRROR_H_ */
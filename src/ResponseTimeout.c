@@ -0,0 +1,157 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#include "project.h"
+
+#include "ResponseTimeout.h"
+#include <string.h>
+
+//clock granularity which is added to the round trip time variation
+#define RTT_CLOCK_GRANULARITY_US 1000
+
+
+static uint32_t clampTimeout(const TResponseTimeoutTable *ptTable_p, uint64_t u64TimeoutUs_p)
+{
+    if (u64TimeoutUs_p < ptTable_p->u32FloorUs)
+    {
+        return ptTable_p->u32FloorUs;
+    }
+    if (u64TimeoutUs_p > ptTable_p->u32CeilingUs)
+    {
+        return ptTable_p->u32CeilingUs;
+    }
+    return (uint32_t)u64TimeoutUs_p;
+}
+
+/************************************************************************/
+/** @ brief adds a measured round trip time to an estimate
+ *  
+ *  SRTT and RTTVAR are updated with the gains 1/8 and 1/4, the timeout
+ *  is SRTT + 4 * RTTVAR (RFC 6298)
+ */
+/************************************************************************/
+static void addRttSample(const TResponseTimeoutTable *ptTable_p, TRttEstimate *ptRtt_p, uint32_t u32RttUs_p)
+{
+    if (!ptRtt_p->bValid)
+    {
+        ptRtt_p->u32SrttUs = u32RttUs_p;
+        ptRtt_p->u32RttVarUs = u32RttUs_p / 2;
+        ptRtt_p->bValid = true;
+    }
+    else
+    {
+        uint32_t u32Deviation_l = (ptRtt_p->u32SrttUs > u32RttUs_p)
+            ? (ptRtt_p->u32SrttUs - u32RttUs_p)
+            : (u32RttUs_p - ptRtt_p->u32SrttUs);
+        ptRtt_p->u32RttVarUs = (uint32_t)(((uint64_t)ptRtt_p->u32RttVarUs * 3 + u32Deviation_l) / 4);
+        ptRtt_p->u32SrttUs = (uint32_t)(((uint64_t)ptRtt_p->u32SrttUs * 7 + u32RttUs_p) / 8);
+    }
+    uint64_t u64Variation_l = (uint64_t)ptRtt_p->u32RttVarUs * 4;
+    if (u64Variation_l < RTT_CLOCK_GRANULARITY_US)
+    {
+        u64Variation_l = RTT_CLOCK_GRANULARITY_US;
+    }
+    ptRtt_p->u32TimeoutUs = clampTimeout(ptTable_p, ptRtt_p->u32SrttUs + u64Variation_l);
+}
+
+
+/************************************************************************/
+/** @ brief initializes the response timeouts of all slaves
+ *  
+ *  @param[out] ptTable_p timeout table of one modbus master
+ *  @param[in] u32FloorUs_p minimal response timeout
+ *  @param[in] u32CeilingUs_p maximal response timeout
+ *  
+ *  slaves without measured round trip time use the ceiling
+ */
+/************************************************************************/
+void initResponseTimeoutTable(TResponseTimeoutTable *ptTable_p, uint32_t u32FloorUs_p, uint32_t u32CeilingUs_p)
+{
+    memset(ptTable_p, 0, sizeof(*ptTable_p));
+    if (u32CeilingUs_p < u32FloorUs_p)
+    {
+        u32CeilingUs_p = u32FloorUs_p;
+    }
+    ptTable_p->u32FloorUs = u32FloorUs_p;
+    ptTable_p->u32CeilingUs = u32CeilingUs_p;
+    for (int32_t i = 0; i < MODBUS_SLAVE_ADDRESS_COUNT; i++)
+    {
+        ptTable_p->atSlave[i].u32TimeoutUs = u32CeilingUs_p;
+    }
+}
+
+/************************************************************************/
+/** @ brief initializes the round trip time estimate of a modbus action
+ *  
+ *  @param[in] u32InitialTimeoutUs_p timeout until the first measurement
+ */
+/************************************************************************/
+void initRttEstimate(const TResponseTimeoutTable *ptTable_p, TRttEstimate *ptRtt_p, uint32_t u32InitialTimeoutUs_p)
+{
+    memset(ptRtt_p, 0, sizeof(*ptRtt_p));
+    ptRtt_p->u32TimeoutUs = clampTimeout(ptTable_p, u32InitialTimeoutUs_p);
+}
+
+/************************************************************************/
+/** @ brief get the response timeout for the next transaction
+ *  
+ *  @param[in] ptActionRtt_p estimate of the action, may be NULL
+ *  @param[in] i8uSlaveAddress_p the addressed slave
+ *  @return response timeout in microseconds
+ *  
+ *  the estimate of the action is used once it has a measurement, before
+ *  that the estimate of the slave. The slave estimate covers all actions
+ *  of the slave and is available as soon as one of them succeeded.
+ */
+/************************************************************************/
+uint32_t getResponseTimeout(const TResponseTimeoutTable *ptTable_p, const TRttEstimate *ptActionRtt_p, uint8_t i8uSlaveAddress_p)
+{
+    const TRttEstimate *ptSlaveRtt_l = &(ptTable_p->atSlave[i8uSlaveAddress_p]);
+    if ((ptActionRtt_p != NULL) && (ptActionRtt_p->bValid || !ptSlaveRtt_l->bValid))
+    {
+        return ptActionRtt_p->u32TimeoutUs;
+    }
+    return ptSlaveRtt_l->u32TimeoutUs;
+}
+
+/************************************************************************/
+/** @ brief adds the round trip time of a successful transaction
+ *  
+ *  @param[in] u32RttUs_p measured time between request and response
+ */
+/************************************************************************/
+void updateResponseTimeout(TResponseTimeoutTable *ptTable_p, TRttEstimate *ptActionRtt_p, uint8_t i8uSlaveAddress_p, uint32_t u32RttUs_p)
+{
+    if (ptActionRtt_p != NULL)
+    {
+        addRttSample(ptTable_p, ptActionRtt_p, u32RttUs_p);
+    }
+    addRttSample(ptTable_p, &(ptTable_p->atSlave[i8uSlaveAddress_p]), u32RttUs_p);
+}
+
+/************************************************************************/
+/** @ brief doubles the response timeout after a transaction timed out
+ *  
+ *  the estimates are kept, the next successful transaction
+ *  recalculates the timeout from them
+ */
+/************************************************************************/
+void backoffResponseTimeout(TResponseTimeoutTable *ptTable_p, TRttEstimate *ptActionRtt_p, uint8_t i8uSlaveAddress_p)
+{
+    TRttEstimate *ptSlaveRtt_l = &(ptTable_p->atSlave[i8uSlaveAddress_p]);
+    if (ptActionRtt_p != NULL)
+    {
+        ptActionRtt_p->u32TimeoutUs = clampTimeout(ptTable_p, (uint64_t)ptActionRtt_p->u32TimeoutUs * 2);
+    }
+    ptSlaveRtt_l->u32TimeoutUs = clampTimeout(ptTable_p, (uint64_t)ptSlaveRtt_l->u32TimeoutUs * 2);
+}
@@ -0,0 +1,55 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef MODBUS_RESPONSE_TIMEOUT_H_
+#define MODBUS_RESPONSE_TIMEOUT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MODBUS_SLAVE_ADDRESS_COUNT 256
+
+/************************************************************************/
+/** @ brief round trip time estimate of one modbus action or slave
+ *  
+ *	smoothed round trip time and its variation as used by TCP (RFC 6298),
+ *	the response timeout is derived from both and clamped to the limits
+ *	of the timeout table
+ */
+/************************************************************************/
+typedef struct
+{
+	uint32_t u32SrttUs;		//smoothed round trip time
+	uint32_t u32RttVarUs;	//round trip time variation
+	uint32_t u32TimeoutUs;	//current response timeout
+	bool bValid;			//at least one round trip time was measured
+} TRttEstimate;
+
+/************************************************************************/
+/** @ brief response timeouts of all slaves of one modbus master
+ */
+/************************************************************************/
+typedef struct
+{
+	uint32_t u32FloorUs;
+	uint32_t u32CeilingUs;
+	TRttEstimate atSlave[MODBUS_SLAVE_ADDRESS_COUNT];	//indexed by the slave address
+} TResponseTimeoutTable;
+
+void initResponseTimeoutTable(TResponseTimeoutTable *ptTable_p, uint32_t u32FloorUs_p, uint32_t u32CeilingUs_p);
+void initRttEstimate(const TResponseTimeoutTable *ptTable_p, TRttEstimate *ptRtt_p, uint32_t u32InitialTimeoutUs_p);
+uint32_t getResponseTimeout(const TResponseTimeoutTable *ptTable_p, const TRttEstimate *ptActionRtt_p, uint8_t i8uSlaveAddress_p);
+void updateResponseTimeout(TResponseTimeoutTable *ptTable_p, TRttEstimate *ptActionRtt_p, uint8_t i8uSlaveAddress_p, uint32_t u32RttUs_p);
+void backoffResponseTimeout(TResponseTimeoutTable *ptTable_p, TRttEstimate *ptActionRtt_p, uint8_t i8uSlaveAddress_p);
+
+#endif /* MODBUS_RESPONSE_TIMEOUT_H_ */
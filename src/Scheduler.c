@@ -20,6 +20,7 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <syslog.h>
+#include <sys/param.h>
 
 //#define SCHEDULER_DEBUG
 
@@ -27,12 +28,316 @@
 const int32_t s32_microseconds_per_second   = 1000000;
 const int32_t s32_nanoseconds_per_second    = 1000000000;
 
+//resolution of the phase offsets within the shortest action interval
+#define MAX_PHASE_SLOTS 64
+
+//max number of periods between two attempts of a failing action
+#define MAX_FAILURE_BACKOFF_PERIODS 16
+
+
+
+/************************************************************************/
+/** @ brief compares two scheduler events by the key of a heap
+ *  
+ *  @return true if event a is before event b in the heap
+ *  
+ *  the release heaps are ordered by trigger time, the ready heaps by
+ *  deadline (trigger time plus interval). Events with equal keys are
+ *  processed in insertion order.
+ */
+/************************************************************************/
+static bool isEventBefore(const struct suEventHeap *pHeap_p, const struct schedulerEvent* a, const struct schedulerEvent* b)
+{
+    struct timespec tv_a_l = a->triggerTime;
+    struct timespec tv_b_l = b->triggerTime;
+
+    if (pHeap_p->bByDeadline)
+    {
+        timespec_add(&tv_a_l, &tv_a_l, &(a->intervalTime));
+        timespec_add(&tv_b_l, &tv_b_l, &(b->intervalTime));
+    }
+    if (tv_a_l.tv_sec != tv_b_l.tv_sec)
+    {
+        return tv_a_l.tv_sec < tv_b_l.tv_sec;
+    }
+    if (tv_a_l.tv_nsec != tv_b_l.tv_nsec)
+    {
+        return tv_a_l.tv_nsec < tv_b_l.tv_nsec;
+    }
+    return a->u64Sequence < b->u64Sequence;
+}
+
+static void placeHeapEvent(struct suEventHeap *pHeap_p, struct schedulerEvent* pEvent_p, int32_t i32Index_p)
+{
+    pHeap_p->ppaEvents[i32Index_p] = pEvent_p;
+    pEvent_p->pHeap = pHeap_p;
+    pEvent_p->i32HeapIndex = i32Index_p;
+}
+
+/************************************************************************/
+/** @ brief moves a scheduler event towards the root of the heap
+ *          until its parent is before it
+ */
+/************************************************************************/
+static void siftEventUp(struct suEventHeap *pHeap_p, int32_t i32Index_p)
+{
+    struct schedulerEvent* pEvent_l = pHeap_p->ppaEvents[i32Index_p];
+    while (i32Index_p > 0)
+    {
+        int32_t i32Parent_l = (i32Index_p - 1) / 2;
+        if (!isEventBefore(pHeap_p, pEvent_l, pHeap_p->ppaEvents[i32Parent_l]))
+        {
+            break;
+        }
+        placeHeapEvent(pHeap_p, pHeap_p->ppaEvents[i32Parent_l], i32Index_p);
+        i32Index_p = i32Parent_l;
+    }
+    placeHeapEvent(pHeap_p, pEvent_l, i32Index_p);
+}
+
+/************************************************************************/
+/** @ brief moves a scheduler event towards the leaves of the heap
+ *          until both children are after it
+ */
+/************************************************************************/
+static void siftEventDown(struct suEventHeap *pHeap_p, int32_t i32Index_p)
+{
+    struct schedulerEvent* pEvent_l = pHeap_p->ppaEvents[i32Index_p];
+    int32_t i32Count_l = pHeap_p->i32Count;
+    while (1)
+    {
+        int32_t i32Child_l = 2 * i32Index_p + 1;
+        if (i32Child_l >= i32Count_l)
+        {
+            break;
+        }
+        if ((i32Child_l + 1 < i32Count_l)
+            && isEventBefore(pHeap_p, pHeap_p->ppaEvents[i32Child_l + 1], pHeap_p->ppaEvents[i32Child_l]))
+        {
+            i32Child_l++;
+        }
+        if (!isEventBefore(pHeap_p, pHeap_p->ppaEvents[i32Child_l], pEvent_l))
+        {
+            break;
+        }
+        placeHeapEvent(pHeap_p, pHeap_p->ppaEvents[i32Child_l], i32Index_p);
+        i32Index_p = i32Child_l;
+    }
+    placeHeapEvent(pHeap_p, pEvent_l, i32Index_p);
+}
+
+static void insertHeapEvent(struct suEventHeap *pHeap_p, struct schedulerEvent* pEvent_p)
+{
+    pHeap_p->i32Count++;
+    placeHeapEvent(pHeap_p, pEvent_p, pHeap_p->i32Count - 1);
+    siftEventUp(pHeap_p, pHeap_p->i32Count - 1);
+}
+
+static void removeHeapEvent(struct schedulerEvent* pEvent_p)
+{
+    struct suEventHeap *pHeap_l = pEvent_p->pHeap;
+    int32_t i32Index_l = pEvent_p->i32HeapIndex;
+
+    pHeap_l->i32Count--;
+    if (i32Index_l < pHeap_l->i32Count)
+    {
+        //the last event fills the gap and is moved to its position
+        struct schedulerEvent* pLast_l = pHeap_l->ppaEvents[pHeap_l->i32Count];
+        placeHeapEvent(pHeap_l, pLast_l, i32Index_l);
+        siftEventUp(pHeap_l, i32Index_l);
+        siftEventDown(pHeap_l, pLast_l->i32HeapIndex);
+    }
+    pEvent_p->pHeap = NULL;
+    pEvent_p->i32HeapIndex = -1;
+}
+
+/************************************************************************/
+/** @ brief puts an event with a new trigger time into the release heap of
+ *          its class
+ */
+/************************************************************************/
+static void rescheduleEvent(struct suEventListHead *pEventListHead_p, struct schedulerEvent* pEvent_p)
+{
+    if (pEvent_p->pHeap != NULL)
+    {
+        removeHeapEvent(pEvent_p);
+    }
+    pEvent_p->u64Sequence = pEventListHead_p->u64NextSequence++;
+    insertHeapEvent(&(pEventListHead_p->atHeaps[pEvent_p->ptModbusAction->ePriority]), pEvent_p);
+}
+
+static bool isEventDue(const struct schedulerEvent* pEvent_p, const struct timespec* ptv_current_p)
+{
+    struct timespec tv_tmp_l;
+    return timespec_diff(&tv_tmp_l, ptv_current_p, &(pEvent_p->triggerTime)) >= 0;
+}
+
+static bool isEventLate(const struct schedulerEvent* pEvent_p, const struct timespec* ptv_current_p)
+{
+    struct timespec tv_deadline_l;
+    struct timespec tv_tmp_l;
+    timespec_add(&tv_deadline_l, &(pEvent_p->triggerTime), &(pEvent_p->intervalTime));
+    return timespec_diff(&tv_tmp_l, ptv_current_p, &tv_deadline_l) >= 0;
+}
+
+/************************************************************************/
+/** @ brief moves the events whose trigger time passed to the ready heaps
+ */
+/************************************************************************/
+static void releaseDueEvents(struct suEventListHead *pEventListHead_p, const struct timespec* ptv_current_p)
+{
+    for (int32_t i32Priority_l = 0; i32Priority_l < MODBUS_ACTION_PRIORITY_COUNT; i32Priority_l++)
+    {
+        struct suEventHeap* pHeap_l = &(pEventListHead_p->atHeaps[i32Priority_l]);
+        while ((pHeap_l->i32Count > 0) && isEventDue(pHeap_l->ppaEvents[0], ptv_current_p))
+        {
+            struct schedulerEvent* pEvent_l = pHeap_l->ppaEvents[0];
+            removeHeapEvent(pEvent_l);
+            insertHeapEvent(&(pEventListHead_p->atReady[i32Priority_l]), pEvent_l);
+        }
+    }
+}
+
+/************************************************************************/
+/** @ brief selects the event which is processed next
+ *  
+ *  of the due events, one which missed its deadline is processed first,
+ *  the earliest deadline of all classes except background wins. Otherwise
+ *  the due event of the highest priority class with the earliest deadline
+ *  is the next one. If no event is due, the event with the earliest
+ *  trigger time of all classes is the next one.
+ */
+/************************************************************************/
+static struct schedulerEvent* selectEvent(struct suEventListHead *pEventListHead_p, const struct timespec* ptv_current_p)
+{
+    struct schedulerEvent* pLate_l = NULL;
+    struct schedulerEvent* pReady_l = NULL;
+    struct schedulerEvent* pEarliest_l = NULL;
+    int32_t i32Priority_l;
+
+    releaseDueEvents(pEventListHead_p, ptv_current_p);
+    for (i32Priority_l = 0; i32Priority_l < MODBUS_ACTION_PRIORITY_COUNT; i32Priority_l++)
+    {
+        struct suEventHeap* pReadyHeap_l = &(pEventListHead_p->atReady[i32Priority_l]);
+        struct suEventHeap* pHeap_l = &(pEventListHead_p->atHeaps[i32Priority_l]);
+        if (pReadyHeap_l->i32Count > 0)
+        {
+            struct schedulerEvent* pEvent_l = pReadyHeap_l->ppaEvents[0];
+            if (pReady_l == NULL)
+            {
+                pReady_l = pEvent_l;
+            }
+            //aging: lower classes are not deferred beyond their deadline
+            if ((i32Priority_l != eActionPriorityBackground) && isEventLate(pEvent_l, ptv_current_p)
+                && ((pLate_l == NULL) || isEventBefore(pReadyHeap_l, pEvent_l, pLate_l)))
+            {
+                pLate_l = pEvent_l;
+            }
+        }
+        if ((pHeap_l->i32Count > 0) && ((pEarliest_l == NULL) || isEventBefore(pHeap_l, pHeap_l->ppaEvents[0], pEarliest_l)))
+        {
+            pEarliest_l = pHeap_l->ppaEvents[0];
+        }
+    }
+    if (pLate_l != NULL)
+    {
+        return pLate_l;
+    }
+    return (pReady_l != NULL) ? pReady_l : pEarliest_l;
+}
+
+
+static uint64_t getEventIntervalNs(const struct schedulerEvent* pEvent_p)
+{
+    return (uint64_t)pEvent_p->intervalTime.tv_sec * s32_nanoseconds_per_second + pEvent_p->intervalTime.tv_nsec;
+}
+
+static int compareEventIntervals(const void* a, const void* b)
+{
+    const struct schedulerEvent* pEventA_l = *(const struct schedulerEvent* const*)a;
+    const struct schedulerEvent* pEventB_l = *(const struct schedulerEvent* const*)b;
+    if (pEventA_l->ptModbusAction->i32uInterval_us != pEventB_l->ptModbusAction->i32uInterval_us)
+    {
+        return (pEventA_l->ptModbusAction->i32uInterval_us < pEventB_l->ptModbusAction->i32uInterval_us) ? -1 : 1;
+    }
+    return (pEventA_l->u64Sequence < pEventB_l->u64Sequence) ? -1 : 1;
+}
+
+/************************************************************************/
+/** @ brief spreads the first trigger times of all events over their periods
+ *  
+ *  @param ptv_start_p trigger time of an event with offset 0
+ *  @return returns '0' if successful otherwise '-1'
+ *  
+ *  the shortest interval (base period) is divided into slots. Starting
+ *  with the shortest interval each event is put into the slot with the
+ *  lowest load, an event with n times the base period adds a load of 1/n.
+ *  Events in the same slot with longer intervals are additionally spread
+ *  over the n base periods of their interval. For harmonic intervals the
+ *  bus load is distributed evenly over the base period, so actions with
+ *  equal intervals do not fire at the same instant.
+ */
+/************************************************************************/
+static int32_t assignEventPhases(struct suEventListHead *pEventListHead_p, const struct timespec* ptv_start_p)
+{
+    double adSlotLoad_l[MAX_PHASE_SLOTS] = { 0 };
+    uint32_t au32SlotEvents_l[MAX_PHASE_SLOTS] = { 0 };
+    int32_t i32SlotCount_l = pEventListHead_p->i32EventCount < MAX_PHASE_SLOTS ? pEventListHead_p->i32EventCount : MAX_PHASE_SLOTS;
+    struct schedulerEvent** ppSorted_l = NULL;
+    uint64_t u64Base_l;
+    int32_t i;
+
+    ppSorted_l = calloc(pEventListHead_p->i32EventCount, sizeof(struct schedulerEvent*));
+    if (ppSorted_l == NULL)
+    {
+        return -1;
+    }
+    for (i = 0; i < pEventListHead_p->i32EventCount; i++)
+    {
+        ppSorted_l[i] = &(pEventListHead_p->paEvents[i]);
+    }
+    qsort(ppSorted_l, pEventListHead_p->i32EventCount, sizeof(struct schedulerEvent*), compareEventIntervals);
+    u64Base_l = getEventIntervalNs(ppSorted_l[0]);
+
+    for (i = 0; i < pEventListHead_p->i32EventCount; i++)
+    {
+        struct schedulerEvent* pEvent_l = ppSorted_l[i];
+        uint64_t u64Multiple_l = (u64Base_l > 0) ? getEventIntervalNs(pEvent_l) / u64Base_l : 1;
+        uint64_t u64Offset_l;
+        struct timespec tv_offset_l;
+        int32_t i32Slot_l = 0;
+        int32_t j;
+
+        for (j = 1; j < i32SlotCount_l; j++)
+        {
+            if (adSlotLoad_l[j] < adSlotLoad_l[i32Slot_l])
+            {
+                i32Slot_l = j;
+            }
+        }
+        if (u64Multiple_l == 0)
+        {
+            u64Multiple_l = 1;
+        }
+        adSlotLoad_l[i32Slot_l] += 1.0 / (double)u64Multiple_l;
+        u64Offset_l = u64Base_l * i32Slot_l / i32SlotCount_l
+            + u64Base_l * (au32SlotEvents_l[i32Slot_l] % u64Multiple_l);
+        au32SlotEvents_l[i32Slot_l]++;
+
+        tv_offset_l.tv_sec  = (time_t)(u64Offset_l / s32_nanoseconds_per_second);
+        tv_offset_l.tv_nsec = (long)(u64Offset_l % s32_nanoseconds_per_second);
+        timespec_add(&(pEvent_l->triggerTime), ptv_start_p, &tv_offset_l);
+    }
+
+    free(ppSorted_l);
+    return 0;
+}
 
 
 /************************************************************************/
 /** @ brief initializes the modbus action scheduler
  *  
- *  @param paModbusActions_p pointer to all modbus actions for this instance
+ *  @param tModbusActionListHead_p all modbus actions for this instance
  *  @param pEventListHead_p pointer to the event list head
  *  @return returns '0' if initialisation was successful otherwise '-1'
  *  
@@ -40,59 +345,87 @@ const int32_t s32_nanoseconds_per_second    = 1000000000;
 /************************************************************************/
 int32_t initScheduler(struct TMBActionListHead tModbusActionListHead_p, struct suEventListHead *pEventListHead_p)
 {
-    struct schedulerEvent* pNewSchedulerEvent;
     struct TMBActionEntry* nextModbusAction = NULL;
+    int32_t i32ActionCount_l = 0;
     if (SLIST_EMPTY(&tModbusActionListHead_p))
     {
         syslog(LOG_ERR, "No modbus actions for device");
         return -1;
     }
-    TAILQ_INIT(pEventListHead_p);
-    //get absolute system time to determine trigger time for all events
-    struct timespec tv_currentTime;
-    clock_gettime(CLOCK_MONOTONIC, &tv_currentTime);
-    
+    int32_t ai32ClassCount_l[MODBUS_ACTION_PRIORITY_COUNT] = { 0 };
+    int32_t i32Priority_l;
     SLIST_FOREACH(nextModbusAction, &tModbusActionListHead_p, entries)
     {
-        pNewSchedulerEvent = malloc(sizeof(struct schedulerEvent));
-        if (pNewSchedulerEvent == NULL)
+        if ((uint32_t)nextModbusAction->modbusAction.ePriority >= MODBUS_ACTION_PRIORITY_COUNT)
         {
-            //if malloc of one element fails, delete the whole list and free memory
-            syslog(LOG_ERR, "Could not initialize modbus command scheduler. Memory allocation failed");
-            cleanupScheduler(pEventListHead_p);
-            return -1;
+            nextModbusAction->modbusAction.ePriority = eActionPriorityNormal;
         }
-        else
-        {
-            pNewSchedulerEvent->ptModbusAction = &(nextModbusAction->modbusAction);	
-            pNewSchedulerEvent->intervalTime.tv_sec  = ((pNewSchedulerEvent->ptModbusAction->i32uInterval_us) / s32_microseconds_per_second);
-            pNewSchedulerEvent->intervalTime.tv_nsec = ((pNewSchedulerEvent->ptModbusAction->i32uInterval_us) % s32_microseconds_per_second) * 1000;
-            //trigger time is absolute time plus interval Time plus an additional second for initialisation
-            timespec_add(&(pNewSchedulerEvent->triggerTime), &tv_currentTime, &(pNewSchedulerEvent->intervalTime));
-            //md timespec_add(&(pNewSchedulerEvent->triggerTime), &tv_currentTime, &(pNewSchedulerEvent->intervalTime));
-            //additional second as buffer for initialisation
-            pNewSchedulerEvent->triggerTime.tv_sec = pNewSchedulerEvent->triggerTime.tv_sec + 1;
-            
-            //insert new entry by due date
-            if (TAILQ_EMPTY(pEventListHead_p))
-            {
-                //first element
-                TAILQ_INSERT_HEAD(pEventListHead_p, pNewSchedulerEvent, events);
-            }
-            else
-            {
-                insertEventByDueDate(pNewSchedulerEvent, pEventListHead_p);
-            }
-            
-        }	
+        ai32ClassCount_l[nextModbusAction->modbusAction.ePriority]++;
+        i32ActionCount_l++;
+    }
+
+    pEventListHead_p->i32EventCount = 0;
+    pEventListHead_p->u64NextSequence = 0;
+    pEventListHead_p->u64DroppedPeriods = 0;
+    pEventListHead_p->paEvents = calloc(i32ActionCount_l, sizeof(struct schedulerEvent));
+    pEventListHead_p->ppaHeap = calloc(2 * i32ActionCount_l, sizeof(struct schedulerEvent*));
+    if ((pEventListHead_p->paEvents == NULL) || (pEventListHead_p->ppaHeap == NULL))
+    {
+        syslog(LOG_ERR, "Could not initialize modbus command scheduler. Memory allocation failed");
+        cleanupScheduler(pEventListHead_p);
+        return -1;
+    }
+    //the release and ready heaps of the priority classes are consecutive parts of ppaHeap
+    struct schedulerEvent** ppHeapStorage_l = pEventListHead_p->ppaHeap;
+    for (i32Priority_l = 0; i32Priority_l < MODBUS_ACTION_PRIORITY_COUNT; i32Priority_l++)
+    {
+        pEventListHead_p->atHeaps[i32Priority_l].ppaEvents = ppHeapStorage_l;
+        pEventListHead_p->atHeaps[i32Priority_l].i32Count = 0;
+        pEventListHead_p->atHeaps[i32Priority_l].bByDeadline = false;
+        ppHeapStorage_l += ai32ClassCount_l[i32Priority_l];
+        pEventListHead_p->atReady[i32Priority_l].ppaEvents = ppHeapStorage_l;
+        pEventListHead_p->atReady[i32Priority_l].i32Count = 0;
+        pEventListHead_p->atReady[i32Priority_l].bByDeadline = true;
+        ppHeapStorage_l += ai32ClassCount_l[i32Priority_l];
+    }
+
+    SLIST_FOREACH(nextModbusAction, &tModbusActionListHead_p, entries)
+    {
+        struct schedulerEvent* pNewSchedulerEvent = &(pEventListHead_p->paEvents[pEventListHead_p->i32EventCount]);
+
+        pNewSchedulerEvent->ptModbusAction = &(nextModbusAction->modbusAction);	
+        pNewSchedulerEvent->intervalTime.tv_sec  = ((pNewSchedulerEvent->ptModbusAction->i32uInterval_us) / s32_microseconds_per_second);
+        pNewSchedulerEvent->intervalTime.tv_nsec = ((pNewSchedulerEvent->ptModbusAction->i32uInterval_us) % s32_microseconds_per_second) * 1000;
+        pNewSchedulerEvent->u64Sequence = pEventListHead_p->u64NextSequence++;
+        pEventListHead_p->i32EventCount++;
+    }
+
+    //get absolute system time to determine trigger time for all events
+    //first trigger time is absolute time plus an additional second for initialisation plus the phase offset
+    struct timespec tv_startTime;
+    clock_gettime(CLOCK_MONOTONIC, &tv_startTime);
+    tv_startTime.tv_sec = tv_startTime.tv_sec + 1;
+    if (assignEventPhases(pEventListHead_p, &tv_startTime) != 0)
+    {
+        syslog(LOG_ERR, "Could not initialize modbus command scheduler. Memory allocation failed");
+        cleanupScheduler(pEventListHead_p);
+        return -1;
+    }
+
+    for (int32_t i = 0; i < pEventListHead_p->i32EventCount; i++)
+    {
+        struct schedulerEvent* pNewSchedulerEvent = &(pEventListHead_p->paEvents[i]);
+        //insert new entry by trigger time into the release heap of its priority class
+        insertHeapEvent(&(pEventListHead_p->atHeaps[pNewSchedulerEvent->ptModbusAction->ePriority]), pNewSchedulerEvent);
     }
     
 #ifdef SCHEDULER_DEBUG
     struct schedulerEvent* pEvent = NULL;
-    TAILQ_FOREACH(pEvent, pEventListHead_p, events)
+    SCHEDULER_FOREACH(pEvent, pEventListHead_p)
     {
-        syslog(LOG_INFO, "Modbus action list entry: %d, %d, %d, %d.%06ds, %d, %d, %d\n",
+        syslog(LOG_INFO, "Modbus action list entry: %d, %d, %d, %d, %d.%06ds, %d, %d, %d\n",
             pEvent->ptModbusAction->i8uSlaveAddress,
+            pEvent->ptModbusAction->ePriority,
             pEvent->ptModbusAction->eFunctionCode,
             pEvent->ptModbusAction->i32uStartRegister,
             (int)(pEvent->triggerTime.tv_sec),
@@ -109,12 +442,18 @@ int32_t initScheduler(struct TMBActionListHead tModbusActionListHead_p, struct s
 
 void cleanupScheduler(struct suEventListHead *pEventListHead_p)
 {
-    while (!TAILQ_EMPTY(pEventListHead_p))
+    int32_t i32Priority_l;
+    free(pEventListHead_p->ppaHeap);
+    free(pEventListHead_p->paEvents);
+    pEventListHead_p->ppaHeap = NULL;
+    pEventListHead_p->paEvents = NULL;
+    pEventListHead_p->i32EventCount = 0;
+    for (i32Priority_l = 0; i32Priority_l < MODBUS_ACTION_PRIORITY_COUNT; i32Priority_l++)
     {
-        struct schedulerEvent* pNewSchedulerEvent; 
-        pNewSchedulerEvent = (struct schedulerEvent*)TAILQ_FIRST(pEventListHead_p);				
-        TAILQ_REMOVE(pEventListHead_p, pNewSchedulerEvent, events);
-        free(pNewSchedulerEvent);
+        pEventListHead_p->atHeaps[i32Priority_l].ppaEvents = NULL;
+        pEventListHead_p->atHeaps[i32Priority_l].i32Count = 0;
+        pEventListHead_p->atReady[i32Priority_l].ppaEvents = NULL;
+        pEventListHead_p->atReady[i32Priority_l].i32Count = 0;
     }
 }
 
@@ -129,7 +468,7 @@ void cleanupScheduler(struct suEventListHead *pEventListHead_p)
 /************************************************************************/
 int32_t getNextEvent(tModbusEvent* next_modbus_event_p, struct suEventListHead *pEventListHead_p)
 {
-    if (TAILQ_EMPTY(pEventListHead_p))
+    if (pEventListHead_p->i32EventCount == 0)
     {
         syslog(LOG_ERR, "No entries in modbus action list");
         return -1;
@@ -139,184 +478,170 @@ int32_t getNextEvent(tModbusEvent* next_modbus_event_p, struct suEventListHead *
     return 0;
 }
 
+
 /************************************************************************/
-/** @ brief get event (modbus action) which has to be processed next
+/** @ brief sets the handling of missed action periods
  *  
- *  @param[in] time_elapsed_p processing time of the previous modbus action to adjust the timing of all following modbus commands
- *	@param[out] max_timeout_p maximal calculated timeout for all actions in the modbus action event list
- *  @return pointer to the next modbus event which has to be processed
+ *  @param eCatchUpPolicy_p skip, coalesce or bounded catch up
+ *  @param u32MaxCatchUpPeriods_p missed periods which are processed back to
+ *         back by the bounded catch up policy
  *  
  */
 /************************************************************************/
-/*int32_t getNextEventAndTimeout(tModbusEvent* next_modbus_event_p, const struct timespec *time_elapsed_p, struct timespec *max_timeout_p, struct suEventListHead *pEventListHead_p)
+void setSchedulerCatchUpPolicy(struct suEventListHead *pEventListHead_p, ECatchUpPolicy eCatchUpPolicy_p, uint32_t u32MaxCatchUpPeriods_p)
 {
-//#error  Modbus action timeouts are not handled appropriate
-    if (TAILQ_EMPTY(pEventListHead_p))
-    {
-        syslog(LOG_ERR, "No entries in modbus action list");
-        return -1;
-    }
-    else
-    {
-        determineNextEvent_relativeTime(next_modbus_event_p, time_elapsed_p, max_timeout_p, pEventListHead_p);
-    }
-    return 0;
-}*/
+    pEventListHead_p->eCatchUpPolicy = eCatchUpPolicy_p;
+    pEventListHead_p->u32MaxCatchUpPeriods = u32MaxCatchUpPeriods_p;
+}
+
 
 
 /************************************************************************/
-/** @ brief determines the next modbus event 
- *     Should only be invoked by function getNextEvent()
- *  
- *  @param[in]	time_elapsed_p processing time of the previous modbus action to adjust the timing of all following modbus commands
- *	@param[out] max_timeout_p maximum timeout value of all modbus actions in event list
- *  @return maximal timeout of all modbus actions
- *  
+/** @ brief advances the trigger time of an event by whole periods
+ *          so that the event stays aligned to its original phase
  */
 /************************************************************************/
-void determineNextEvent(tModbusEvent* next_modbus_event_p, struct suEventListHead *pEventListHead_p)
+static void advanceEventPeriods(struct schedulerEvent* pEvent_p, uint64_t u64Periods_p)
 {
-    struct schedulerEvent* pNextSchedulerEvent_l = NULL;
+    uint64_t u64Advance_l = u64Periods_p * getEventIntervalNs(pEvent_p);
+    struct timespec tv_advance_l;
+    tv_advance_l.tv_sec  = (time_t)(u64Advance_l / s32_nanoseconds_per_second);
+    tv_advance_l.tv_nsec = (long)(u64Advance_l % s32_nanoseconds_per_second);
+    timespec_add(&(pEvent_p->triggerTime), &(pEvent_p->triggerTime), &tv_advance_l);
+}
 
-    //store scheduler event with earliest due date and next modbus event
-    pNextSchedulerEvent_l = TAILQ_FIRST(pEventListHead_p);
-    next_modbus_event_p->triggerTime = pNextSchedulerEvent_l->triggerTime;
-    next_modbus_event_p->ptModbusAction = pNextSchedulerEvent_l->ptModbusAction;
-    //remove entry with earliest due date from list
-    TAILQ_REMOVE(pEventListHead_p, pNextSchedulerEvent_l, events);	
-    //add interval time to removed scheduler event
-    timespec_add(&(pNextSchedulerEvent_l->triggerTime), &(pNextSchedulerEvent_l->triggerTime), &(pNextSchedulerEvent_l->intervalTime));
-    //insert entry according to the new due date
-    insertEventByDueDate(pNextSchedulerEvent_l, pEventListHead_p);	
+/************************************************************************/
+/** @ brief number of periods after the trigger time of an event which
+ *          are already due at the given time
+ */
+/************************************************************************/
+static uint64_t getMissedPeriods(const struct schedulerEvent* pEvent_p, const struct timespec* ptv_current_p)
+{
+    struct timespec tv_next_l;
+    struct timespec tv_late_l;
+    uint64_t u64Interval_l = getEventIntervalNs(pEvent_p);
+
+    timespec_add(&tv_next_l, &(pEvent_p->triggerTime), &(pEvent_p->intervalTime));
+    if ((u64Interval_l == 0) || (timespec_diff(&tv_late_l, ptv_current_p, &tv_next_l) < 0))
+    {
+        return 0;
+    }
+    return ((uint64_t)tv_late_l.tv_sec * s32_nanoseconds_per_second + tv_late_l.tv_nsec) / u64Interval_l + 1;
 }
 
+static void dropEventPeriods(struct suEventListHead *pEventListHead_p, struct schedulerEvent* pEvent_p, uint64_t u64Periods_p)
+{
+    pEvent_p->u32DroppedPeriods += (uint32_t)u64Periods_p;
+    pEventListHead_p->u64DroppedPeriods += u64Periods_p;
+}
+
+
 /************************************************************************/
 /** @ brief determines the next modbus event 
-  *     Should only be invoked by function getNextEvent()
+ *     Should only be invoked by function getNextEvent()
  *  
- *  @param[in]	time_elapsed_p processing time of the previous modbus action to adjust the timing of all following modbus commands
-  *	@param[out] max_timeout_p maximum timeout value of all modbus actions in event list
- *  @return maximal timeout of all modbus actions
+ *  @param[out] next_modbus_event_p the event which has to be processed next
  *  
+ *  If several events are due, the event of the highest priority class is
+ *  processed first, within a class the event with the earliest deadline
+ *  (trigger time plus interval). Lower priority classes are deferred while
+ *  higher ones are due, so an overloaded bus delays background reads
+ *  instead of outputs, but only up to their deadline: a due event which
+ *  missed its deadline is processed before the other classes, except in
+ *  the background class.
+ *  The trigger time of the event is advanced by whole intervals and it is
+ *  put back into the release heap of its class.
+ *  The next trigger time is always the previous one plus a multiple of the
+ *  interval, so the action never drifts from its phase. If periods were
+ *  missed (e.g. after a connection loss) the catch up policy decides how
+ *  many of them are processed, all others are dropped and counted.
+ *  Background events which missed their deadline (trigger time plus one
+ *  interval) are always shed like with the skip policy.
  */
 /************************************************************************/
-/*int32_t determineNextEvent_relativeTime(tModbusEvent* next_modbus_event_p, const struct timespec *time_elapsed_p, struct timespec *max_timeout_p, struct suEventListHead *pEventListHead_p)
+void determineNextEvent(tModbusEvent* next_modbus_event_p, struct suEventListHead *pEventListHead_p)
 {
-    int32_t mb_action_timeout = 0;
-    struct schedulerEvent* pEvent = NULL;
-    struct schedulerEvent* pNextEvent = NULL;
-
-    struct timespec time_mb_tmp_action_timeout;
-    time_mb_tmp_action_timeout.tv_sec = 0;
-    time_mb_tmp_action_timeout.tv_nsec = 0;
-    
-    
-    //store command with earliest due date
-    pNextEvent = TAILQ_FIRST(pEventListHead_p);
-    next_modbus_event_p->triggerTime = pNextEvent->triggerTime;
-    next_modbus_event_p->ptModbusAction = pNextEvent->ptModbusAction;
-    
-    //remove entry with earliest due date from list
-    TAILQ_REMOVE(pEventListHead_p, pNextEvent, events);	
-    //add interval time to removed modbus action
-    //pNextEvent->triggerTime.tv_sec = pNextEvent->triggerTime.tv_sec + pNextEvent->intervalTime.tv_sec;
-    //pNextEvent->triggerTime.tv_nsec = pNextEvent->triggerTime.tv_nsec + pNextEvent->intervalTime.tv_nsec;
-    timespec_add(&(pNextEvent->triggerTime), &(pNextEvent->triggerTime), &(pNextEvent->intervalTime));
-    //insert entry according to the new due date
-    insertEventByDueDate(pNextEvent, pEventListHead_p);
-
+    struct schedulerEvent* pNextSchedulerEvent_l = NULL;
+    struct timespec tv_current_l;
+    uint64_t u64Missed_l;
+    uint64_t u64Allowed_l;
+    bool bShed_l;
 
-    //calculate new due dates for all actions
-    TAILQ_FOREACH(pEvent, pEventListHead_p, events)
+    clock_gettime(CLOCK_MONOTONIC, &tv_current_l);
+    while (1)
     {
-        if ((pEvent->triggerTime.tv_sec == 0) 
-            && (pEvent->triggerTime.tv_nsec == 0))
-        {
-            //next command has to be executed immediately
-            //=> no time adjustment
-        }
-        else
+        pNextSchedulerEvent_l = selectEvent(pEventListHead_p, &tv_current_l);
+        u64Missed_l = getMissedPeriods(pNextSchedulerEvent_l, &tv_current_l);
+        bShed_l = (pEventListHead_p->eCatchUpPolicy == eCatchUpSkip)
+            || (pNextSchedulerEvent_l->ptModbusAction->ePriority == eActionPriorityBackground);
+        if (!bShed_l || (u64Missed_l == 0))
         {
-            timespec_diff(&(pEvent->triggerTime), &(pEvent->triggerTime), &(next_modbus_event_p->triggerTime));
-            
-            //further timing adjustment: subtract modbus processing time	
-            if (timespec_diff(&(time_mb_tmp_action_timeout), &(pEvent->triggerTime), time_elapsed_p) < 0)
-            {
-                syslog(LOG_ERR, "modbus action backlog\n");
-                mb_action_timeout = mb_action_timeout + 1;
-                //timeout => set delay for action to zero and set new max timeout as return value if new delay is greater then max delay
-                pEvent->triggerTime.tv_sec = 0;
-                pEvent->triggerTime.tv_nsec = 0;
-                struct timespec timespec_tmp;
-                if (timespec_diff(&timespec_tmp, max_timeout_p, &time_mb_tmp_action_timeout) < 0)
-                {
-                    timespec_tmp.tv_sec = 0;
-                    timespec_tmp.tv_nsec = 0;
-                    timespec_diff(max_timeout_p, &timespec_tmp, &time_mb_tmp_action_timeout);
-                    max_timeout_p->tv_sec = time_mb_tmp_action_timeout.tv_sec;
-                    max_timeout_p->tv_nsec = time_mb_tmp_action_timeout.tv_nsec;
-                }
-            }
-            else
-            {
-                pEvent->triggerTime.tv_sec = time_mb_tmp_action_timeout.tv_sec;
-                pEvent->triggerTime.tv_nsec = time_mb_tmp_action_timeout.tv_nsec;
-            }
+            break;
         }
+        //overdue by at least one whole period: drop it together with all missed periods
+        dropEventPeriods(pEventListHead_p, pNextSchedulerEvent_l, u64Missed_l + 1);
+        advanceEventPeriods(pNextSchedulerEvent_l, u64Missed_l + 1);
+        rescheduleEvent(pEventListHead_p, pNextSchedulerEvent_l);
     }
-    
-#ifdef SCHEDULER_DEBUG
-    syslog(LOG_INFO, "Update Modbus next actions list entry\n");
-    TAILQ_FOREACH(pEvent, pEventListHead_p, events)
+
+    //store scheduler event with earliest due date and next modbus event
+    next_modbus_event_p->triggerTime = pNextSchedulerEvent_l->triggerTime;
+    next_modbus_event_p->ptModbusAction = pNextSchedulerEvent_l->ptModbusAction;
+    next_modbus_event_p->pSchedulerEvent = pNextSchedulerEvent_l;
+    next_modbus_event_p->u32DroppedPeriods = 0;
+
+    u64Allowed_l = (pEventListHead_p->eCatchUpPolicy == eCatchUpBounded) ? pEventListHead_p->u32MaxCatchUpPeriods : 0;
+    if (u64Missed_l > u64Allowed_l)
     {
-        syslog(LOG_INFO, "Modbus next actions list entry: %d, %d, %d, %d s, %d msec, %d, %d, \n",
-            pEvent->ptModbusAction->i8uSlaveAddress,
-            pEvent->ptModbusAction->eFunctionCode,
-            pEvent->ptModbusAction->i32uStartRegister,
-            //pEvent->ptModbusAction->i8uCountRegister,
-            (int)(pEvent->triggerTime.tv_sec),
-            (int)(pEvent->triggerTime.tv_nsec/1000),
-            pEvent->ptModbusAction->i32uStartByteProcessData,
-            pEvent->ptModbusAction->i8uStartBitProcessData);
+        next_modbus_event_p->u32DroppedPeriods = (uint32_t)(u64Missed_l - u64Allowed_l);
+        dropEventPeriods(pEventListHead_p, pNextSchedulerEvent_l, u64Missed_l - u64Allowed_l);
+        advanceEventPeriods(pNextSchedulerEvent_l, u64Missed_l - u64Allowed_l);
     }
-#endif
-    
-    return mb_action_timeout;
-}*/
+    //add interval time to scheduler event
+    timespec_add(&(pNextSchedulerEvent_l->triggerTime), &(pNextSchedulerEvent_l->triggerTime), &(pNextSchedulerEvent_l->intervalTime));
+    //move entry according to the new trigger time
+    rescheduleEvent(pEventListHead_p, pNextSchedulerEvent_l);
+}
+
 
 
 /************************************************************************/
-/** @ brief insert a scheduler event to the list according to its due date
+/** @ brief reports the result of a processed event to the scheduler
+ *  
+ *  @param[in] pEvent_p the scheduler event of the processed action
+ *  @param[in] bSuccess_p false if the action failed (timeout, exception
+ *             or process image error)
  *  
- *  @param *newEvent_p scheduler event which has to be inserted
+ *  an action which fails repeatedly backs off exponentially: after the
+ *  n-th consecutive failure it is attempted again only every 2^(n-1)
+ *  periods, at most every MAX_FAILURE_BACKOFF_PERIODS periods. The
+ *  skipped periods are not counted as dropped. The first success
+ *  restores the normal interval. The backoff only concerns the failing
+ *  action, the other actions keep their timing.
  */
 /************************************************************************/
-void insertEventByDueDate(struct schedulerEvent* newEvent_p, struct suEventListHead *pEventListHead_p)
+void reportEventResult(struct suEventListHead *pEventListHead_p, struct schedulerEvent* pEvent_p, bool bSuccess_p)
 {
-    struct schedulerEvent* pEvent_l = NULL;
-    bool bEventNotInserted_l = true;
-    TAILQ_FOREACH(pEvent_l, pEventListHead_p, events)
+    uint32_t u32Backoff_l;
+
+    if (bSuccess_p)
     {
-        if (newEvent_p->triggerTime.tv_sec < pEvent_l->triggerTime.tv_sec)
-        {
-            TAILQ_INSERT_BEFORE(pEvent_l, newEvent_p, events);
-            bEventNotInserted_l = false;
-            break;							
-        }
-        else if ((newEvent_p->triggerTime.tv_sec == pEvent_l->triggerTime.tv_sec)					
-            && (newEvent_p->triggerTime.tv_nsec < pEvent_l->triggerTime.tv_nsec))
-        {
-            TAILQ_INSERT_BEFORE(pEvent_l, newEvent_p, events);
-            bEventNotInserted_l = false;
-            break;
-        }				
+        pEvent_p->u32ConsecutiveFailures = 0;
+        return;
     }
-    //pNextEvent will be the last element of the list
-    if (bEventNotInserted_l == true)
+    if (pEvent_p->u32ConsecutiveFailures < UINT32_MAX)
     {
-        TAILQ_INSERT_TAIL(pEventListHead_p, newEvent_p, events);
+        pEvent_p->u32ConsecutiveFailures++;
     }
-    
+    u32Backoff_l = (pEvent_p->u32ConsecutiveFailures > 5) ? MAX_FAILURE_BACKOFF_PERIODS
+        : MIN(1u << (pEvent_p->u32ConsecutiveFailures - 1), MAX_FAILURE_BACKOFF_PERIODS);
+    if (u32Backoff_l < 2)
+    {
+        return;
+    }
+    //the next trigger time is already one period ahead
+    advanceEventPeriods(pEvent_p, u32Backoff_l - 1);
+    rescheduleEvent(pEventListHead_p, pEvent_p);
 }
 
 
@@ -336,7 +661,7 @@ void get_minimal_modbus_action_interval(struct timespec* min_interval_p, struct
     min_interval_p->tv_sec = INT32_MAX;
     min_interval_p->tv_nsec = s32_nanoseconds_per_second - 1;
     struct timespec tv_tmp_l;
-    TAILQ_FOREACH(pEvent_l, pEventListHead_p, events)
+    SCHEDULER_FOREACH(pEvent_l, pEventListHead_p)
     {
         if (timespec_diff(&tv_tmp_l, &(pEvent_l->intervalTime), min_interval_p) < 0)
         {
@@ -366,7 +691,7 @@ void get_minimal_modbus_event_offset(struct timespec* min_event_offset_p, struct
     
     double inverse_mean_time_between_events = 0;
     double mean_time_between_events = 0;
-    TAILQ_FOREACH(pEvent_l, pEventListHead_p, events)
+    SCHEDULER_FOREACH(pEvent_l, pEventListHead_p)
     {
         uint64_t interval = pEvent_l->intervalTime.tv_nsec + pEvent_l->intervalTime.tv_sec*s32_nanoseconds_per_second;
         inverse_mean_time_between_events = inverse_mean_time_between_events + 1/((double)interval);
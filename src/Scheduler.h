@@ -20,8 +20,9 @@
 
 
 #include <time.h>
-#include <sys/queue.h>
+#include <stdbool.h>
 #include "modbusconfig.h"
+#include "ResponseTimeout.h"
 
 extern const int32_t s32_microseconds_per_second;
 extern const int32_t s32_nanoseconds_per_second;
@@ -31,8 +32,9 @@ extern const int32_t s32_nanoseconds_per_second;
  *  
  *	contains a pointer to the modbus action of type TModbusAction*,
  *		the interval time of the modbus action,
- *		the remaining time until the action has to be processed again
- *		and the TAILQ_ENTRY which contains the pointers for the double linked list
+ *		the absolute time when the action has to be processed again,
+ *		the current position of the event in the scheduler heap
+ *		and the round trip time estimate of the action
  */
 /************************************************************************/
 struct schedulerEvent
@@ -40,7 +42,12 @@ struct schedulerEvent
 	struct timespec intervalTime;
 	struct timespec triggerTime;
 	TModbusAction* ptModbusAction;
-	TAILQ_ENTRY(schedulerEvent) events;
+	uint64_t u64Sequence;		//insertion order, keeps events with equal keys in FIFO order
+	struct suEventHeap* pHeap;	//release or ready heap which contains the event
+	int32_t i32HeapIndex;		//position in this heap
+	uint32_t u32DroppedPeriods;	//number of action periods dropped by the catch up policy
+	TRttEstimate tRtt;			//round trip time estimate for the response timeout
+	uint32_t u32ConsecutiveFailures;	//failed attempts since the last success, for the failure backoff
 };
 
 
@@ -55,23 +62,59 @@ typedef struct
 {
 	struct timespec triggerTime;
 	TModbusAction* ptModbusAction;
+	struct schedulerEvent* pSchedulerEvent;	//scheduler state of the action
+	uint32_t u32DroppedPeriods;	//periods of this action dropped since the previous event
 } tModbusEvent;
 
 /************************************************************************/
-/** @ brief struct for the scheduler event list head
+/** @ brief binary min-heap of scheduler events ordered by trigger time
+ *         or by deadline (trigger time plus interval)
+ */
+/************************************************************************/
+struct suEventHeap
+{
+	struct schedulerEvent** ppaEvents;
+	int32_t i32Count;
+	bool bByDeadline;
+};
+
+/************************************************************************/
+/** @ brief struct for the scheduler event queue
  *  
+ *	all scheduler events are allocated in one block (paEvents). Each
+ *	priority class has two binary min-heaps of pointers into this block:
+ *	the events which are not due yet ordered by trigger time (atHeaps) and
+ *	the due events ordered by deadline (atReady). All heaps share the
+ *	array ppaHeap. Taking the next event and re-inserting it with its new
+ *	trigger time costs O(log N).
  */
 /************************************************************************/
-TAILQ_HEAD(suEventListHead, schedulerEvent);
+struct suEventListHead
+{
+	struct schedulerEvent* paEvents;
+	struct schedulerEvent** ppaHeap;
+	struct suEventHeap atHeaps[MODBUS_ACTION_PRIORITY_COUNT];
+	struct suEventHeap atReady[MODBUS_ACTION_PRIORITY_COUNT];
+	int32_t i32EventCount;
+	uint64_t u64NextSequence;
+	ECatchUpPolicy eCatchUpPolicy;
+	uint32_t u32MaxCatchUpPeriods;
+	uint64_t u64DroppedPeriods;	//number of action periods dropped by the catch up policy
+};
+
+#define SCHEDULER_EVENT_LIST_INITIALIZER { NULL, NULL, { { NULL, 0, false } }, { { NULL, 0, true } }, 0, 0, DEFAULT_CATCH_UP_POLICY, DEFAULT_MAX_CATCH_UP_PERIODS, 0 }
+
+//iterate over all scheduler events in unspecified order
+#define SCHEDULER_FOREACH(var, head) \
+	for ((var) = (head)->paEvents; (var) < (head)->paEvents + (head)->i32EventCount; (var)++)
 
 
 int32_t initScheduler(struct TMBActionListHead tModbusActionListHead_p, struct suEventListHead *pEventListHead_p);
 void cleanupScheduler(struct suEventListHead *pEventListHead_p);
 int32_t getNextEvent(tModbusEvent* next_modbus_event_p, struct suEventListHead *pEventListHead_p);
-// int32_t getNextEventAndTimeout(tModbusEvent* next_modbus_event_p, const struct timespec *time_elapsed_p, struct timespec *max_timeout_p, struct suEventListHead *pEventListHead_p);
 void determineNextEvent(tModbusEvent* nextEvent, struct suEventListHead *pEventListHead_p);
-// int32_t determineNextEvent_relativeTime(tModbusEvent* next_modbus_event_p, const struct timespec *timeElapsed_p, struct timespec *max_timeout_p, struct suEventListHead *pEventListHead_p);
-void insertEventByDueDate(struct schedulerEvent* newEvent, struct suEventListHead *pEventListHead_p);
+void reportEventResult(struct suEventListHead *pEventListHead_p, struct schedulerEvent* pEvent_p, bool bSuccess_p);
+void setSchedulerCatchUpPolicy(struct suEventListHead *pEventListHead_p, ECatchUpPolicy eCatchUpPolicy_p, uint32_t u32MaxCatchUpPeriods_p);
 void get_minimal_modbus_action_interval(struct timespec* min_interval_p, struct suEventListHead *pEventListHead_p);
 void get_minimal_modbus_event_offset(struct timespec* min_event_offset_p, struct suEventListHead *pEventListHead_p);
 
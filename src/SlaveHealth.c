@@ -0,0 +1,132 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#include "project.h"
+
+#include "SlaveHealth.h"
+#include "Scheduler.h"
+#include <string.h>
+#include <syslog.h>
+
+
+static void scheduleNextProbe(TSlaveHealth *ptSlave_p, const struct timespec *ptv_current_p)
+{
+    struct timespec tv_interval;
+    tv_interval.tv_sec = ptSlave_p->u32ProbeIntervalUs / s32_microseconds_per_second;
+    tv_interval.tv_nsec = (ptSlave_p->u32ProbeIntervalUs % s32_microseconds_per_second) * 1000;
+    timespec_add(&(ptSlave_p->tvNextProbe), ptv_current_p, &tv_interval);
+}
+
+/************************************************************************/
+/** @ brief initializes the circuit breakers of a master, all are closed
+ *  
+ *  @param[in] u32FailureThreshold_p consecutive failures which open a
+ *             breaker, 0 disables the breakers
+ *  @param[in] u32MinProbeIntervalUs_p first probe interval of an open breaker
+ *  @param[in] u32MaxProbeIntervalUs_p limit of the probe interval, also
+ *             limits the first probe interval
+ *  
+ */
+/************************************************************************/
+void initSlaveHealthTable(TSlaveHealthTable *ptTable_p, uint32_t u32FailureThreshold_p, uint32_t u32MinProbeIntervalUs_p, uint32_t u32MaxProbeIntervalUs_p)
+{
+    memset(ptTable_p, 0, sizeof(*ptTable_p));
+    ptTable_p->u32FailureThreshold = u32FailureThreshold_p;
+    ptTable_p->u32MinProbeIntervalUs = (u32MinProbeIntervalUs_p > u32MaxProbeIntervalUs_p) ? u32MaxProbeIntervalUs_p : u32MinProbeIntervalUs_p;
+    ptTable_p->u32MaxProbeIntervalUs = u32MaxProbeIntervalUs_p;
+}
+
+/************************************************************************/
+/** @ brief checks if a request may be sent to a slave
+ *  
+ *  @return true if the breaker of the slave is closed or if a probe is due,
+ *          false if the action has to be skipped
+ *  
+ *  while the breaker is open the next probe is scheduled as soon as a probe
+ *  is allowed, so the other actions of the slave are skipped until then
+ */
+/************************************************************************/
+bool isSlaveRequestAllowed(TSlaveHealthTable *ptTable_p, uint8_t i8uSlaveAddress_p, const struct timespec *ptv_current_p)
+{
+    TSlaveHealth *ptSlave_l = &(ptTable_p->atSlave[i8uSlaveAddress_p]);
+    struct timespec tv_diff;
+
+    if (!ptSlave_l->bOpen)
+    {
+        return true;
+    }
+    if (timespec_diff(&tv_diff, ptv_current_p, &(ptSlave_l->tvNextProbe)) < 0)
+    {
+        return false;
+    }
+    scheduleNextProbe(ptSlave_l, ptv_current_p);
+    return true;
+}
+
+/************************************************************************/
+/** @ brief updates the breaker of a slave with the result of a transaction
+ *  
+ *  @param[in] bResponded_p true if the slave answered, also with an
+ *             exception response
+ *  @return true if the breaker of the slave opened or closed
+ *  
+ */
+/************************************************************************/
+bool reportSlaveResult(TSlaveHealthTable *ptTable_p, uint8_t i8uSlaveAddress_p, bool bResponded_p, const struct timespec *ptv_current_p)
+{
+    TSlaveHealth *ptSlave_l = &(ptTable_p->atSlave[i8uSlaveAddress_p]);
+
+    if (ptTable_p->u32FailureThreshold == 0)
+    {
+        return false;
+    }
+    if (bResponded_p)
+    {
+        ptSlave_l->u32ConsecutiveFailures = 0;
+        if (ptSlave_l->bOpen)
+        {
+            ptSlave_l->bOpen = false;
+            ptTable_p->u32OpenCount--;
+            syslog(LOG_INFO, "Modbus slave %d responds again, full rate restored\n", (int)i8uSlaveAddress_p);
+            return true;
+        }
+        return false;
+    }
+
+    if (ptSlave_l->u32ConsecutiveFailures < UINT32_MAX)
+    {
+        ptSlave_l->u32ConsecutiveFailures++;
+    }
+    if (ptSlave_l->bOpen)
+    {
+        //failed probe
+        ptSlave_l->u32ProbeIntervalUs = (ptSlave_l->u32ProbeIntervalUs > ptTable_p->u32MaxProbeIntervalUs / 2)
+            ? ptTable_p->u32MaxProbeIntervalUs
+            : ptSlave_l->u32ProbeIntervalUs * 2;
+        scheduleNextProbe(ptSlave_l, ptv_current_p);
+        return false;
+    }
+    if (ptSlave_l->u32ConsecutiveFailures >= ptTable_p->u32FailureThreshold)
+    {
+        ptSlave_l->bOpen = true;
+        ptTable_p->u32OpenCount++;
+        ptSlave_l->u32ProbeIntervalUs = ptTable_p->u32MinProbeIntervalUs;
+        scheduleNextProbe(ptSlave_l, ptv_current_p);
+        syslog(LOG_ERR, "Modbus slave %d: %u requests without response, probing every %u ms\n",
+            (int)i8uSlaveAddress_p,
+            (unsigned)ptSlave_l->u32ConsecutiveFailures,
+            (unsigned)(ptSlave_l->u32ProbeIntervalUs / 1000));
+        return true;
+    }
+    return false;
+}
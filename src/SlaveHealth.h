@@ -0,0 +1,56 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef MODBUS_SLAVE_HEALTH_H_
+#define MODBUS_SLAVE_HEALTH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "ResponseTimeout.h"
+
+/************************************************************************/
+/** @ brief circuit breaker of one modbus slave
+ *  
+ *	the breaker opens after u32FailureThreshold consecutive transactions
+ *	without a response. While it is open only one request per probe
+ *	interval is sent to the slave, the interval doubles with every failed
+ *	probe. The first response closes the breaker.
+ */
+/************************************************************************/
+typedef struct
+{
+	uint32_t u32ConsecutiveFailures;
+	uint32_t u32ProbeIntervalUs;	//current probe interval while the breaker is open
+	struct timespec tvNextProbe;
+	bool bOpen;
+} TSlaveHealth;
+
+/************************************************************************/
+/** @ brief circuit breakers of all slaves of one modbus master
+ */
+/************************************************************************/
+typedef struct
+{
+	uint32_t u32FailureThreshold;	//0 disables the breakers
+	uint32_t u32MinProbeIntervalUs;
+	uint32_t u32MaxProbeIntervalUs;
+	uint32_t u32OpenCount;			//number of open breakers
+	TSlaveHealth atSlave[MODBUS_SLAVE_ADDRESS_COUNT];	//indexed by the slave address
+} TSlaveHealthTable;
+
+void initSlaveHealthTable(TSlaveHealthTable *ptTable_p, uint32_t u32FailureThreshold_p, uint32_t u32MinProbeIntervalUs_p, uint32_t u32MaxProbeIntervalUs_p);
+bool isSlaveRequestAllowed(TSlaveHealthTable *ptTable_p, uint8_t i8uSlaveAddress_p, const struct timespec *ptv_current_p);
+bool reportSlaveResult(TSlaveHealthTable *ptTable_p, uint8_t i8uSlaveAddress_p, bool bResponded_p, const struct timespec *ptv_current_p);
+
+#endif /* MODBUS_SLAVE_HEALTH_H_ */
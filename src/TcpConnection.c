@@ -0,0 +1,406 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#include "project.h"
+
+#define _GNU_SOURCE //ppoll
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+#include "TcpConnection.h"
+#include "Scheduler.h"
+
+#define TCP_MIN_RECONNECT_DELAY_US      10000
+#define TCP_DEAD_PEER_MIN_FAILURES      2       //a single timeout is no reason to reconnect
+#define TCP_KEEPALIVE_INTERVAL_S        1
+#define TCP_KEEPALIVE_PROBES            3
+
+
+static uint32_t getElapsedUs(const struct timespec *ptv_current_p, const struct timespec *ptv_start_p)
+{
+    struct timespec tv_diff;
+    if (timespec_diff(&tv_diff, ptv_current_p, ptv_start_p) < 0)
+    {
+        return 0;
+    }
+    if (tv_diff.tv_sec >= (time_t)(UINT32_MAX / s32_microseconds_per_second))
+    {
+        return UINT32_MAX;
+    }
+    return (uint32_t)(tv_diff.tv_sec * s32_microseconds_per_second + tv_diff.tv_nsec / 1000);
+}
+
+/************************************************************************/
+/** @ brief initializes the connection state of a tcp master
+ *  
+ *  @param[in] ptTuning_p tuning parameters of the master
+ *  
+ */
+/************************************************************************/
+void initTcpConnection(TTcpConnection *ptConnection_p, const TModbusMasterTuning *ptTuning_p)
+{
+    struct timespec tv_current;
+
+    memset(ptConnection_p, 0, sizeof(*ptConnection_p));
+    ptConnection_p->u32ConnectTimeoutUs = ptTuning_p->u32ConnectTimeoutUs;
+    ptConnection_p->u32DeadPeerTimeoutUs = ptTuning_p->u32DeadPeerTimeoutUs;
+    ptConnection_p->u32MaxReconnectDelayUs = (ptTuning_p->u32MaxReconnectDelayUs < TCP_MIN_RECONNECT_DELAY_US)
+        ? TCP_MIN_RECONNECT_DELAY_US : ptTuning_p->u32MaxReconnectDelayUs;
+    ptConnection_p->u32ReconnectDelayUs = TCP_MIN_RECONNECT_DELAY_US;
+
+    //the connections of several masters must not retry in lockstep
+    clock_gettime(CLOCK_MONOTONIC, &tv_current);
+    ptConnection_p->uSeed = (unsigned int)tv_current.tv_nsec ^ (unsigned int)(uintptr_t)pthread_self();
+}
+
+/************************************************************************/
+/** @ brief waits for a non-blocking connect until the deadline
+ *  
+ *  @return '0' if the socket is writable, otherwise '-1' with errno set
+ */
+/************************************************************************/
+static int waitForConnect(int iSocket_p, const struct timespec *ptv_deadline_p)
+{
+    struct pollfd tPollFd_l;
+    struct timespec tv_current;
+    struct timespec tv_timeout;
+    int ret;
+
+    tPollFd_l.fd = iSocket_p;
+    tPollFd_l.events = POLLOUT;
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC, &tv_current);
+        if (timespec_diff(&tv_timeout, ptv_deadline_p, &tv_current) < 0)
+        {
+            tv_timeout.tv_sec = 0;
+            tv_timeout.tv_nsec = 0;
+        }
+        ret = ppoll(&tPollFd_l, 1, &tv_timeout, NULL);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret < 0)
+    {
+        return -1;
+    }
+    if (ret == 0)
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief sets the socket options of a connected socket
+ *  
+ *  @param[in] bBlocking_p true to switch the socket to blocking mode for
+ *             libmodbus, false to leave it non-blocking
+ *  
+ *  Keepalive probes detect a dead peer on an idle connection,
+ *  TCP_USER_TIMEOUT aborts the connection if sent data is not acknowledged
+ *  in time.
+ */
+/************************************************************************/
+static void setTcpOptions(const TTcpConnection *ptConnection_p, int iSocket_p, bool bBlocking_p)
+{
+    int option;
+
+    if (bBlocking_p)
+    {
+        int flags = fcntl(iSocket_p, F_GETFL);
+        if ((flags < 0) || (fcntl(iSocket_p, F_SETFL, flags & ~O_NONBLOCK) < 0))
+        {
+            syslog(LOG_ERR, "Modbus TCP: set blocking mode failed: %s\n", strerror(errno));
+        }
+    }
+
+    option = 1;
+    setsockopt(iSocket_p, IPPROTO_TCP, TCP_NODELAY, &option, sizeof(option));
+    setsockopt(iSocket_p, SOL_SOCKET, SO_KEEPALIVE, &option, sizeof(option));
+
+    option = (int)(ptConnection_p->u32DeadPeerTimeoutUs / s32_microseconds_per_second);
+    option = (option < 1) ? 1 : option;
+    setsockopt(iSocket_p, IPPROTO_TCP, TCP_KEEPIDLE, &option, sizeof(option));
+    option = TCP_KEEPALIVE_INTERVAL_S;
+    setsockopt(iSocket_p, IPPROTO_TCP, TCP_KEEPINTVL, &option, sizeof(option));
+    option = TCP_KEEPALIVE_PROBES;
+    setsockopt(iSocket_p, IPPROTO_TCP, TCP_KEEPCNT, &option, sizeof(option));
+#ifdef TCP_USER_TIMEOUT
+    unsigned int timeout_ms = ptConnection_p->u32DeadPeerTimeoutUs / 1000;
+    setsockopt(iSocket_p, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout_ms, sizeof(timeout_ms));
+#endif
+}
+
+/************************************************************************/
+/** @ brief resolves the address of the modbus tcp slave
+ *  
+ *  @return list of addresses, to be freed with freeaddrinfo(), NULL with
+ *          errno set if the address is invalid
+ */
+/************************************************************************/
+static struct addrinfo* resolveTcpSlave(const TTcpConfig *ptTcpConfig_p)
+{
+    struct addrinfo tHints_l;
+    struct addrinfo *ptAddrList_l = NULL;
+    char sz8Port[12];
+    int ret;
+
+    memset(&tHints_l, 0, sizeof(tHints_l));
+    tHints_l.ai_family = AF_UNSPEC;
+    tHints_l.ai_socktype = SOCK_STREAM;
+    tHints_l.ai_flags = AI_NUMERICSERV;
+    snprintf(sz8Port, sizeof(sz8Port), "%d", ptTcpConfig_p->i32uPort);
+
+    ret = getaddrinfo(ptTcpConfig_p->szTcpIpAddress, sz8Port, &tHints_l, &ptAddrList_l);
+    if (ret != 0)
+    {
+        syslog(LOG_ERR, "Modbus TCP: unable to resolve %s: %s\n", ptTcpConfig_p->szTcpIpAddress, gai_strerror(ret));
+        errno = EHOSTUNREACH;
+        return NULL;
+    }
+    return ptAddrList_l;
+}
+
+/************************************************************************/
+/** @ brief starts a non-blocking connect to one address
+ *  
+ *  @return the socket if the connect finished or is in progress,
+ *          otherwise '-1' with errno set
+ */
+/************************************************************************/
+static int startConnect(const struct addrinfo *ptAddr_p)
+{
+    int iSocket_l = socket(ptAddr_p->ai_family, ptAddr_p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ptAddr_p->ai_protocol);
+    if (iSocket_l < 0)
+    {
+        return -1;
+    }
+    if ((connect(iSocket_l, ptAddr_p->ai_addr, ptAddr_p->ai_addrlen) < 0) && (errno != EINPROGRESS))
+    {
+        int err = errno;
+        close(iSocket_l);
+        errno = err;
+        return -1;
+    }
+    return iSocket_l;
+}
+
+/************************************************************************/
+/** @ brief starts a non-blocking connect to the modbus tcp slave
+ *  
+ *  @param[in] ptTcpConfig_p address and port of the slave
+ *  @return the non-blocking socket, '-1' with errno set if the connect
+ *          failed at once
+ *  
+ *  only the first address of the slave is used. The socket is writable
+ *  when the connect finished, then finishTcpConnection() has to be called.
+ */
+/************************************************************************/
+int beginTcpConnection(TTcpConnection *ptConnection_p, const TTcpConfig *ptTcpConfig_p)
+{
+    struct addrinfo *ptAddrList_l = resolveTcpSlave(ptTcpConfig_p);
+    int iSocket_l;
+    int err;
+
+    (void)ptConnection_p;
+    if (ptAddrList_l == NULL)
+    {
+        return -1;
+    }
+    iSocket_l = startConnect(ptAddrList_l);
+    err = errno;
+    freeaddrinfo(ptAddrList_l);
+    errno = err;
+    return iSocket_l;
+}
+
+/************************************************************************/
+/** @ brief completes a connect started by beginTcpConnection()
+ *  
+ *  @param[in] iSocket_p the socket, writable after the connect finished
+ *  @param[in] bBlocking_p true to switch the socket to blocking mode
+ *  @return '0' if connected, otherwise '-1' with errno set
+ *  
+ */
+/************************************************************************/
+int finishTcpConnection(TTcpConnection *ptConnection_p, int iSocket_p, bool bBlocking_p)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (getsockopt(iSocket_p, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+    {
+        return -1;
+    }
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    setTcpOptions(ptConnection_p, iSocket_p, bBlocking_p);
+
+    //a new connection starts without failures
+    clock_gettime(CLOCK_MONOTONIC, &(ptConnection_p->tvLastResponse));
+    ptConnection_p->u32ConsecutiveFailures = 0;
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief connects to the modbus tcp slave
+ *  
+ *  @param[in] ptTcpConfig_p address and port of the slave
+ *  @return the connected blocking socket, '-1' with errno set if the
+ *          connect failed or did not finish within the connect timeout
+ *  
+ */
+/************************************************************************/
+int openTcpConnection(TTcpConnection *ptConnection_p, const TTcpConfig *ptTcpConfig_p)
+{
+    struct addrinfo *ptAddrList_l;
+    struct addrinfo *ptAddr_l;
+    struct timespec tv_deadline;
+    struct timespec tv_timeout;
+    int iSocket_l = -1;
+    int err = ETIMEDOUT;
+
+    ptAddrList_l = resolveTcpSlave(ptTcpConfig_p);
+    if (ptAddrList_l == NULL)
+    {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &tv_deadline);
+    tv_timeout.tv_sec = ptConnection_p->u32ConnectTimeoutUs / s32_microseconds_per_second;
+    tv_timeout.tv_nsec = (ptConnection_p->u32ConnectTimeoutUs % s32_microseconds_per_second) * 1000;
+    timespec_add(&tv_deadline, &tv_deadline, &tv_timeout);
+
+    for (ptAddr_l = ptAddrList_l; ptAddr_l != NULL; ptAddr_l = ptAddr_l->ai_next)
+    {
+        iSocket_l = startConnect(ptAddr_l);
+        if ((iSocket_l >= 0)
+            && (waitForConnect(iSocket_l, &tv_deadline) == 0)
+            && (finishTcpConnection(ptConnection_p, iSocket_l, true) == 0))
+        {
+            break;
+        }
+        err = errno;
+        if (iSocket_l >= 0)
+        {
+            close(iSocket_l);
+            iSocket_l = -1;
+        }
+    }
+    freeaddrinfo(ptAddrList_l);
+
+    if (iSocket_l < 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return iSocket_l;
+}
+
+/************************************************************************/
+/** @ brief returns the delay before the next connect
+ *  
+ *  @return delay in usec, chosen randomly between half and the full
+ *          current delay. The current delay is doubled up to the
+ *          configured maximum.
+ */
+/************************************************************************/
+uint32_t getTcpReconnectDelay(TTcpConnection *ptConnection_p)
+{
+    uint32_t u32DelayUs_l = ptConnection_p->u32ReconnectDelayUs / 2;
+
+    u32DelayUs_l += (uint32_t)rand_r(&(ptConnection_p->uSeed)) % (ptConnection_p->u32ReconnectDelayUs / 2 + 1);
+    ptConnection_p->u32ReconnectDelayUs = (ptConnection_p->u32ReconnectDelayUs > ptConnection_p->u32MaxReconnectDelayUs / 2)
+        ? ptConnection_p->u32MaxReconnectDelayUs
+        : ptConnection_p->u32ReconnectDelayUs * 2;
+    return u32DelayUs_l;
+}
+
+/************************************************************************/
+/** @ brief sleeps before the next connect, see getTcpReconnectDelay()
+ */
+/************************************************************************/
+void waitTcpReconnect(TTcpConnection *ptConnection_p)
+{
+    struct timespec tv_sleep;
+    uint32_t u32DelayUs_l = getTcpReconnectDelay(ptConnection_p);
+
+    tv_sleep.tv_sec = u32DelayUs_l / s32_microseconds_per_second;
+    tv_sleep.tv_nsec = (u32DelayUs_l % s32_microseconds_per_second) * 1000;
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &tv_sleep, NULL);
+}
+
+/************************************************************************/
+/** @ brief updates the connection state with the result of a request
+ *  
+ *  @param[in] bResponded_p true if the peer answered, also with an
+ *             exception response
+ *  
+ *  a response resets the reconnect delay, so the next connection loss is
+ *  recovered at once
+ */
+/************************************************************************/
+void reportTcpResponse(TTcpConnection *ptConnection_p, bool bResponded_p, const struct timespec *ptv_current_p)
+{
+    if (bResponded_p)
+    {
+        ptConnection_p->tvLastResponse = *ptv_current_p;
+        ptConnection_p->u32ConsecutiveFailures = 0;
+        ptConnection_p->u32ReconnectDelayUs = TCP_MIN_RECONNECT_DELAY_US;
+    }
+    else if (ptConnection_p->u32ConsecutiveFailures < UINT32_MAX)
+    {
+        ptConnection_p->u32ConsecutiveFailures++;
+    }
+}
+
+/************************************************************************/
+/** @ brief checks if the connection has to be reestablished
+ *  
+ *  @param[in] iSocket_p the connected socket
+ *  @return true if the kernel closed the connection (reset, user timeout,
+ *          keepalive) or if requests failed and the peer did not respond
+ *          for the dead peer timeout
+ */
+/************************************************************************/
+bool isTcpPeerDead(const TTcpConnection *ptConnection_p, int iSocket_p, const struct timespec *ptv_current_p)
+{
+    struct tcp_info tInfo_l;
+    socklen_t len = sizeof(tInfo_l);
+
+    if (ptConnection_p->u32ConsecutiveFailures == 0)
+    {
+        return false;
+    }
+    if ((getsockopt(iSocket_p, IPPROTO_TCP, TCP_INFO, &tInfo_l, &len) < 0)
+        || (tInfo_l.tcpi_state != TCP_ESTABLISHED))
+    {
+        return true;
+    }
+    return (ptConnection_p->u32ConsecutiveFailures >= TCP_DEAD_PEER_MIN_FAILURES)
+        && (getElapsedUs(ptv_current_p, &(ptConnection_p->tvLastResponse)) >= ptConnection_p->u32DeadPeerTimeoutUs);
+}
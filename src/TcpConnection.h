@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef MODBUS_TCP_CONNECTION_H_
+#define MODBUS_TCP_CONNECTION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "modbusconfig.h"
+
+/************************************************************************/
+/** @ brief connection state of a modbus tcp master
+ *  
+ *	the connect is bounded by u32ConnectTimeoutUs. Failed connects are
+ *	retried after a jittered, exponentially growing delay. The peer is
+ *	considered dead if the kernel closed the connection or if it did not
+ *	respond for u32DeadPeerTimeoutUs while requests failed.
+ */
+/************************************************************************/
+typedef struct
+{
+	uint32_t u32ConnectTimeoutUs;
+	uint32_t u32DeadPeerTimeoutUs;
+	uint32_t u32MaxReconnectDelayUs;
+	uint32_t u32ReconnectDelayUs;		//current reconnect delay, doubles with every failed connect
+	uint32_t u32ConsecutiveFailures;	//failed requests since the last response
+	struct timespec tvLastResponse;		//last response of the peer or connect time
+	unsigned int uSeed;					//for the jitter of the reconnect delay
+} TTcpConnection;
+
+void initTcpConnection(TTcpConnection *ptConnection_p, const TModbusMasterTuning *ptTuning_p);
+int openTcpConnection(TTcpConnection *ptConnection_p, const TTcpConfig *ptTcpConfig_p);
+int beginTcpConnection(TTcpConnection *ptConnection_p, const TTcpConfig *ptTcpConfig_p);
+int finishTcpConnection(TTcpConnection *ptConnection_p, int iSocket_p, bool bBlocking_p);
+uint32_t getTcpReconnectDelay(TTcpConnection *ptConnection_p);
+void waitTcpReconnect(TTcpConnection *ptConnection_p);
+void reportTcpResponse(TTcpConnection *ptConnection_p, bool bResponded_p, const struct timespec *ptv_current_p);
+bool isTcpPeerDead(const TTcpConnection *ptConnection_p, int iSocket_p, const struct timespec *ptv_current_p);
+
+#endif /* MODBUS_TCP_CONNECTION_H_ */
@@ -0,0 +1,414 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#include "project.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "TcpReactor.h"
+#include "ComAndDataProcessor.h"
+#include "ModbusMasterThread.h"
+
+#define TCP_REACTOR_MAX_EVENTS 64
+
+
+static bool isTimeBefore(const struct timespec *a, const struct timespec *b)
+{
+    struct timespec tv_diff;
+    return timespec_diff(&tv_diff, a, b) < 0;
+}
+
+static void addMicroseconds(struct timespec *sum, const struct timespec *summand, uint32_t u32Us_p)
+{
+    struct timespec tv_offset;
+    tv_offset.tv_sec = u32Us_p / s32_microseconds_per_second;
+    tv_offset.tv_nsec = (u32Us_p % s32_microseconds_per_second) * 1000;
+    timespec_add(sum, summand, &tv_offset);
+}
+
+/************************************************************************/
+/** @ brief initializes a reactor without devices
+ *  
+ *  @param[in] u32MaxDeviceCount_p max number of devices of the reactor
+ *  @return '0' if successful, otherwise '-1'
+ *  
+ */
+/************************************************************************/
+int32_t initTcpReactor(TTcpReactor *ptReactor_p, uint32_t u32MaxDeviceCount_p)
+{
+    struct epoll_event tEvent_l;
+
+    memset(ptReactor_p, 0, sizeof(*ptReactor_p));
+    ptReactor_p->iEpoll = -1;
+    ptReactor_p->iTimer = -1;
+    ptReactor_p->ptDevices = calloc(u32MaxDeviceCount_p, sizeof(TTcpReactorDevice));
+    if (ptReactor_p->ptDevices == NULL)
+    {
+        syslog(LOG_ERR, "Unable to allocate modbus tcp reactor\n");
+        return -1;
+    }
+    ptReactor_p->u32MaxDeviceCount = u32MaxDeviceCount_p;
+
+    ptReactor_p->iEpoll = epoll_create1(EPOLL_CLOEXEC);
+    ptReactor_p->iTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if ((ptReactor_p->iEpoll < 0) || (ptReactor_p->iTimer < 0))
+    {
+        syslog(LOG_ERR, "Modbus tcp reactor: epoll/timerfd failed: %s\n", strerror(errno));
+        cleanupTcpReactor(ptReactor_p);
+        return -1;
+    }
+
+    //the timer is identified by a NULL pointer, the sockets by their device
+    tEvent_l.events = EPOLLIN;
+    tEvent_l.data.ptr = NULL;
+    if (epoll_ctl(ptReactor_p->iEpoll, EPOLL_CTL_ADD, ptReactor_p->iTimer, &tEvent_l) < 0)
+    {
+        syslog(LOG_ERR, "Modbus tcp reactor: epoll_ctl failed: %s\n", strerror(errno));
+        cleanupTcpReactor(ptReactor_p);
+        return -1;
+    }
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief adds a modbus tcp master to the reactor
+ *  
+ *  @param[in] ptConfig_p configuration of the master, has to be valid as
+ *             long as the reactor runs
+ *  @return '0' if successful, '-1' if the reactor is full
+ *  
+ */
+/************************************************************************/
+int32_t addTcpReactorDevice(TTcpReactor *ptReactor_p, TModbusMasterConfiguration *ptConfig_p)
+{
+    TTcpReactorDevice *ptDevice_l;
+
+    if (ptReactor_p->u32DeviceCount >= ptReactor_p->u32MaxDeviceCount)
+    {
+        return -1;
+    }
+    ptDevice_l = &(ptReactor_p->ptDevices[ptReactor_p->u32DeviceCount++]);
+    ptDevice_l->ptConfig = ptConfig_p;
+    ptDevice_l->eState = eReactorIdle;
+    ptDevice_l->iSocket = -1;
+    initTcpConnection(&(ptDevice_l->tConnection), &(ptConfig_p->tTuning));
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief closes the connection of a device and schedules the reconnect
+ */
+/************************************************************************/
+static void disconnectReactorDevice(TTcpReactorDevice *ptDevice_p, const struct timespec *ptv_current_p)
+{
+    if (ptDevice_p->eState == eReactorConnected)
+    {
+        cleanupTcpPipeline(&(ptDevice_p->tPipeline));
+        cleanupScheduler(&(ptDevice_p->tEventListHead));
+    }
+    if (ptDevice_p->iSocket >= 0)
+    {
+        //closing the socket removes it from the epoll set
+        close(ptDevice_p->iSocket);
+        ptDevice_p->iSocket = -1;
+    }
+    writeMasterErrorMessage(ptDevice_p->ptConfig, (uint8_t)(eNoResponseFromDevice));
+
+    ptDevice_p->eState = eReactorIdle;
+    addMicroseconds(&(ptDevice_p->tvWakeup), ptv_current_p, getTcpReconnectDelay(&(ptDevice_p->tConnection)));
+}
+
+/************************************************************************/
+/** @ brief starts the connect of an idle device
+ */
+/************************************************************************/
+static void connectReactorDevice(TTcpReactor *ptReactor_p, TTcpReactorDevice *ptDevice_p, const struct timespec *ptv_current_p)
+{
+    TTcpConfig *ptTcpConfig_l = &(ptDevice_p->ptConfig->tModbusDeviceConfig.uProt.tTcpConfig);
+    struct epoll_event tEvent_l;
+
+    ptDevice_p->iSocket = beginTcpConnection(&(ptDevice_p->tConnection), ptTcpConfig_l);
+    tEvent_l.events = EPOLLOUT;
+    tEvent_l.data.ptr = ptDevice_p;
+    if ((ptDevice_p->iSocket < 0)
+        || (epoll_ctl(ptReactor_p->iEpoll, EPOLL_CTL_ADD, ptDevice_p->iSocket, &tEvent_l) < 0))
+    {
+        syslog(LOG_ERR, "Modbus connection failed: ip=%s errno=%s\n", ptTcpConfig_l->szTcpIpAddress, modbus_strerror(errno));
+        disconnectReactorDevice(ptDevice_p, ptv_current_p);
+        return;
+    }
+    ptDevice_p->eState = eReactorConnecting;
+    addMicroseconds(&(ptDevice_p->tvWakeup), ptv_current_p, ptDevice_p->tConnection.u32ConnectTimeoutUs);
+}
+
+/************************************************************************/
+/** @ brief starts the processing of the actions on a new connection
+ *  
+ *  @return '0' if successful, otherwise '-1'
+ *  
+ */
+/************************************************************************/
+static int32_t startReactorDevice(TTcpReactor *ptReactor_p, TTcpReactorDevice *ptDevice_p)
+{
+    TModbusMasterConfiguration *psModbusConfiguration_l = ptDevice_p->ptConfig;
+    TTcpConfig *ptTcpConfig_l = &(psModbusConfiguration_l->tModbusDeviceConfig.uProt.tTcpConfig);
+    struct epoll_event tEvent_l;
+
+    if (initScheduler(psModbusConfiguration_l->mbActionListHead, &(ptDevice_p->tEventListHead)) < 0)
+    {
+        syslog(LOG_ERR, "Scheduler initialization failed\n");
+        writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eInternalError));
+        return -1;
+    }
+    setSchedulerCatchUpPolicy(&(ptDevice_p->tEventListHead),
+        psModbusConfiguration_l->tTuning.eCatchUpPolicy,
+        psModbusConfiguration_l->tTuning.u32MaxCatchUpPeriods);
+    initActionTimeouts(&(ptDevice_p->tTimeouts), &(ptDevice_p->tEventListHead), &(psModbusConfiguration_l->tTuning));
+
+    if (initTcpPipeline(&(ptDevice_p->tPipeline), ptDevice_p->iSocket, psModbusConfiguration_l->tTuning.u32PipelineDepth) < 0)
+    {
+        cleanupScheduler(&(ptDevice_p->tEventListHead));
+        return -1;
+    }
+
+    tEvent_l.events = EPOLLIN;
+    tEvent_l.data.ptr = ptDevice_p;
+    if ((startTcpPipeline(&(ptDevice_p->tPipeline), &(ptDevice_p->tEventListHead), &(ptDevice_p->tConnection)) < 0)
+        || (epoll_ctl(ptReactor_p->iEpoll, EPOLL_CTL_MOD, ptDevice_p->iSocket, &tEvent_l) < 0))
+    {
+        cleanupTcpPipeline(&(ptDevice_p->tPipeline));
+        cleanupScheduler(&(ptDevice_p->tEventListHead));
+        return -1;
+    }
+
+    ptDevice_p->eState = eReactorConnected;
+    syslog(LOG_INFO, "Modbus connection established to ip=%s port=%d\n", ptTcpConfig_l->szTcpIpAddress, ptTcpConfig_l->i32uPort);
+    writeMasterErrorMessage(psModbusConfiguration_l, (uint8_t)(eNoError));
+    return 0;
+}
+
+/************************************************************************/
+/** @ brief processes a device which got a socket event or is due
+ *  
+ *  sets the next wakeup time of the device. A connected device whose next
+ *  action waits for a free pipeline slot wakes only for its response
+ *  timeouts, the response itself wakes it through the socket.
+ */
+/************************************************************************/
+static void serviceReactorDevice(TTcpReactor *ptReactor_p, TTcpReactorDevice *ptDevice_p, const struct timespec *ptv_current_p)
+{
+    TModbusDeviceConfiguration *ptDeviceConfig_l = &(ptDevice_p->ptConfig->tModbusDeviceConfig);
+    bool bReady_l = ptDevice_p->bReady;
+
+    ptDevice_p->bReady = false;
+    switch (ptDevice_p->eState)
+    {
+    case eReactorIdle:
+        connectReactorDevice(ptReactor_p, ptDevice_p, ptv_current_p);
+        return;
+
+    case eReactorConnecting:
+        if (!bReady_l)
+        {
+            errno = ETIMEDOUT;
+        }
+        if (!bReady_l
+            || (finishTcpConnection(&(ptDevice_p->tConnection), ptDevice_p->iSocket, false) < 0))
+        {
+            syslog(LOG_ERR, "Modbus connection failed: ip=%s errno=%s\n", ptDeviceConfig_l->uProt.tTcpConfig.szTcpIpAddress, modbus_strerror(errno));
+            disconnectReactorDevice(ptDevice_p, ptv_current_p);
+            return;
+        }
+        if (startReactorDevice(ptReactor_p, ptDevice_p) < 0)
+        {
+            disconnectReactorDevice(ptDevice_p, ptv_current_p);
+            return;
+        }
+        bReady_l = false;
+        break;
+
+    case eReactorConnected:
+        break;
+    }
+
+    if (serviceTcpPipeline(&(ptDevice_p->tPipeline), bReady_l, &(ptDevice_p->tTimeouts), ptDevice_p->ptConfig, &(ptDevice_p->tvWakeup)) < 0)
+    {
+        disconnectReactorDevice(ptDevice_p, ptv_current_p);
+    }
+}
+
+/************************************************************************/
+/** @ brief shortest action interval of all devices of a reactor in usec
+ */
+/************************************************************************/
+static uint32_t getShortestActionInterval(const TTcpReactor *ptReactor_p)
+{
+    uint32_t u32IntervalUs_l = UINT32_MAX;
+
+    for (uint32_t i = 0; i < ptReactor_p->u32DeviceCount; i++)
+    {
+        struct TMBActionEntry *pAction_l;
+        SLIST_FOREACH(pAction_l, &(ptReactor_p->ptDevices[i].ptConfig->mbActionListHead), entries)
+        {
+            if (pAction_l->modbusAction.i32uInterval_us < u32IntervalUs_l)
+            {
+                u32IntervalUs_l = pAction_l->modbusAction.i32uInterval_us;
+            }
+        }
+    }
+    return (u32IntervalUs_l == UINT32_MAX) ? 0 : u32IntervalUs_l;
+}
+
+/************************************************************************/
+/** @ brief closes all connections and frees the reactor
+ *  
+ *  @param[in] ptr the reactor (TTcpReactor*), usable as cleanup handler
+ *             of the reactor thread
+ *  
+ */
+/************************************************************************/
+void cleanupTcpReactor(void *ptr)
+{
+    TTcpReactor *ptReactor_l = (TTcpReactor *)ptr;
+
+    for (uint32_t i = 0; i < ptReactor_l->u32DeviceCount; i++)
+    {
+        TTcpReactorDevice *ptDevice_l = &(ptReactor_l->ptDevices[i]);
+        if (ptDevice_l->eState == eReactorConnected)
+        {
+            cleanupTcpPipeline(&(ptDevice_l->tPipeline));
+            cleanupScheduler(&(ptDevice_l->tEventListHead));
+        }
+        if (ptDevice_l->iSocket >= 0)
+        {
+            close(ptDevice_l->iSocket);
+        }
+    }
+    if (ptReactor_l->iTimer >= 0)
+    {
+        close(ptReactor_l->iTimer);
+    }
+    if (ptReactor_l->iEpoll >= 0)
+    {
+        close(ptReactor_l->iEpoll);
+    }
+    free(ptReactor_l->ptDevices);
+    memset(ptReactor_l, 0, sizeof(*ptReactor_l));
+    ptReactor_l->iEpoll = -1;
+    ptReactor_l->iTimer = -1;
+}
+
+/************************************************************************/
+/** @ brief thread which processes all modbus tcp masters of a reactor
+ *  
+ *  @param[in] arg the reactor (TTcpReactor*), it is cleaned up when the
+ *             thread is canceled
+ *  
+ *  every device which got a socket event or whose wakeup time passed is
+ *  serviced, then the timer is set to the earliest wakeup time. The
+ *  thread can only be canceled while it waits for events.
+ */
+/************************************************************************/
+void *startTcpReactorThread(void *arg)
+{
+    TTcpReactor *ptReactor_l = (TTcpReactor *)arg;
+    struct epoll_event atEvents_l[TCP_REACTOR_MAX_EVENTS];
+    struct timespec tv_current;
+    int iCancelState_l;
+
+    //set realtime priority of the thread
+    if (setprio(20, SCHED_RR) < 0)
+    {
+        syslog(LOG_ERR, "Set realtime priority for modbus tcp reactor thread failed\n");
+    }
+
+    pthread_cleanup_push(cleanupTcpReactor, ptReactor_l);
+
+    //the connects are spread over the shortest action interval like the actions of a device,
+    //so the devices do not send their requests at the same instant
+    clock_gettime(CLOCK_MONOTONIC, &tv_current);
+    uint32_t u32SpreadUs_l = getShortestActionInterval(ptReactor_l);
+    for (uint32_t i = 0; i < ptReactor_l->u32DeviceCount; i++)
+    {
+        addMicroseconds(&(ptReactor_l->ptDevices[i].tvWakeup), &tv_current,
+            (uint32_t)((uint64_t)u32SpreadUs_l * i / ptReactor_l->u32DeviceCount));
+    }
+    syslog(LOG_INFO, "Modbus tcp reactor started with %u devices\n", (unsigned)ptReactor_l->u32DeviceCount);
+
+    while (1)
+    {
+        struct itimerspec tTimer_l;
+        int n;
+
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelState_l);
+
+        clock_gettime(CLOCK_MONOTONIC, &tv_current);
+        memset(&tTimer_l, 0, sizeof(tTimer_l));
+        for (uint32_t i = 0; i < ptReactor_l->u32DeviceCount; i++)
+        {
+            TTcpReactorDevice *ptDevice_l = &(ptReactor_l->ptDevices[i]);
+            if (ptDevice_l->bReady || !isTimeBefore(&tv_current, &(ptDevice_l->tvWakeup)))
+            {
+                serviceReactorDevice(ptReactor_l, ptDevice_l, &tv_current);
+            }
+            if ((i == 0) || isTimeBefore(&(ptDevice_l->tvWakeup), &(tTimer_l.it_value)))
+            {
+                tTimer_l.it_value = ptDevice_l->tvWakeup;
+            }
+        }
+
+        //an expired absolute time fires at once, a zero time would disarm the timer
+        if ((tTimer_l.it_value.tv_sec == 0) && (tTimer_l.it_value.tv_nsec == 0))
+        {
+            tTimer_l.it_value.tv_nsec = 1;
+        }
+        if ((ptReactor_l->u32DeviceCount > 0)
+            && (timerfd_settime(ptReactor_l->iTimer, TFD_TIMER_ABSTIME, &tTimer_l, NULL) < 0))
+        {
+            syslog(LOG_ERR, "Modbus tcp reactor: timerfd_settime failed: %s\n", strerror(errno));
+        }
+
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &iCancelState_l);
+        n = epoll_wait(ptReactor_l->iEpoll, atEvents_l, TCP_REACTOR_MAX_EVENTS, -1);
+        if ((n < 0) && (errno != EINTR))
+        {
+            syslog(LOG_ERR, "Modbus tcp reactor: epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            if (atEvents_l[i].data.ptr == NULL)
+            {
+                //the due devices are found by their wakeup time, the timer is only read to rearm the event
+                uint64_t u64Expirations_l;
+                ssize_t ret = read(ptReactor_l->iTimer, &u64Expirations_l, sizeof(u64Expirations_l));
+                (void)ret;
+            }
+            else
+            {
+                ((TTcpReactorDevice *)atEvents_l[i].data.ptr)->bReady = true;
+            }
+        }
+    }
+
+    pthread_cleanup_pop(1);
+    return NULL;
+}
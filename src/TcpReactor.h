@@ -0,0 +1,73 @@
+/*
+ * SPDX-FileCopyrightText: 2023 KUNBUS GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*!
+ *
+ * Project: piModbusMaster
+ * (C)    : KUNBUS GmbH, Heerweg 15C, 73370 Denkendorf, Germany
+ *
+ */
+
+#ifndef MODBUS_TCP_REACTOR_H_
+#define MODBUS_TCP_REACTOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "modbusconfig.h"
+#include "Scheduler.h"
+#include "ResponseTimeout.h"
+#include "TcpConnection.h"
+#include "ModbusTcpPipeline.h"
+
+typedef enum
+{
+    eReactorIdle,           // not connected, the next connect is due at tvWakeup
+    eReactorConnecting,     // non-blocking connect in progress until tvWakeup
+    eReactorConnected,      // actions are processed by the pipeline
+} EReactorDeviceState;
+
+/************************************************************************/
+/** @ brief modbus tcp master driven by a reactor thread
+ *  
+ *	holds the state which the thread per device keeps on its stack
+ */
+/************************************************************************/
+typedef struct
+{
+	TModbusMasterConfiguration *ptConfig;
+	EReactorDeviceState eState;
+	int iSocket;
+	bool bReady;					//socket event since the last service
+	struct timespec tvWakeup;		//the device has to be serviced at this time at the latest
+	TTcpConnection tConnection;
+	struct suEventListHead tEventListHead;
+	TResponseTimeoutTable tTimeouts;
+	TModbusTcpPipeline tPipeline;
+} TTcpReactorDevice;
+
+/************************************************************************/
+/** @ brief thread which processes several modbus tcp masters
+ *  
+ *	all sockets are non-blocking and watched by one epoll instance, one
+ *	timerfd wakes the thread at the earliest wakeup time of the devices
+ */
+/************************************************************************/
+typedef struct
+{
+	int iEpoll;
+	int iTimer;
+	uint32_t u32DeviceCount;
+	uint32_t u32MaxDeviceCount;
+	TTcpReactorDevice *ptDevices;
+} TTcpReactor;
+
+int32_t initTcpReactor(TTcpReactor *ptReactor_p, uint32_t u32MaxDeviceCount_p);
+int32_t addTcpReactorDevice(TTcpReactor *ptReactor_p, TModbusMasterConfiguration *ptConfig_p);
+void cleanupTcpReactor(void *ptr);
+void *startTcpReactorThread(void *arg);
+
+#endif /* MODBUS_TCP_REACTOR_H_ */
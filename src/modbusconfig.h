@@ -8,6 +8,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <modbus/modbus.h>
 #include <limits.h>
 #include <arpa/inet.h>
@@ -29,8 +30,15 @@
 #define MAX_MODBUS_WRITE_COILS_COUNT            1968
 #define MAX_MODBUS_WRITE_REGISTERS_COUNT        123
 
-//max register size for each modbus device action configured in pictory
-#define MAX_REGISTER_SIZE_PER_ACTION            256
+//max register/coil count for each modbus device action configured in pictory,
+//larger actions than one modbus request allows are split into several requests
+#define MAX_REGISTER_COUNT_PER_ACTION           2000
+
+//max register size in bytes for each modbus device action configured in pictory
+#define MAX_REGISTER_SIZE_PER_ACTION            (2 * MAX_REGISTER_COUNT_PER_ACTION)
+
+//transaction id, protocol id, length and unit id in front of a modbus tcp PDU
+#define MODBUS_MBAP_HEADER_LENGTH               7
 
 typedef enum
 {
@@ -67,9 +75,20 @@ typedef enum
     eNoDevice               = 0x10,
     eNoResponseFromDevice   = 0x11,
     eModbusActionBacklog    = 0x12,
+    eSlaveSuspended         = 0x13,
     eInternalError          = 0xf0,
 } EModbusErrors;
 
+//priority classes of modbus actions, a lower value is dispatched first
+typedef enum
+{
+    eActionPriorityOutput = 0,      // writes to the slaves, default for write function codes
+    eActionPriorityCritical,
+    eActionPriorityNormal,          // default for read function codes
+    eActionPriorityBackground,      // shed if overdue by a whole period
+    MODBUS_ACTION_PRIORITY_COUNT,
+} EModbusActionPriority;
+
 typedef struct  
 {
     uint16_t i16uVendorId;
@@ -83,6 +102,9 @@ typedef struct
     char sz8DeviceFilePath[PATH_MAX];	//path to the specified device file e.g. "/dev/ttyUSB0"
 } TRtuConfig;
 
+struct TMBActionEntry;
+SLIST_HEAD(TMBActionListHead, TMBActionEntry);
+
 typedef struct
 {
     uint16_t i16uActionID;
@@ -96,6 +118,9 @@ typedef struct
     uint32_t i32uStatusByteProcessImageOffset;		//The pi process image offset for the commands status byte
     uint32_t i32uResetStatusProcessImageByteOffset;	//The pi process image byte offset for the status reset
     uint8_t	i8uResetStatusProcessImageBitOffset;	//The pi process image bit offset for the status reset
+    EModbusActionPriority ePriority;				//dispatch priority if several actions are due
+    uint32_t u32TurnaroundDelayUs;					//rtu: minimal pause on the bus after a telegram of this action
+    struct TMBActionListHead tMembers;				//configured actions merged into this one, empty if not merged
         
 } TModbusAction;
 
@@ -140,18 +165,99 @@ typedef struct
 
 
 
+//handling of action periods which were missed, e.g. after a long connection loss
+typedef enum
+{
+    eCatchUpSkip,           // overdue by a whole period: drop it and continue with the next period in the future
+    eCatchUpCoalesce,       // process the overdue action once, drop all further missed periods
+    eCatchUpBounded,        // process up to u32MaxCatchUpPeriods missed periods back to back
+} ECatchUpPolicy;
+
+//assignment of the actions to the tcp connections of a master
+typedef enum
+{
+    eShardByUnit,           // all actions of a slave (unit id) use the same connection
+    eShardRoundRobin,       // the actions are dealt out to the connections one by one
+} EConnectionSharding;
+
+//implementation of the serial line protocol of a rtu master
+typedef enum
+{
+    eRtuTransportLibmodbus, // libmodbus rtu backend
+    eRtuTransportNative,    // own termios transport, ends a response as soon as its length is complete
+} ERtuTransport;
+
+//defaults for the optional tuning parameters ("extend" -> "tuning" in config.rsc)
+#define DEFAULT_CATCH_UP_POLICY                 eCatchUpCoalesce
+#define DEFAULT_MAX_CATCH_UP_PERIODS            3
+#define DEFAULT_RESPONSE_TIMEOUT_FLOOR_US       5000
+#define DEFAULT_RESPONSE_TIMEOUT_CEILING_US     1000000
+#define READ_COALESCING_OFF                     UINT32_MAX
+#define DEFAULT_READ_COALESCE_GAP               READ_COALESCING_OFF
+#define DEFAULT_WRITE_COALESCING                false
+#define DEFAULT_PIPELINE_DEPTH                  1
+#define MAX_PIPELINE_DEPTH                      16
+#define DEFAULT_CONNECTION_COUNT                1
+#define MAX_CONNECTION_COUNT                    8
+#define DEFAULT_CONNECTION_SHARDING             eShardByUnit
+#define DEFAULT_BREAKER_THRESHOLD               3
+#define DEFAULT_BREAKER_MAX_PROBE_INTERVAL_US   10000000
+#define BREAKER_MIN_PROBE_INTERVAL_US           1000000
+#define DEFAULT_CONNECT_TIMEOUT_US              1000000
+#define DEFAULT_MAX_RECONNECT_DELAY_US          5000000
+#define DEFAULT_DEAD_PEER_TIMEOUT_US            1000000
+#define DEFAULT_SHARED_CONNECTION               true
+#define DEFAULT_TURNAROUND_DELAY_US             0
+#define MAX_TURNAROUND_DELAY_US                 1000000
+#define DEFAULT_RTU_TRANSPORT                   eRtuTransportLibmodbus
+
+typedef struct
+{
+    ECatchUpPolicy eCatchUpPolicy;
+    uint32_t u32MaxCatchUpPeriods;
+    uint32_t u32ResponseTimeoutFloorUs;     // adaptive response timeouts are clamped to
+    uint32_t u32ResponseTimeoutCeilingUs;   // [floor, ceiling]
+    uint32_t u32ReadCoalesceGap;            // max unused registers between merged read actions, READ_COALESCING_OFF disables merging
+    bool bWriteCoalescing;                  // merge contiguous write actions
+    uint32_t u32PipelineDepth;              // max outstanding modbus tcp requests, 1 = one request at a time via libmodbus
+    uint32_t u32ConnectionCount;            // tcp connections to the slave, each with its own thread and scheduler
+    EConnectionSharding eConnectionSharding;
+    uint32_t u32BreakerThreshold;           // consecutive failed requests which suspend a rtu slave, 0 = off
+    uint32_t u32BreakerMaxProbeIntervalUs;  // limit of the probe interval of a suspended slave
+    uint32_t u32ConnectTimeoutUs;           // limit of a tcp connect
+    uint32_t u32MaxReconnectDelayUs;        // limit of the exponential delay between failed tcp connects
+    uint32_t u32DeadPeerTimeoutUs;          // reconnect if the tcp slave did not respond for this time
+    bool bSharedConnection;                 // share the connection with the other tcp masters of the same endpoint
+    uint32_t u32TurnaroundDelayUs;          // rtu: minimal pause after a telegram to a slave of this master
+    ERtuTransport eRtuTransport;
+} TModbusMasterTuning;
+
+struct TMBMasterConfigEntry;
+SLIST_HEAD(TMBMasterConfHead, TMBMasterConfigEntry);
+
 typedef struct
 {
     TModbusDeviceConfiguration tModbusDeviceConfig;
+    TModbusMasterTuning tTuning;
     int32_t i32ActionCount;
-    SLIST_HEAD(TMBActionListHead, TMBActionEntry) mbActionListHead; // Array of demanded actions, last element must be NULL
+    struct TMBActionListHead mbActionListHead; // Array of demanded actions, last element must be NULL
+    struct TMBMasterConfHead tMembers;         // masters of the same endpoint merged into this one, their actions
+                                               // are in mbActionListHead, only their status bytes are used
 } TModbusMasterConfiguration;
 
+#define DEFAULT_MIRROR_INTERVAL_US              0
+
+typedef struct
+{
+    uint32_t u32MirrorIntervalUs;           // refresh interval of the input mirror, 0 = inputs are read for every request
+} TModbusSlaveTuning;
+
 typedef struct
 {
     TModbusDeviceConfiguration tModbusDeviceConfig;
     TModbusSlaveDataSizeConfig tModbusDataConfig;
     TProcessImageConfiguration tProcessImageConfig;
+    TModbusSlaveTuning tTuning;
 } TModbusSlaveConfiguration;
 
 struct TMBSlaveConfigEntry
@@ -169,5 +275,4 @@ struct TMBMasterConfigEntry
 SLIST_HEAD(TMBSlaveConfHead, TMBSlaveConfigEntry);
 extern struct TMBSlaveConfHead mbSlaveConfHead;
 
-SLIST_HEAD(TMBMasterConfHead, TMBMasterConfigEntry);
 extern struct TMBMasterConfHead mbMasterConfHead;
@@ -22,9 +22,10 @@
 #include <syslog.h>
 #include <sys/types.h>
 #include <regex.h>
+#include <inttypes.h>
 
 #include <piControl.h>
-#include <piTest/piControlIf.h>
+#include "../ProcessImage.h"
 
 
 typedef enum
@@ -34,6 +35,7 @@ typedef enum
     ACTION_FUNCTION_CODE_WRONG_FORMAT,
     ACTION_ID_WRONG_FORMAT,
     ACTION_INTERVALL_WRONG_FORMAT,
+    ACTION_PRIORITY_WRONG_FORMAT,
     ACTION_REGISTER_ADDRESS_WRONG_FORMAT,
     ACTION_REGISTER_QUANTITY_WRONG_FORMAT,
     DEVICE_RESET_ENTRIES_NOT_FOUND,
@@ -72,6 +74,7 @@ typedef enum
     TCP_ADDRESS_WRONG_FORMAT,
     TCP_PORT_NOT_FOUND,
     TCP_PORT_WRONG_FORMAT,
+    TUNING_PARAMETER_WRONG_FORMAT,
     UNKNOWN_MODBUS_DEVICE,
     SUCCESS = 0
 } parsing_error;
@@ -83,6 +86,12 @@ parsing_error parse_modbus_master_config_data(const char* pc8_pi_config_data_p,
 parsing_error parse_device_modbus_configuration(json_object *json_device_parameter_object_p, TModbusDeviceConfiguration* modbusDeviceConfig_p);
 parsing_error parse_modbus_master_action_list(json_object *json_pi_device_p, struct TMBActionListHead *tModbusActionListHead_p);
 parsing_error parse_modbus_slave_device_process_image_config(json_object *pi_device_p, TModbusSlaveConfiguration* modbusSlaveConfiguration_p);
+parsing_error parse_modbus_master_tuning(json_object *json_pi_device_p, TModbusMasterTuning *tTuning_p);
+parsing_error parse_modbus_slave_tuning(json_object *json_pi_device_p, TModbusSlaveTuning *tTuning_p);
+parsing_error get_tuning_string_parameter(json_object *json_pi_device_p, const char* json_key_p, const char **ppc8_value_p);
+parsing_error get_tuning_uint_parameter(json_object *json_pi_device_p, const char* json_key_p, uint32_t *u32_value_p);
+parsing_error get_tuning_ms_parameter(json_object *json_pi_device_p, const char* json_key_p, uint32_t *u32_value_us_p);
+parsing_error parse_modbus_master_action_priority(const char* pc8_value_p, EModbusFunction eFunctionCode_p, EModbusActionPriority *ePriority_p);
 parsing_error get_device_product_type(json_object *pi_device, const char **ppc8_productType);
 parsing_error get_variable_parameters(json_object *json_pi_device_p,
                                       const char* json_parameter_name,
@@ -110,10 +119,31 @@ const char MODBUS_MASTER_FUNCTON_CODE_KEY[]	                    = "FunctionCode"
 const char MODBUS_MASTER_REGISTER_ADDRESS_KEY[]	                = "RegisterAddress";
 const char MODBUS_MASTER_QUANTITY_OF_REGISTERS_KEY[]            = "QuantityOfRegisters";
 const char MODBUS_MASTER_ACTION_INTERVAL_KEY[]                  = "ActionInterval";
+const char MODBUS_MASTER_ACTION_PRIORITY_KEY[]                  = "ActionPriority";
 const char MODBUS_MASTER_PROCESS_IMAGE_VARIABLE_NAME_KEY[]      = "DeviceValue";
 const char MODBUS_MASTER_ACTION_STATUS_BYTE[]                   = "ModbusActionStatus";
 const char MODBUS_MASTER_ACTION_STATUS_RESET[]                  = "ActionStatusReset";
 
+const char MODBUS_TUNING_KEY[]                                  = "tuning";
+const char MODBUS_TUNING_CATCH_UP_POLICY_KEY[]                  = "CatchUpPolicy";
+const char MODBUS_TUNING_MAX_CATCH_UP_PERIODS_KEY[]             = "MaxCatchUpPeriods";
+const char MODBUS_TUNING_RESPONSE_TIMEOUT_FLOOR_KEY[]           = "ResponseTimeoutFloor";
+const char MODBUS_TUNING_RESPONSE_TIMEOUT_CEILING_KEY[]         = "ResponseTimeoutCeiling";
+const char MODBUS_TUNING_READ_COALESCE_GAP_KEY[]                = "ReadCoalesceGap";
+const char MODBUS_TUNING_WRITE_COALESCING_KEY[]                 = "WriteCoalescing";
+const char MODBUS_TUNING_PIPELINE_DEPTH_KEY[]                   = "PipelineDepth";
+const char MODBUS_TUNING_CONNECTION_COUNT_KEY[]                 = "ConnectionCount";
+const char MODBUS_TUNING_CONNECTION_SHARDING_KEY[]              = "ConnectionSharding";
+const char MODBUS_TUNING_BREAKER_THRESHOLD_KEY[]                = "BreakerThreshold";
+const char MODBUS_TUNING_BREAKER_MAX_PROBE_INTERVAL_KEY[]       = "BreakerMaxProbeInterval";
+const char MODBUS_TUNING_CONNECT_TIMEOUT_KEY[]                  = "ConnectTimeout";
+const char MODBUS_TUNING_MAX_RECONNECT_DELAY_KEY[]              = "ReconnectMaxDelay";
+const char MODBUS_TUNING_DEAD_PEER_TIMEOUT_KEY[]                = "DeadPeerTimeout";
+const char MODBUS_TUNING_SHARED_CONNECTION_KEY[]               = "SharedConnection";
+const char MODBUS_TUNING_TURNAROUND_DELAY_KEY[]                 = "TurnaroundDelay";
+const char MODBUS_TUNING_RTU_TRANSPORT_KEY[]                    = "RtuTransport";
+const char MODBUS_TUNING_MIRROR_INTERVAL_KEY[]                  = "MirrorInterval";
+
 const char MODBUS_MASTER_MASTER_STATUS_BYTE[]                   = "ModbusMasterStatus";
 //const char MODBUS_MASTER_MASTER_STATUS_BYTE_VAR_NAME[]          = "Modbus_Master_Status";
 const char MODBUS_MASTER_MASTER_STATUS_RESET_BYTE[]             = "MasterStatusReset";
@@ -148,6 +178,8 @@ static const char* get_parsing_error_translation(parsing_error error_code)
             return "Action data object id has wrong format";
         case ACTION_INTERVALL_WRONG_FORMAT:
             return "Action intervall has wrong format";
+        case ACTION_PRIORITY_WRONG_FORMAT:
+            return "Action priority has wrong format";
         case ACTION_REGISTER_ADDRESS_WRONG_FORMAT:
             return "Action register address has wrong format";
         case ACTION_REGISTER_QUANTITY_WRONG_FORMAT:
@@ -198,6 +230,8 @@ static const char* get_parsing_error_translation(parsing_error error_code)
             return "TCP port not found";
         case TCP_PORT_WRONG_FORMAT:
             return "TCP port has wrong format";
+        case TUNING_PARAMETER_WRONG_FORMAT:
+            return "Tuning parameter has wrong format";
         case RTU_BAUDRATE_NOT_FOUND:
             return "Baud rate for RTU connection not found";
         case RTU_BAUDRATE_WRONG_FORMAT:
@@ -475,6 +509,372 @@ parsing_error get_json_devices_array(const char* pc8_pi_config_data_p, struct ar
 }
 
 
+/*****************************************************************************/
+/** @ brief returns an optional tuning parameter of json type string
+ *          from the "extend" -> "tuning" section of a device
+ *
+ *	@param[in] json_pi_device_p pointer to json object which contains the device information
+ *	@param[in] json_key_p name of the tuning parameter
+ *	@param[out] ppc8_value_p the parameter value, NULL if the parameter is not configured
+ *
+ *	@return '0' if the parameter is missing or valid, otherwise a negative value
+ *
+ */
+/*****************************************************************************/
+parsing_error get_tuning_string_parameter(json_object *json_pi_device_p, const char* json_key_p, const char **ppc8_value_p)
+{
+    json_object *json_config_extend = NULL;
+    json_object *json_tuning = NULL;
+    json_object *json_value = NULL;
+
+    *ppc8_value_p = NULL;
+    if (!(json_object_object_get_ex(json_pi_device_p, "extend", &json_config_extend))
+        || !(json_object_object_get_ex(json_config_extend, MODBUS_TUNING_KEY, &json_tuning))
+        || !(json_object_object_get_ex(json_tuning, json_key_p, &json_value)))
+    {
+        return SUCCESS;
+    }
+    if (json_object_get_type(json_value) != json_type_string)
+    {
+        syslog(LOG_ERR, "parsing config failed, tuning parameter %s is not a string\n", json_key_p);
+        return TUNING_PARAMETER_WRONG_FORMAT;
+    }
+    *ppc8_value_p = json_object_get_string(json_value);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************/
+/** @ brief returns an optional unsigned integer tuning parameter
+ *
+ *	@param[in] json_pi_device_p pointer to json object which contains the device information
+ *	@param[in] json_key_p name of the tuning parameter
+ *	@param[out] u32_value_p the parameter value, left untouched if the parameter is not configured
+ *
+ *	@return '0' if the parameter is missing or valid, otherwise a negative value
+ *
+ */
+/*****************************************************************************/
+parsing_error get_tuning_uint_parameter(json_object *json_pi_device_p, const char* json_key_p, uint32_t *u32_value_p)
+{
+    const char *pc8_value = NULL;
+    char *pc8_end = NULL;
+    int32_t success = get_tuning_string_parameter(json_pi_device_p, json_key_p, &pc8_value);
+    if ((success < 0) || (pc8_value == NULL))
+    {
+        return success;
+    }
+    errno = 0;
+    uintmax_t value = strtoumax(pc8_value, &pc8_end, 10);
+    if ((errno != 0) || (pc8_end == pc8_value) || (*pc8_end != '\0') || (value > UINT32_MAX))
+    {
+        syslog(LOG_ERR, "parsing config failed, tuning parameter %s has wrong format: %s\n", json_key_p, pc8_value);
+        return TUNING_PARAMETER_WRONG_FORMAT;
+    }
+    *u32_value_p = (uint32_t)value;
+    return SUCCESS;
+}
+
+/*****************************************************************************/
+/** @ brief returns an optional time tuning parameter, configured in msec
+ *
+ *	@param[in] json_pi_device_p pointer to json object which contains the device information
+ *	@param[in] json_key_p name of the tuning parameter
+ *	@param[out] u32_value_us_p the parameter value in usec, left untouched if the parameter
+ *	            is not configured or invalid
+ *
+ *	@return '0' if the parameter is missing or valid, otherwise a negative value
+ *
+ */
+/*****************************************************************************/
+parsing_error get_tuning_ms_parameter(json_object *json_pi_device_p, const char* json_key_p, uint32_t *u32_value_us_p)
+{
+    uint32_t u32_value_ms = *u32_value_us_p / 1000;
+    int32_t success = get_tuning_uint_parameter(json_pi_device_p, json_key_p, &u32_value_ms);
+    if (success < 0)
+    {
+        return success;
+    }
+    if ((u32_value_ms == 0) || (u32_value_ms > UINT32_MAX / 1000))
+    {
+        syslog(LOG_ERR, "parsing config failed, tuning parameter %s out of range: %u\n", json_key_p, (unsigned)u32_value_ms);
+        return TUNING_PARAMETER_WRONG_FORMAT;
+    }
+    *u32_value_us_p = u32_value_ms * 1000;
+    return SUCCESS;
+}
+
+
+/*****************************************************************************/
+/** @ brief parse the optional tuning parameters of a modbus master device
+ *
+ *	@param[in] json_pi_device_p pointer to json object which contains the device information
+ *	@param[out] tTuning_p tuning parameters, defaults are used for missing entries
+ *
+ *	@return '0' if processing was successful, otherwise a negative value
+ *
+ */
+/*****************************************************************************/
+parsing_error parse_modbus_master_tuning(json_object *json_pi_device_p, TModbusMasterTuning *tTuning_p)
+{
+    const char *pc8_value = NULL;
+    int32_t result = SUCCESS;
+    int32_t success;
+
+    tTuning_p->eCatchUpPolicy = DEFAULT_CATCH_UP_POLICY;
+    tTuning_p->u32MaxCatchUpPeriods = DEFAULT_MAX_CATCH_UP_PERIODS;
+    tTuning_p->u32ResponseTimeoutFloorUs = DEFAULT_RESPONSE_TIMEOUT_FLOOR_US;
+    tTuning_p->u32ResponseTimeoutCeilingUs = DEFAULT_RESPONSE_TIMEOUT_CEILING_US;
+    tTuning_p->u32ReadCoalesceGap = DEFAULT_READ_COALESCE_GAP;
+    tTuning_p->bWriteCoalescing = DEFAULT_WRITE_COALESCING;
+    tTuning_p->u32PipelineDepth = DEFAULT_PIPELINE_DEPTH;
+    tTuning_p->u32ConnectionCount = DEFAULT_CONNECTION_COUNT;
+    tTuning_p->eConnectionSharding = DEFAULT_CONNECTION_SHARDING;
+    tTuning_p->u32BreakerThreshold = DEFAULT_BREAKER_THRESHOLD;
+    tTuning_p->u32BreakerMaxProbeIntervalUs = DEFAULT_BREAKER_MAX_PROBE_INTERVAL_US;
+    tTuning_p->u32ConnectTimeoutUs = DEFAULT_CONNECT_TIMEOUT_US;
+    tTuning_p->u32MaxReconnectDelayUs = DEFAULT_MAX_RECONNECT_DELAY_US;
+    tTuning_p->u32DeadPeerTimeoutUs = DEFAULT_DEAD_PEER_TIMEOUT_US;
+    tTuning_p->bSharedConnection = DEFAULT_SHARED_CONNECTION;
+    tTuning_p->u32TurnaroundDelayUs = DEFAULT_TURNAROUND_DELAY_US;
+    tTuning_p->eRtuTransport = DEFAULT_RTU_TRANSPORT;
+
+    success = get_tuning_string_parameter(json_pi_device_p, MODBUS_TUNING_CATCH_UP_POLICY_KEY, &pc8_value);
+    if (success < 0)
+    {
+        result = success;
+    }
+    else if (pc8_value != NULL)
+    {
+        if (strcmp(pc8_value, "skip") == 0)
+        {
+            tTuning_p->eCatchUpPolicy = eCatchUpSkip;
+        }
+        else if (strcmp(pc8_value, "coalesce") == 0)
+        {
+            tTuning_p->eCatchUpPolicy = eCatchUpCoalesce;
+        }
+        else if (strcmp(pc8_value, "bounded") == 0)
+        {
+            tTuning_p->eCatchUpPolicy = eCatchUpBounded;
+        }
+        else
+        {
+            syslog(LOG_ERR, "parsing config failed, unknown catch up policy: %s\n", pc8_value);
+            result = TUNING_PARAMETER_WRONG_FORMAT;
+        }
+    }
+
+    success = get_tuning_uint_parameter(json_pi_device_p, MODBUS_TUNING_MAX_CATCH_UP_PERIODS_KEY, &(tTuning_p->u32MaxCatchUpPeriods));
+    if (success < 0)
+    {
+        result = success;
+    }
+
+    //response timeouts are configured in msec like the action interval
+    success = get_tuning_ms_parameter(json_pi_device_p, MODBUS_TUNING_RESPONSE_TIMEOUT_FLOOR_KEY, &(tTuning_p->u32ResponseTimeoutFloorUs));
+    if (success < 0)
+    {
+        result = success;
+    }
+    success = get_tuning_ms_parameter(json_pi_device_p, MODBUS_TUNING_RESPONSE_TIMEOUT_CEILING_KEY, &(tTuning_p->u32ResponseTimeoutCeilingUs));
+    if (success < 0)
+    {
+        result = success;
+    }
+
+    //"off" disables the merging of read actions, otherwise the max number of unused registers
+    success = get_tuning_string_parameter(json_pi_device_p, MODBUS_TUNING_READ_COALESCE_GAP_KEY, &pc8_value);
+    if ((success == SUCCESS) && (pc8_value != NULL) && (strcmp(pc8_value, "off") == 0))
+    {
+        tTuning_p->u32ReadCoalesceGap = READ_COALESCING_OFF;
+    }
+    else
+    {
+        success = get_tuning_uint_parameter(json_pi_device_p, MODBUS_TUNING_READ_COALESCE_GAP_KEY, &(tTuning_p->u32ReadCoalesceGap));
+        if ((success < 0) || (tTuning_p->u32ReadCoalesceGap > MAX_MODBUS_READ_HOLDING_REGISTERS_COUNT))
+        {
+            result = (success < 0) ? success : TUNING_PARAMETER_WRONG_FORMAT;
+            tTuning_p->u32ReadCoalesceGap = DEFAULT_READ_COALESCE_GAP;
+        }
+    }
+
+    success = get_tuning_string_parameter(json_pi_device_p, MODBUS_TUNING_WRITE_COALESCING_KEY, &pc8_value);
+    if (success < 0)
+    {
+        result = success;
+    }
+    else if (pc8_value != NULL)
+    {
+        if (strcmp(pc8_value, "on") == 0)
+        {
+            tTuning_p->bWriteCoalescing = true;
+        }
+        else if (strcmp(pc8_value, "off") == 0)
+        {
+            tTuning_p->bWriteCoalescing = false;
+        }
+        else
+        {
+            syslog(LOG_ERR, "parsing config failed, tuning parameter %s has wrong format: %s\n", MODBUS_TUNING_WRITE_COALESCING_KEY, pc8_value);
+            result = TUNING_PARAMETER_WRONG_FORMAT;
+        }
+    }
+
+    success = get_tuning_string_parameter(json_pi_device_p, MODBUS_TUNING_SHARED_CONNECTION_KEY, &pc8_value);
+    if (success < 0)
+    {
+        result = success;
+    }
+    else if (pc8_value != NULL)
+    {
+        if (strcmp(pc8_value, "on") == 0)
+        {
+            tTuning_p->bSharedConnection = true;
+        }
+        else if (strcmp(pc8_value, "off") == 0)
+        {
+            tTuning_p->bSharedConnection = false;
+        }
+        else
+        {
+            syslog(LOG_ERR, "parsing config failed, tuning parameter %s has wrong format: %s\n", MODBUS_TUNING_SHARED_CONNECTION_KEY, pc8_value);
+            result = TUNING_PARAMETER_WRONG_FORMAT;
+        }
+    }
+
+    success = get_tuning_uint_parameter(json_pi_device_p, MODBUS_TUNING_PIPELINE_DEPTH_KEY, &(tTuning_p->u32PipelineDepth));
+    if ((success < 0) || (tTuning_p->u32PipelineDepth == 0) || (tTuning_p->u32PipelineDepth > MAX_PIPELINE_DEPTH))
+    {
+        result = (success < 0) ? success : TUNING_PARAMETER_WRONG_FORMAT;
+        tTuning_p->u32PipelineDepth = DEFAULT_PIPELINE_DEPTH;
+    }
+
+    success = get_tuning_uint_parameter(json_pi_device_p, MODBUS_TUNING_CONNECTION_COUNT_KEY, &(tTuning_p->u32ConnectionCount));
+    if ((success < 0) || (tTuning_p->u32ConnectionCount == 0) || (tTuning_p->u32ConnectionCount > MAX_CONNECTION_COUNT))
+    {
+        result = (success < 0) ? success : TUNING_PARAMETER_WRONG_FORMAT;
+        tTuning_p->u32ConnectionCount = DEFAULT_CONNECTION_COUNT;
+    }
+
+    success = get_tuning_string_parameter(json_pi_device_p, MODBUS_TUNING_CONNECTION_SHARDING_KEY, &pc8_value);
+    if (success < 0)
+    {
+        result = success;
+    }
+    else if (pc8_value != NULL)
+    {
+        if (strcmp(pc8_value, "unit") == 0)
+        {
+            tTuning_p->eConnectionSharding = eShardByUnit;
+        }
+        else if (strcmp(pc8_value, "roundrobin") == 0)
+        {
+            tTuning_p->eConnectionSharding = eShardRoundRobin;
+        }
+        else
+        {
+            syslog(LOG_ERR, "parsing config failed, tuning parameter %s has wrong format: %s\n", MODBUS_TUNING_CONNECTION_SHARDING_KEY, pc8_value);
+            result = TUNING_PARAMETER_WRONG_FORMAT;
+        }
+    }
+
+    success = get_tuning_uint_parameter(json_pi_device_p, MODBUS_TUNING_BREAKER_THRESHOLD_KEY, &(tTuning_p->u32BreakerThreshold));
+    if (success < 0)
+    {
+        result = success;
+    }
+
+    //the probe interval is configured in msec like the action interval
+    success = get_tuning_ms_parameter(json_pi_device_p, MODBUS_TUNING_BREAKER_MAX_PROBE_INTERVAL_KEY, &(tTuning_p->u32BreakerMaxProbeIntervalUs));
+    if (success < 0)
+    {
+        result = success;
+    }
+
+    success = get_tuning_ms_parameter(json_pi_device_p, MODBUS_TUNING_CONNECT_TIMEOUT_KEY, &(tTuning_p->u32ConnectTimeoutUs));
+    if (success < 0)
+    {
+        result = success;
+    }
+    success = get_tuning_ms_parameter(json_pi_device_p, MODBUS_TUNING_MAX_RECONNECT_DELAY_KEY, &(tTuning_p->u32MaxReconnectDelayUs));
+    if (success < 0)
+    {
+        result = success;
+    }
+    success = get_tuning_ms_parameter(json_pi_device_p, MODBUS_TUNING_DEAD_PEER_TIMEOUT_KEY, &(tTuning_p->u32DeadPeerTimeoutUs));
+    if (success < 0)
+    {
+        result = success;
+    }
+
+    //in usec, the pause is often shorter than a millisecond on fast lines
+    success = get_tuning_uint_parameter(json_pi_device_p, MODBUS_TUNING_TURNAROUND_DELAY_KEY, &(tTuning_p->u32TurnaroundDelayUs));
+    if ((success < 0) || (tTuning_p->u32TurnaroundDelayUs > MAX_TURNAROUND_DELAY_US))
+    {
+        result = (success < 0) ? success : TUNING_PARAMETER_WRONG_FORMAT;
+        tTuning_p->u32TurnaroundDelayUs = DEFAULT_TURNAROUND_DELAY_US;
+    }
+
+    success = get_tuning_string_parameter(json_pi_device_p, MODBUS_TUNING_RTU_TRANSPORT_KEY, &pc8_value);
+    if (success < 0)
+    {
+        result = success;
+    }
+    else if (pc8_value != NULL)
+    {
+        if (strcmp(pc8_value, "libmodbus") == 0)
+        {
+            tTuning_p->eRtuTransport = eRtuTransportLibmodbus;
+        }
+        else if (strcmp(pc8_value, "native") == 0)
+        {
+            tTuning_p->eRtuTransport = eRtuTransportNative;
+        }
+        else
+        {
+            syslog(LOG_ERR, "parsing config failed, tuning parameter %s has wrong format: %s\n", MODBUS_TUNING_RTU_TRANSPORT_KEY, pc8_value);
+            result = TUNING_PARAMETER_WRONG_FORMAT;
+        }
+    }
+
+    return result;
+}
+
+
+/*****************************************************************************/
+/** @ brief parse the optional tuning parameters of a modbus slave device
+ *
+ *	@param[in] json_pi_device_p pointer to json object which contains the device information
+ *	@param[out] tTuning_p tuning parameters, defaults are used for missing entries
+ *
+ *	@return '0' if processing was successful, otherwise a negative value
+ *
+ */
+/*****************************************************************************/
+parsing_error parse_modbus_slave_tuning(json_object *json_pi_device_p, TModbusSlaveTuning *tTuning_p)
+{
+    const char *pc8_value = NULL;
+    int32_t success;
+
+    tTuning_p->u32MirrorIntervalUs = DEFAULT_MIRROR_INTERVAL_US;
+
+    //"off" reads the inputs for every request, otherwise the refresh interval in msec
+    success = get_tuning_string_parameter(json_pi_device_p, MODBUS_TUNING_MIRROR_INTERVAL_KEY, &pc8_value);
+    if ((success < 0) || (pc8_value == NULL) || (strcmp(pc8_value, "off") == 0))
+    {
+        return success;
+    }
+    uint32_t u32_interval_us = 1000;
+    success = get_tuning_ms_parameter(json_pi_device_p, MODBUS_TUNING_MIRROR_INTERVAL_KEY, &u32_interval_us);
+    if (success == SUCCESS)
+    {
+        tTuning_p->u32MirrorIntervalUs = u32_interval_us;
+    }
+    return success;
+}
+
+
 /*****************************************************************************/
 /** @ brief get the string of the product type from config.rsc
  *
@@ -552,6 +952,13 @@ parsing_error parse_modbus_master_config_data(const char* pc8_pi_config_data_p,
                 continue;
             }
 
+            success = parse_modbus_master_tuning(json_pi_device, &(nextConfig->mbMasterConfig.tTuning));
+            if (success < 0)
+            {
+                // invalid tuning parameters are reported, the defaults are used instead
+                print_err(success);
+            }
+
             nextConfig->mbMasterConfig.i32ActionCount = parse_modbus_master_action_list(json_pi_device, &(nextConfig->mbMasterConfig.mbActionListHead));
             if(nextConfig->mbMasterConfig.i32ActionCount < 0)
             {
@@ -559,6 +966,12 @@ parsing_error parse_modbus_master_config_data(const char* pc8_pi_config_data_p,
                 free(nextConfig);
                 continue;
             }
+            //the actions keep the turnaround delay of their device if several devices share a bus
+            struct TMBActionEntry *action;
+            SLIST_FOREACH(action, &(nextConfig->mbMasterConfig.mbActionListHead), entries)
+            {
+                action->modbusAction.u32TurnaroundDelayUs = nextConfig->mbMasterConfig.tTuning.u32TurnaroundDelayUs;
+            }
 
             //search for device status byte offset in inp and out list of device
             //get status byte variable name
@@ -631,8 +1044,22 @@ void free_modbus_master_config_data(struct TMBMasterConfHead *p_mbMasterConfHead
         {
             struct TMBActionEntry *act = SLIST_FIRST(&entry->mbMasterConfig.mbActionListHead);
             SLIST_REMOVE_HEAD(&entry->mbMasterConfig.mbActionListHead, entries);
+            //actions merged by the master are members of the merged action
+            while (!SLIST_EMPTY(&act->modbusAction.tMembers))
+            {
+                struct TMBActionEntry *member = SLIST_FIRST(&act->modbusAction.tMembers);
+                SLIST_REMOVE_HEAD(&act->modbusAction.tMembers, entries);
+                free(member);
+            }
             free(act);
         }
+        //masters merged into this one, their actions were moved to it
+        while (!SLIST_EMPTY(&entry->mbMasterConfig.tMembers))
+        {
+            struct TMBMasterConfigEntry *member = SLIST_FIRST(&entry->mbMasterConfig.tMembers);
+            SLIST_REMOVE_HEAD(&entry->mbMasterConfig.tMembers, entries);
+            free(member);
+        }
         free(entry);
     }
 }
@@ -695,6 +1122,13 @@ parsing_error parse_modbus_slaves_config_data(const char* pc8_pi_config_data_p,
                 free(nextConfig);
                 continue;
             }
+
+            success = parse_modbus_slave_tuning(pi_device, &(nextConfig->mbSlaveConfig.tTuning));
+            if (success < 0)
+            {
+                // invalid tuning parameters are reported, the defaults are used instead
+                print_err(success);
+            }
             SLIST_INSERT_HEAD(p_mbSlaveConfHead_p, nextConfig, entries);
         }
     }
@@ -1081,6 +1515,64 @@ parsing_error parse_device_modbus_configuration(json_object *json_device_object_
 }
 
 
+/*****************************************************************************/
+/** @ brief parse the priority class of a modbus action
+ *
+ *	@param[in] pc8_value_p "output", "critical", "normal", "background" or NULL
+ *	@param[in] eFunctionCode_p modbus function of the action
+ *	@param[out] ePriority_p priority class of the action
+ *	@return SUCCESS or ACTION_PRIORITY_WRONG_FORMAT
+ *
+ *	without a configured priority write actions are in class "output" and
+ *	read actions in class "normal". An invalid value uses this default too.
+ */
+/*****************************************************************************/
+parsing_error parse_modbus_master_action_priority(const char* pc8_value_p, EModbusFunction eFunctionCode_p, EModbusActionPriority *ePriority_p)
+{
+    switch (eFunctionCode_p)
+    {
+        case eWRITE_SINGLE_COIL:
+        case eWRITE_SINGLE_REGISTER:
+        case eWRITE_MULTIPLE_COILS:
+        case eWRITE_MULTIPLE_REGISTERS:
+        case eWRITE_MASK_REGISTER:
+        case eWRITE_AND_READ_REGISTERS:
+            *ePriority_p = eActionPriorityOutput;
+            break;
+        default:
+            *ePriority_p = eActionPriorityNormal;
+            break;
+    }
+
+    if (pc8_value_p == NULL)
+    {
+        return SUCCESS;
+    }
+    if (strcmp(pc8_value_p, "output") == 0)
+    {
+        *ePriority_p = eActionPriorityOutput;
+    }
+    else if (strcmp(pc8_value_p, "critical") == 0)
+    {
+        *ePriority_p = eActionPriorityCritical;
+    }
+    else if (strcmp(pc8_value_p, "normal") == 0)
+    {
+        *ePriority_p = eActionPriorityNormal;
+    }
+    else if (strcmp(pc8_value_p, "background") == 0)
+    {
+        *ePriority_p = eActionPriorityBackground;
+    }
+    else
+    {
+        syslog(LOG_ERR, "parsing config failed, unknown action priority: %s\n", pc8_value_p);
+        return ACTION_PRIORITY_WRONG_FORMAT;
+    }
+    return SUCCESS;
+}
+
+
 /*****************************************************************************/
 /** @ brief parse the modbus action list
  *
@@ -1250,15 +1742,15 @@ parsing_error parse_modbus_master_action_list(json_object *json_pi_device_p, str
                 return ACTION_REGISTER_QUANTITY_WRONG_FORMAT;
             }
 
-            if (quantity_of_registers > MAX_REGISTER_SIZE_PER_ACTION)
+            if (quantity_of_registers > MAX_REGISTER_COUNT_PER_ACTION)
             {
                 syslog(LOG_ERR,
-                    "Error PiCtory, quantity of registers configured for action ID %d exceeds MAX REGISTER SIZE PER ACTION %d \n",
+                    "Error PiCtory, quantity of registers configured for action ID %d exceeds MAX REGISTER COUNT PER ACTION %d \n",
                     nextAction->modbusAction.i16uActionID,
-                    MAX_REGISTER_SIZE_PER_ACTION);
+                    MAX_REGISTER_COUNT_PER_ACTION);
             }
 
-            assert((quantity_of_registers > 0) && (quantity_of_registers <= MAX_REGISTER_SIZE_PER_ACTION));    //check min/max register quantity
+            assert((quantity_of_registers > 0) && (quantity_of_registers <= MAX_REGISTER_COUNT_PER_ACTION));    //check min/max register quantity
             nextAction->modbusAction.i16uRegisterCount = quantity_of_registers;
 
             //set modbus command interval
@@ -1281,6 +1773,19 @@ parsing_error parse_modbus_master_action_list(json_object *json_pi_device_p, str
             assert((action_interval > 0) && (action_interval <= (1000 * 60 * 30)));  //check min 1 ms, max 0.5h = 1800000ms
             nextAction->modbusAction.i32uInterval_us = action_interval * 1000; //msec to usec
 
+            //set optional action priority
+            val_str_buffer = get_modbus_action_matching_name_string_value(
+                    json_modbus_actions,
+                MODBUS_MASTER_ACTION_PRIORITY_KEY,
+                action_parameters_identifier);
+            int32_t priority_result = parse_modbus_master_action_priority(val_str_buffer,
+                nextAction->modbusAction.eFunctionCode,
+                &(nextAction->modbusAction.ePriority));
+            if (priority_result != SUCCESS)
+            {
+                print_err(priority_result);
+            }
+
             uint32_t process_image_byte_offset = 0;
             uint32_t process_image_bit_offset = 0;
 
@@ -1366,10 +1871,10 @@ parsing_error parse_modbus_master_action_list(json_object *json_pi_device_p, str
             reset_data_l.i16uAddress = (uint16_t)(nextAction->modbusAction.i32uResetStatusProcessImageByteOffset);
             reset_data_l.i8uBit      = nextAction->modbusAction.i8uResetStatusProcessImageBitOffset;
             reset_data_l.i8uValue    = 0;
-            piControlSetBitValue(&reset_data_l);
+            setProcessImageBit(&reset_data_l);
 
             uint8_t reset_data = 0;
-            piControlWrite(nextAction->modbusAction.i32uStatusByteProcessImageOffset, (uint32_t)1, &(reset_data));
+            writeProcessImage(nextAction->modbusAction.i32uStatusByteProcessImageOffset, (uint32_t)1, &(reset_data));
 
             val_str_buffer = NULL;
             if (action_parameters_identifier != NULL)
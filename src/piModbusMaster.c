@@ -19,24 +19,61 @@
 #include "modbusconfig.h"
 
 #include "ModbusMasterThread.h"
+#include "ActionPlanner.h"
+#include "TcpReactor.h"
 #include "piConfigParser/piConfigParser.h"
 #include <piTest/piControlIf.h>
 
 #define DEBUG_MODE
 
+//the master threads need only a small part of the default stack of 8 MB
+#define MASTER_THREAD_STACK_SIZE    (256 * 1024)
+#define MAX_TCP_REACTOR_COUNT       64
 
 
+static void printUsage(const char *pc8Name_p)
+{
+    fprintf(stderr, "usage: %s [-r reactor threads]\n", pc8Name_p);
+    fprintf(stderr, "  -r n  process all modbus tcp masters in n threads (1..%d) instead of one thread per master\n",
+        MAX_TCP_REACTOR_COUNT);
+}
+
 int main(int argc, char *argv[])
 {
-    int i, modbusDevicesCount;
+    int i, modbusDevicesCount, threadCount;
+    int opt;
+    int reactorCount = 0;       //0: one thread per tcp master
+    int activeReactorCount = 0;
+    int tcpDevicesCount;
     pthread_t *pThreads = NULL;
+    pthread_t *pReactorThreads = NULL;
+    TTcpReactor *ptReactors = NULL;
+    pthread_attr_t tThreadAttr;
     struct TMBMasterConfigEntry *mbMasterConfigListEntry;
 
-    (void)argc;
-    (void)argv;
+    while ((opt = getopt(argc, argv, "r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            reactorCount = atoi(optarg);
+            if ((reactorCount < 1) || (reactorCount > MAX_TCP_REACTOR_COUNT))
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
     
     STDERR = stdout;    // show all messages on stdout
 
+    pthread_attr_init(&tThreadAttr);
+    pthread_attr_setstacksize(&tThreadAttr, MASTER_THREAD_STACK_SIZE);
+
     //open syslog
     openlog("piModbusMaster", LOG_PID, LOG_DAEMON);
     syslog(LOG_NOTICE, "piModbusMaster started\n");
@@ -52,25 +89,73 @@ int main(int argc, char *argv[])
         {
             syslog(LOG_ERR, "No modbus master configuration found in config file");
             modbusDevicesCount = 0;
+            threadCount = 0;
+            activeReactorCount = 0;
         }
         else
         {
             modbusDevicesCount = 0;
+            tcpDevicesCount = 0;
+            //masters with the same tcp endpoint or serial port share one connection and scheduler
+            mergeModbusEndpoints(&mbMasterConfHead);
             //count number of matching devices to allocate memory for pthreads
             SLIST_FOREACH(mbMasterConfigListEntry, &mbMasterConfHead, entries)
             {
+                //merge compatible actions into single modbus requests
+                int32_t i32RequestCount = planModbusActions(&(mbMasterConfigListEntry->mbMasterConfig));
+                if (i32RequestCount > 0)
+                {
+                    mbMasterConfigListEntry->mbMasterConfig.i32ActionCount = i32RequestCount;
+                }
+            }
+            SLIST_FOREACH(mbMasterConfigListEntry, &mbMasterConfHead, entries)
+            {
+                //a tcp master with several connections gets one configuration per connection,
+                //they are inserted after the current entry and started as separate threads
+                shardModbusConnections(mbMasterConfigListEntry);
                 modbusDevicesCount++;
+                if (mbMasterConfigListEntry->mbMasterConfig.tModbusDeviceConfig.eProtocol == eProtTCP)
+                {
+                    tcpDevicesCount++;
+                }
             }
             pThreads = calloc(modbusDevicesCount, sizeof(pthread_t));
+
+            //the tcp masters are dealt out to the reactors, no reactor without masters
+            activeReactorCount = (reactorCount < tcpDevicesCount) ? reactorCount : tcpDevicesCount;
+            if (activeReactorCount > 0)
+            {
+                ptReactors = calloc(activeReactorCount, sizeof(TTcpReactor));
+                pReactorThreads = calloc(activeReactorCount, sizeof(pthread_t));
+                for (i = 0; i < activeReactorCount; i++)
+                {
+                    //a reactor which failed has no room for masters, they are not started then
+                    initTcpReactor(&ptReactors[i], (tcpDevicesCount + activeReactorCount - 1) / activeReactorCount);
+                }
+            }
         
             //start a thread for every matching configuration found in pictory config file
             i = 0;
+            tcpDevicesCount = 0;
             SLIST_FOREACH(mbMasterConfigListEntry, &mbMasterConfHead, entries)
             {
                 pThreads[i] = 0;
+                if ((activeReactorCount > 0)
+                    && (mbMasterConfigListEntry->mbMasterConfig.tModbusDeviceConfig.eProtocol == eProtTCP))
+                {
+                    if (addTcpReactorDevice(&ptReactors[tcpDevicesCount % activeReactorCount], &(mbMasterConfigListEntry->mbMasterConfig)) < 0)
+                    {
+                        syslog(LOG_ERR,
+                            "Cannot add modbus master for IP %s and Port %d to reactor\n",
+                            mbMasterConfigListEntry->mbMasterConfig.tModbusDeviceConfig.uProt.tTcpConfig.szTcpIpAddress,
+                            mbMasterConfigListEntry->mbMasterConfig.tModbusDeviceConfig.uProt.tTcpConfig.i32uPort);
+                    }
+                    tcpDevicesCount++;
+                    continue;
+                }
                 if (mbMasterConfigListEntry->mbMasterConfig.tModbusDeviceConfig.eProtocol == eProtRTU)
                 {
-                    if (0 != pthread_create(&pThreads[i], NULL, &startRtuMasterThread, (void*)&(mbMasterConfigListEntry->mbMasterConfig)))
+                    if (0 != pthread_create(&pThreads[i], &tThreadAttr, &startRtuMasterThread, (void*)&(mbMasterConfigListEntry->mbMasterConfig)))
                     {
                         syslog(LOG_ERR,
                             "Cannot create modbus master thread for device %s\n",
@@ -79,7 +164,7 @@ int main(int argc, char *argv[])
                 }
                 else if (mbMasterConfigListEntry->mbMasterConfig.tModbusDeviceConfig.eProtocol == eProtTCP)
                 {
-                    if (0 != pthread_create(&pThreads[i], NULL, &startTcpMasterThread, (void*)&(mbMasterConfigListEntry->mbMasterConfig)))
+                    if (0 != pthread_create(&pThreads[i], &tThreadAttr, &startTcpMasterThread, (void*)&(mbMasterConfigListEntry->mbMasterConfig)))
                     {
                         syslog(LOG_ERR,
                             "Cannot create modbus master thread for IP %s and Port %d\n",
@@ -93,6 +178,20 @@ int main(int argc, char *argv[])
                 }
                 i++;
             }
+            threadCount = i;
+
+            for (i = 0; i < activeReactorCount; i++)
+            {
+                pReactorThreads[i] = 0;
+                if (ptReactors[i].u32DeviceCount == 0)
+                {
+                    continue;
+                }
+                if (0 != pthread_create(&pReactorThreads[i], &tThreadAttr, &startTcpReactorThread, (void*)&ptReactors[i]))
+                {
+                    syslog(LOG_ERR, "Cannot create modbus tcp reactor thread %d\n", i);
+                }
+            }
         }
         
         int event;
@@ -102,7 +201,7 @@ int main(int argc, char *argv[])
         
         if (modbusDevicesCount > 0)
         {
-            for (i = 0; i < modbusDevicesCount; i++) {
+            for (i = 0; i < threadCount; i++) {
                 if (pThreads[i])
                     pthread_cancel(pThreads[i]);
                 else
@@ -110,6 +209,23 @@ int main(int argc, char *argv[])
             }
             free(pThreads);
 
+            //the reactors close their connections when they are canceled
+            for (i = 0; i < activeReactorCount; i++) {
+                if (pReactorThreads[i])
+                {
+                    pthread_cancel(pReactorThreads[i]);
+                    pthread_join(pReactorThreads[i], NULL);
+                }
+                else
+                {
+                    cleanupTcpReactor(&ptReactors[i]);
+                }
+            }
+            free(pReactorThreads);
+            free(ptReactors);
+            pReactorThreads = NULL;
+            ptReactors = NULL;
+
             free_modbus_master_config_data(&mbMasterConfHead);
         }
         free_config_buffer();
@@ -12,47 +12,72 @@
  */
 #include <stdio.h>
 #include "piProcessImageAccess.h"
-#include <piTest/piControlIf.h>
+#include "ProcessImage.h"
 #include <syslog.h>
 
 
 /*****************************************************************************/
-/** @ brief write the current modbus data for device to pi process image
+/** @ brief checks that a requested range lies within a mapping area
+ *
+ *	@return true if the range is not empty and within the area
+ */
+/*****************************************************************************/
+static bool isRangeInArea(uint16_t u16Address_p, uint16_t u16Count_p, int iAreaSize_p)
+{
+	return (u16Count_p > 0) && (((int)u16Address_p + (int)u16Count_p) <= iAreaSize_p);
+}
+
+/*****************************************************************************/
+/** @ brief write the modbus data changed by a request to the pi process image
  *  
  *	@param[in]	mbMapping the libmodbus mapping object with current modbus data
  *	@param[in] ptrSPiProcessImageOffsets modbus slave parameter for the pi process image 
+ *	@param[in] eFunctionCode_p function code of the processed write request
+ *	@param[in] u16Address_p first coil/register written by the request
+ *	@param[in] u16Count_p number of coils/registers written by the request
  *
- *	@return '0' if processing was successful, otherwise a negative value
+ *	@return '0' if nothing was written, a positive value if processing was
+ *	        successful, otherwise a negative value
  *
+ *	only the coils or holding registers of the request are written, a range
+ *	outside of the mapping is rejected by libmodbus and not written
  */
 /*****************************************************************************/
-int32_t writeModbusDataToProcessImage(modbus_mapping_t* mbMapping, TProcessImageConfiguration* ptrSPiProcessImageOffsets)
+int32_t writeModbusDataToProcessImage(modbus_mapping_t* mbMapping, TProcessImageConfiguration* ptrSPiProcessImageOffsets,
+	EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p)
 {
-	
 	int32_t successful = 0;
-	
-	//write modbus coils data
-	if (mbMapping->nb_bits > 0)
+
+	switch (eFunctionCode_p)
 	{
-		successful = piControlWrite(ptrSPiProcessImageOffsets->u32CoilsInputOffset, mbMapping->nb_bits >> 3, (uint8_t*)mbMapping->tab_bits);	
-		if (successful <= 0)
+	case eWRITE_SINGLE_COIL:
+	case eWRITE_MULTIPLE_COILS:
+		if (isRangeInArea(u16Address_p, u16Count_p, mbMapping->nb_bits))
 		{
-			syslog(LOG_ERR, "write access to process image failed: %d\n", successful);
-			return successful;
+			//libmodbus stores one bit per byte, the process image 8 bits per byte
+			successful = writeProcessImageBits(ptrSPiProcessImageOffsets->u32CoilsInputOffset + (u16Address_p >> 3),
+				(uint8_t)(u16Address_p & 7), u16Count_p, &(mbMapping->tab_bits[u16Address_p]));
 		}
-	}
-	
-	//write modbus holding registers data
-	if (mbMapping->nb_registers > 0)
-	{
-		successful = piControlWrite(ptrSPiProcessImageOffsets->u32HoldingRegistersInputOffset, mbMapping->nb_registers << 1, (uint8_t*)mbMapping->tab_registers);	
-		if (successful <= 0)
+		break;
+
+	case eWRITE_SINGLE_REGISTER:
+	case eWRITE_MULTIPLE_REGISTERS:
+	case eWRITE_MASK_REGISTER:
+	case eWRITE_AND_READ_REGISTERS:
+		if (isRangeInArea(u16Address_p, u16Count_p, mbMapping->nb_registers))
 		{
-			syslog(LOG_ERR, "write access to process image failed: %d\n", successful);
-			return successful;
+			successful = writeProcessImage(ptrSPiProcessImageOffsets->u32HoldingRegistersInputOffset + ((uint32_t)u16Address_p << 1),
+				(uint32_t)u16Count_p << 1, (uint8_t*)&(mbMapping->tab_registers[u16Address_p]));
 		}
-	}
+		break;
 
+	default:
+		break;
+	}
+	if (successful < 0)
+	{
+		syslog(LOG_ERR, "write access to process image failed: %d\n", successful);
+	}
 	return successful;
 }
 
@@ -61,45 +86,55 @@ int32_t writeModbusDataToProcessImage(modbus_mapping_t* mbMapping, TProcessImage
 
 
 /*****************************************************************************/
-/** @ brief update the current modbus output data from device to pi process image
+/** @ brief update the modbus data requested by a read from the pi process image
  *  
  *	@param[in]	mbMapping the libmodbus mapping object with current modbus data
  *	@param[in]	ptrSPiProcessImageOffsets modbus slave parameter for the pi process image 
+ *	@param[in] eFunctionCode_p function code of the read request
+ *	@param[in] u16Address_p first input/register requested
+ *	@param[in] u16Count_p number of inputs/registers requested
  *
- *	@return '0' if processing was successful, otherwise a negative value
+ *	@return '0' if nothing was read, a positive value if processing was
+ *	        successful, otherwise a negative value
  *
  *	due to seperated input and output areas in the pi process image,
  *	data from pi process image(e.g. other device) can only be requested by
  *	the modbus functions READ_INPUT_REGISTERS and READ_DISCRETE_INPUTS
- *	therefor only for this modbus functions a read from the pi process image is performed
+ *	therefor only for this modbus functions a read from the pi process image is performed.
+ *	Only the requested inputs or registers are read.
  *
  */
 /*****************************************************************************/
-int32_t readModbusDataFromProcessImage(modbus_mapping_t* mbMapping, TProcessImageConfiguration* ptrSPiProcessImageOffsets)
+int32_t readModbusDataFromProcessImage(modbus_mapping_t* mbMapping, TProcessImageConfiguration* ptrSPiProcessImageOffsets,
+	EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p)
 {
 	int32_t successful = 0;	
-    
-	//read modbus discrete inputs data
-	if (mbMapping->nb_input_bits > 0)
+
+	switch (eFunctionCode_p)
 	{
-		successful = piControlRead(ptrSPiProcessImageOffsets->u32DiscreteInputsOffset, mbMapping->nb_input_bits >> 3, (uint8_t*)mbMapping->tab_input_bits);	
-		if (successful <= 0)
+	case eREAD_DISCRETE_INPUTS:
+		if (isRangeInArea(u16Address_p, u16Count_p, mbMapping->nb_input_bits))
 		{
-			syslog(LOG_ERR, "read access to process image failed: %d\n", successful);
-			return successful;
+			//libmodbus stores one bit per byte, the process image 8 bits per byte
+			successful = readProcessImageBits(ptrSPiProcessImageOffsets->u32DiscreteInputsOffset + (u16Address_p >> 3),
+				(uint8_t)(u16Address_p & 7), u16Count_p, &(mbMapping->tab_input_bits[u16Address_p]));
 		}
-	}
+		break;
 
-	//read modbus input registers data
-	if (mbMapping->nb_input_registers > 0)
-	{
-		successful = piControlRead(ptrSPiProcessImageOffsets->u32InputRegistersOffset, mbMapping->nb_input_registers << 1, (uint8_t*)mbMapping->tab_input_registers);	
-		if (successful <= 0)
+	case eREAD_INPUT_REGISTERS:
+		if (isRangeInArea(u16Address_p, u16Count_p, mbMapping->nb_input_registers))
 		{
-			syslog(LOG_ERR, "read access to process image failed: %d\n", successful);
-			return successful;
+			successful = readProcessImage(ptrSPiProcessImageOffsets->u32InputRegistersOffset + ((uint32_t)u16Address_p << 1),
+				(uint32_t)u16Count_p << 1, (uint8_t*)&(mbMapping->tab_input_registers[u16Address_p]));
 		}
+		break;
+
+	default:
+		break;
+	}
+	if (successful < 0)
+	{
+		syslog(LOG_ERR, "read access to process image failed: %d\n", successful);
 	}
-	
 	return successful;
 }
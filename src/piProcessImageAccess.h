@@ -15,8 +15,10 @@
 
 #include "modbusconfig.h"
 
-int32_t writeModbusDataToProcessImage(modbus_mapping_t* mbMapping, TProcessImageConfiguration* ptrSPiProcessImageOffsets);
-int32_t readModbusDataFromProcessImage(modbus_mapping_t* mbMapping, TProcessImageConfiguration* ptrSPiProcessImageOffsets);
+int32_t writeModbusDataToProcessImage(modbus_mapping_t* mbMapping, TProcessImageConfiguration* ptrSPiProcessImageOffsets,
+	EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p);
+int32_t readModbusDataFromProcessImage(modbus_mapping_t* mbMapping, TProcessImageConfiguration* ptrSPiProcessImageOffsets,
+	EModbusFunction eFunctionCode_p, uint16_t u16Address_p, uint16_t u16Count_p);
 
 
 #endif /* PI_PROCESS_IMAGE_ACCESS_H_ */